@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "ethercat.h"
+#ifdef EROB_SIM
+#include "erob_sim.h" // Simulated eRob slaves instead of the NIC (build with -DEROB_SIM)
+#endif
 #include <iostream>
 #include <inttypes.h>
 #include <time.h>
@@ -26,12 +29,24 @@
 
 #include <iostream>
 #include <cstdint>
+#include <atomic>
+#include <type_traits>
 
 #include <sched.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 // Global variables for EtherCAT communication
 char IOmap[4096]; // I/O mapping for EtherCAT
@@ -49,20 +64,28 @@ int64 toff, gl_delta; // Time offset and global delta for synchronization
 // Function prototypes for EtherCAT thread functions
 OSAL_THREAD_FUNC ecatcheck(void *ptr); // Function to check the state of EtherCAT slaves
 OSAL_THREAD_FUNC_RT ecatthread(void *ptr); // Real-time EtherCAT thread function
+OSAL_THREAD_FUNC logthread(void *ptr); // Non-RT thread that prints the RT log records
 
 // Thread handles for the EtherCAT threads
 OSAL_THREAD_HANDLE thread1; // Handle for the EtherCAT check thread
 OSAL_THREAD_HANDLE thread2; // Handle for the real-time EtherCAT thread
+OSAL_THREAD_HANDLE thread3; // Handle for the log drain thread
+pthread_t server_thread;    // Setpoint/telemetry server, if server_port is set
+bool server_started = false;
+std::atomic<bool> ecat_stop(false); // Asks the EtherCAT threads to exit (erob_stop)
 
 // Function to synchronize time with the EtherCAT distributed clock
 void ec_sync(int64 reftime, int64 cycletime, int64 *offsettime);
 // Function to add nanoseconds to a timespec structure
 void add_timespec(struct timespec *ts, int64 addtime);
+// Function to compute the difference (end - start) in nanoseconds
+int64 timespec_diff_ns(const struct timespec *start, const struct timespec *end);
 
 // Define constants for stack size and timing
 #define stack64k (64 * 1024) // Stack size for threads
 #define NSEC_PER_SEC 1000000000   // Number of nanoseconds in one second
 #define EC_TIMEOUTMON 5000        // Timeout for monitoring in microseconds
+#define MAX_AXES 64               // Maximum number of axes handled by ecatthread
 #define MAX_VELOCITY 30000        // Reduced maximum velocity (from 200000 to 30000)
 #define MAX_ACCELERATION 50000    // Reduced maximum acceleration (from 500000 to 50000)
 
@@ -70,96 +93,3135 @@ void add_timespec(struct timespec *ts, int64 addtime);
 float Cnt_to_deg = 0.000686645; // Conversion factor from counts to degrees
 int8_t SLAVE_ID; // Slave ID for EtherCAT communication
 
+// PDO layouts.
+// Each PDO is declared once as a list of entries X(index, subindex, bit length, type, field name).
+// The list generates the packed struct, the mapping words written to 0x1600/0x1A00, the field
+// names/offsets and compile-time size checks, so adding an object is a one-line change, e.g.
+//     X(0x60F4, 0x00, 32, int32_t, following_error)     /* Following error */
+// Padding entries use index 0x0000.
+
+// The mapping carries the targets of all three cyclic modes (CSP, CSV, CST) so the mode can be
+// switched through 0x6060 while in OP; remapping would require a trip through PRE-OP.
+
+// RXPDO 0x1600 (control data sent to the slave)
+#define RXPDO_ENTRIES(X) \
+    X(0x6040, 0x00, 16, uint16_t, controlword)          /* Control Word */ \
+    X(0x607A, 0x00, 32, int32_t, target_position)       /* Target Position (CSP) */ \
+    X(0x60FF, 0x00, 32, int32_t, target_velocity)       /* Target Velocity (CSV) */ \
+    X(0x6071, 0x00, 16, int16_t, target_torque)         /* Target Torque (CST) */ \
+    X(0x6060, 0x00, 8, uint8_t, mode_of_operation)      /* Mode of Operation */ \
+    X(0x0000, 0x00, 8, uint8_t, padding)                /* 8 bits padding */
+
+// TXPDO 0x1A00 (status data received from the slave)
+#define TXPDO_ENTRIES(X) \
+    X(0x6041, 0x00, 16, uint16_t, statusword)           /* Status Word */ \
+    X(0x6064, 0x00, 32, int32_t, actual_position)       /* Actual Position */ \
+    X(0x606C, 0x00, 32, int32_t, actual_velocity)       /* Actual Velocity */ \
+    X(0x6077, 0x00, 16, int16_t, actual_torque)         /* Actual Torque */ \
+    X(0x6061, 0x00, 8, uint8_t, mode_display)           /* Mode of Operation Display */ \
+    X(0x0000, 0x00, 8, uint8_t, padding)                /* 8 bits padding */
+
+#define PDO_FIELD(index, subindex, bits, type, name) type name;
+#define PDO_MAPPING_WORD(index, subindex, bits, type, name) \
+    (((uint32)(index) << 16) | ((uint32)(subindex) << 8) | (uint32)(bits)),
+#define PDO_FIELD_NAME(index, subindex, bits, type, name) #name,
+#define PDO_FIELD_SIGNED(index, subindex, bits, type, name) std::is_signed<type>::value,
+#define PDO_CHECK_TYPE(index, subindex, bits, type, name) \
+    static_assert((bits) == 8 * sizeof(type), "PDO entry " #name ": bit length does not match its type");
+
 // Structure for RXPDO (Control data sent to slave)
 typedef struct {
-    uint16_t controlword;      // 0x6040:0, 16 bits
-    int32_t target_position;   // 0x607A:0, 32 bits
-    uint8_t mode_of_operation; // 0x6060:0, 8 bits
-    uint8_t padding;           // 8 bits padding for alignment
+    RXPDO_ENTRIES(PDO_FIELD)
 } __attribute__((__packed__)) rxpdo_t;
 
-// Structure for TXPDO (Status data received from slave)
-typedef struct {
-    uint16_t statusword;      // 0x6041:0, 16 bits
-    int32_t actual_position;  // 0x6064:0, 32 bits
-    int32_t actual_velocity;  // 0x606C:0, 32 bits
-    int16_t actual_torque;    // 0x6077:0, 16 bits
-} __attribute__((__packed__)) txpdo_t;
+// Structure for TXPDO (Status data received from slave)
+typedef struct {
+    TXPDO_ENTRIES(PDO_FIELD)
+} __attribute__((__packed__)) txpdo_t;
+
+// Mapping words (index << 16 | subindex << 8 | bit length) and field names, in PDO order
+constexpr uint32 rxpdo_mapping[] = {RXPDO_ENTRIES(PDO_MAPPING_WORD)};
+constexpr uint32 txpdo_mapping[] = {TXPDO_ENTRIES(PDO_MAPPING_WORD)};
+constexpr const char *rxpdo_names[] = {RXPDO_ENTRIES(PDO_FIELD_NAME)};
+constexpr const char *txpdo_names[] = {TXPDO_ENTRIES(PDO_FIELD_NAME)};
+constexpr bool rxpdo_signed[] = {RXPDO_ENTRIES(PDO_FIELD_SIGNED)};
+constexpr bool txpdo_signed[] = {TXPDO_ENTRIES(PDO_FIELD_SIGNED)};
+
+// Number of entries in a mapping
+template <size_t N>
+constexpr int pdo_entry_count(const uint32 (&)[N]) {
+    return (int)N;
+}
+
+// Byte offset of entry `entry` in the process image (sum of the preceding bit lengths)
+template <size_t N>
+constexpr uint32 pdo_entry_offset(const uint32 (&mapping)[N], size_t entry) {
+    uint32 bits = 0;
+    for (size_t k = 0; k < entry && k < N; k++) {
+        bits += mapping[k] & 0xFF;
+    }
+    return bits / 8;
+}
+
+// Total image size in bytes
+template <size_t N>
+constexpr uint32 pdo_image_size(const uint32 (&mapping)[N]) {
+    return pdo_entry_offset(mapping, N);
+}
+
+RXPDO_ENTRIES(PDO_CHECK_TYPE)
+TXPDO_ENTRIES(PDO_CHECK_TYPE)
+static_assert(pdo_image_size(rxpdo_mapping) == sizeof(rxpdo_t), "RXPDO mapping and rxpdo_t differ in size");
+static_assert(pdo_image_size(txpdo_mapping) == sizeof(txpdo_t), "TXPDO mapping and txpdo_t differ in size");
+
+// Add in the global variable declaration section at the beginning of the file
+rxpdo_t rxpdo;  // Global variable, used for sending data to slaves
+txpdo_t txpdo;  // Global variable, used for receiving data from slaves
+
+// 在全局变量区域添加
+struct MotorStatus {
+    bool is_operational;
+    uint16_t status_word;
+    int32_t actual_position;
+    int32_t actual_velocity;
+    int16_t actual_torque;
+} motor_status;
+
+void update_motor_status(int slave_id);  // Add function declaration
+
+// 在文件开头，其他宏定义之后添加
+#undef MAX_VELOCITY  // Ensure there are no naming conflicts
+#undef MAX_ACCELERATION
+
+// Trajectory generation mode of a MotionPlanner
+enum PlannerMode : uint8_t {
+    PLANNER_QUINTIC, // Quintic segment planned once per move (plan_quintic)
+    PLANNER_ONLINE,  // Jerk-limited online generator recomputed every cycle (online_step)
+    PLANNER_MODE_COUNT
+};
+
+const char *planner_mode_names[PLANNER_MODE_COUNT] = {"quintic", "online"};
+
+// 在全局变量声明区域添加
+struct MotionPlanner {
+    int32_t start_position;    // Start position
+    int32_t target_position;   // Final target position (requested)
+    int32_t smooth_target;     // Target the active quintic segment was planned for
+    int32_t current_position;  // Current planned position
+    double current_velocity;   // Current velocity (counts/s)
+    double current_acceleration; // Current acceleration (counts/s^2)
+    double planned_position;   // Unrounded planned position
+    double start_time;         // Start time
+    double total_time;         // Total time
+    double current_time;       // Current time
+    bool is_moving;            // Movement state
+    bool seeded;               // Planner state has been initialized from the actual position
+    uint32_t revision;         // Incremented whenever the coefficients change
+    uint8_t mode;              // PlannerMode, only changed while the axis is not enabled
+    
+    // Motion parameters
+    static constexpr double MAX_VELOCITY = 50000.0;     // Maximum velocity limit
+    static constexpr double MAX_ACCELERATION = 50000.0; // Maximum acceleration limit
+    static constexpr double MAX_JERK = 500000.0;        // Maximum jerk limit (online mode)
+    static double CYCLE_TIME;                             // Cycle time (s), set by config_apply()
+    static constexpr double SMOOTH_FACTOR = 0.002;        // Smoothing factor for target position
+
+    // Quintic polynomial coefficients
+    double a0, a1, a2, a3, a4, a5;
+
+    MotionPlanner() : start_position(0), target_position(0), smooth_target(0),
+                      current_position(0), current_velocity(0.0), current_acceleration(0.0),
+                      planned_position(0.0), start_time(0.0), total_time(0.0), current_time(0.0),
+                      is_moving(false), seeded(false), revision(0), mode(PLANNER_QUINTIC),
+                      a0(0.0), a1(0.0), a2(0.0), a3(0.0), a4(0.0), a5(0.0) {}
+};
+
+// Define static member variables
+constexpr double MotionPlanner::MAX_VELOCITY;
+constexpr double MotionPlanner::MAX_ACCELERATION;
+constexpr double MotionPlanner::MAX_JERK;
+double MotionPlanner::CYCLE_TIME = 0.0005; // 500us until a configuration is applied
+constexpr double MotionPlanner::SMOOTH_FACTOR;
+
+// Global variable, one planner per axis
+MotionPlanner g_motion_planner[MAX_AXES];
+uint8_t g_planner_mode = PLANNER_QUINTIC; // Mode given to every axis planner by axes_init(), set by config_apply()
+
+// Function declaration
+int32_t plan_trajectory(MotionPlanner* planner, int32_t actual_position);
+void planner_reset(MotionPlanner* planner, int32_t position);
+void planner_seed(MotionPlanner* planner, int32_t position, double velocity);
+
+// Batched evaluation of all axis trajectories (structure-of-arrays coefficients)
+struct TrajectoryBatch;
+extern TrajectoryBatch g_trajectory_batch;
+void trajectory_step_all(MotionPlanner *planners, const int32_t *actual_position, int count,
+                         TrajectoryBatch *b, int steps);
+
+// Fault injection (hooks are empty unless built with EROB_FAULT_INJECTION)
+bool fault_load(const char *path);
+void fault_print(FILE *out);
+const char *fault_kind_name(int kind);
+
+// Next transfer of the PDO mapping for a slave being reconfigured (batched SDO configuration)
+bool pdo_mapping_step(uint16 slave, int *next, bool *complete_access);
+
+// 在其他函数声明之后，添加这些函数声明
+void* start_server(void* arg);
+
+//##################################################################################################
+// Distributed clock synchronisation.
+// ecatthread moves its next wake-up by `toff` so that its frames keep a fixed phase to the DC
+// reference clock. The phase error is delta = reftime mod cycle, centred on 0. A correction moves
+// every later wake-up, so the plant is an integrator:
+//     delta[k+1] = delta[k] + toff[k] + drift per cycle
+// dc_sync_update() is a PI controller on delta in double precision; its integral term converges
+// to the drift between the clocks, the proportional term removes the phase error.
+//  - Two gain sets: ACQUIRE (fast lock) until the filtered phase error stays within lock_ns for
+//    lock_cycles cycles, then LOCKED (fine lock, low bandwidth so wake-up jitter is filtered).
+//    While locked, phase errors are clamped to clamp_ns so a late wake-up moves the schedule by
+//    at most kp * clamp_ns; a filtered error above 2 * lock_ns for unlock_cycles cycles returns
+//    to ACQUIRE. The integral is rescaled on a gain change so the drift estimate carries over.
+//  - Anti-windup: the drift estimate is clamped to max_drift_ppm and the integral is held while
+//    the correction is at its limit (max_step of the cycle).
+//  - The fraction of a nanosecond the integer toff cannot express is carried to the next cycle.
+// The loop is stable for 0 < kp < 2, ki > 0 and 2 kp + ki < 4; config_validate() checks this.
+
+enum DcSyncState : uint8_t {
+    DC_UNSYNCED,  // No DC time received yet
+    DC_ACQUIRE,   // Fast lock gains
+    DC_LOCKED     // Fine lock gains
+};
+
+const char *dc_sync_state_names[] = {"unsynced", "acquire", "locked"};
+
+struct DcSyncParams {
+    double kp_acquire;     // Proportional gain while acquiring
+    double ki_acquire;     // Integral gain while acquiring
+    double kp_lock;        // Proportional gain once locked
+    double ki_lock;        // Integral gain once locked
+    double lock_ns;        // Filtered |phase error| below which the loop counts as locked
+    int lock_cycles;       // Cycles the filtered error must stay within lock_ns
+    double clamp_ns;       // Largest phase error the locked loop acts on (late wake-ups)
+    int unlock_cycles;     // Cycles the filtered error must exceed 2 * lock_ns to lose the lock
+    double max_drift_ppm;  // Largest clock drift the integral may represent
+    double max_step;       // Largest correction per cycle, as a fraction of the cycle time
+};
+
+#define DC_SYNC_DEFAULTS {0.3, 0.02, 0.02, 0.0001, 1000.0, 200, 5000.0, 200, 500.0, 0.05}
+
+// Lock state and offset metrics, published with the telemetry snapshot
+struct DcSyncStatus {
+    uint8_t state;           // DcSyncState
+    int32_t delta_ns;        // Phase error of the last frame
+    int32_t offset_ns;       // Filtered phase error (about 64 cycles)
+    int32_t correction_ns;   // toff applied to the next wake-up
+    float drift_ppm;         // Clock drift estimated by the integral
+    uint32_t locked_cycles;  // Cycles since the lock was reached, 0 while not locked
+    uint32_t time_to_lock;   // Cycles the last acquisition took
+    uint32_t locks;          // Number of times the lock was reached
+    int32_t max_locked_ns;   // Largest |phase error| seen while locked
+};
+
+struct DcSync {
+    DcSyncParams params;
+    DcSyncStatus status;
+    double integral;         // Sum of phase errors (ns * cycles) under the current ki
+    double residue;          // Fraction of the correction not applied yet (ns)
+    double filtered;         // Exponential average of the phase error (ns)
+    int in_band;             // Consecutive cycles with |filtered| <= lock_ns
+    int out_band;            // Consecutive cycles with |filtered| > 2 * lock_ns
+    uint32_t acquire_cycles; // Cycles since the acquisition started
+};
+
+void dc_sync_reset(DcSync *dc, const DcSyncParams *params) {
+    memset(dc, 0, sizeof(*dc));
+    dc->params = *params;
+    dc->status.state = DC_UNSYNCED;
+}
+
+/*
+ * One controller step for the DC time of the last frame. Returns the correction (ns) to add to the
+ * next cycle's wake-up time.
+ */
+int64 dc_sync_update(DcSync *dc, int64 reftime, int64 cycletime) {
+    const DcSyncParams &p = dc->params;
+    DcSyncStatus &s = dc->status;
+    int64 delta = reftime % cycletime;
+    if (delta > cycletime / 2) {
+        delta -= cycletime;
+    } else if (delta < -cycletime / 2) {
+        delta += cycletime;
+    }
+
+    if (s.state == DC_UNSYNCED) {
+        s.state = DC_ACQUIRE;
+        dc->filtered = (double)delta;
+    }
+    double error = (double)delta;
+    if (s.state == DC_LOCKED) {
+        error = fmin(fmax(error, -p.clamp_ns), p.clamp_ns);
+    }
+    dc->filtered += (error - dc->filtered) / 64.0;
+    dc->acquire_cycles++;
+
+    // Lock detection
+    if (s.state == DC_ACQUIRE) {
+        dc->in_band = fabs(dc->filtered) <= p.lock_ns ? dc->in_band + 1 : 0;
+        if (dc->in_band >= p.lock_cycles) {
+            s.state = DC_LOCKED;
+            s.time_to_lock = dc->acquire_cycles;
+            s.locks++;
+            s.locked_cycles = 0;
+            s.max_locked_ns = 0;
+            dc->out_band = 0;
+            dc->integral *= p.ki_acquire / p.ki_lock; // Keep ki * integral (the drift estimate)
+        }
+    } else {
+        dc->out_band = fabs(dc->filtered) > 2.0 * p.lock_ns ? dc->out_band + 1 : 0;
+        if (dc->out_band >= p.unlock_cycles) {
+            s.state = DC_ACQUIRE;
+            s.locked_cycles = 0;
+            dc->in_band = 0;
+            dc->acquire_cycles = 0;
+            dc->integral *= p.ki_lock / p.ki_acquire;
+        } else {
+            s.locked_cycles++;
+            int32_t magnitude = (int32_t)(delta < 0 ? -delta : delta);
+            if (magnitude > s.max_locked_ns) {
+                s.max_locked_ns = magnitude;
+            }
+        }
+    }
+    double kp = s.state == DC_LOCKED ? p.kp_lock : p.kp_acquire;
+    double ki = s.state == DC_LOCKED ? p.ki_lock : p.ki_acquire;
+
+    // PI with a clamped drift estimate and conditional integration
+    double max_step = p.max_step * cycletime;
+    double max_integral = p.max_drift_ppm * 1e-6 * cycletime / ki;
+    double integral = fmin(fmax(dc->integral + error, -max_integral), max_integral);
+    double correction = -(kp * error + ki * integral);
+    if (correction > max_step || correction < -max_step) {
+        if ((error > 0) == (correction < 0)) {
+            integral = dc->integral; // Integrating would push further into the limit
+        }
+        correction = correction > 0 ? max_step : -max_step;
+    }
+    dc->integral = integral;
+
+    // Carry the sub-nanosecond part to the next cycle
+    double total = correction + dc->residue;
+    int64 offset = llround(total);
+    dc->residue = total - (double)offset;
+
+    s.delta_ns = (int32_t)delta;
+    s.offset_ns = (int32_t)lround(dc->filtered);
+    s.correction_ns = (int32_t)offset;
+    s.drift_ppm = (float)(ki * dc->integral / cycletime * 1e6); // Reference clock rate against ours
+    return offset;
+}
+
+// True without DC or while locked with the filtered phase error inside the lock band
+bool dc_sync_settled(const DcSync *dc) {
+    return dc->status.state == DC_UNSYNCED ||
+           (dc->status.state == DC_LOCKED && fabs(dc->filtered) <= dc->params.lock_ns);
+}
+
+DcSync g_dc_sync; // Controller of ecatthread, reset at the start of ecat_loop
+
+//##################################################################################################
+// Runtime configuration.
+// Everything that differs between cells (interface, cycle time, DC SYNC0, scheduling, axes) is
+// read from a text file instead of being compiled in. One "key = value" per line, '#' starts a
+// comment:
+//     ifname = enp58s0
+//     cycle_us = 500          # 125 .. 2000, below 250 only with wait = hybrid or spin
+//     sync0_us = 500          # optional, must equal cycle_us
+//     sync0_shift_us = 0
+//     rt_priority = 99        # SCHED_FIFO priority of the process and of ecatthread
+//     cpu_main = auto         # a CPU number, "auto" (topology_plan decides) or "none"
+//     cpu_ecat = auto
+//     cpu_check = auto
+//     cpu_log = auto
+//     irq_steer = 0           # 1: move the NIC interrupts and RPS/XPS to the ecatthread CPU
+//     wait = sleep            # sleep, hybrid (sleep, then spin the last spin_us) or spin
+//     spin_us = 50
+//     send_budget_us = 250    # wake-up to send; optional work is shed beyond it (0 = half the cycle)
+//     dc_kp_acquire = 0.3     # DC synchronisation gains and lock window (see DcSyncParams)
+//     dc_ki_acquire = 0.02
+//     dc_kp_lock = 0.02
+//     dc_ki_lock = 0.0001
+//     dc_lock_ns = 1000
+//     dc_max_drift_ppm = 500
+//     planner = quintic       # quintic (one segment per move) or online (jerk-limited, every cycle)
+//     axes = 1-4 6            # slave positions, default one axis per slave found
+// config_validate() checks the values against each other before anything touches the network.
+
+#define EROB_CONFIG_FILE "erob.conf" // Read by main when no --config is given (optional)
+#define CONFIG_MIN_CYCLE_US 125
+#define CONFIG_MIN_SLEEP_CYCLE_US 250 // Shortest cycle clock_nanosleep alone can hold
+#define CONFIG_MAX_CYCLE_US 2000
+#define CONFIG_MAX_SERVER_BATCH 64 // Telemetry samples per server datagram
+#define CONFIG_SERVER_BIND_DEFAULT "127.0.0.1" // The server accepts setpoints from this host only
+#define CPU_AUTO -1 // CPU chosen by topology_plan()
+#define CPU_NONE -2 // Thread is not pinned
+
+// How ecatthread waits for the next cycle (cycle_wait)
+enum WaitStrategy : uint8_t {
+    WAIT_SLEEP,  // clock_nanosleep to the deadline: no CPU cost, wake-up error of the timer path
+    WAIT_HYBRID, // clock_nanosleep to spin_us before the deadline, then poll the clock
+    WAIT_SPIN,   // Poll the clock for the whole cycle; needs an isolated CPU
+    WAIT_STRATEGY_COUNT
+};
+
+const char *wait_strategy_names[WAIT_STRATEGY_COUNT] = {"sleep", "hybrid", "spin"};
+
+struct RuntimeConfig {
+    char ifname[64];              // Network interface of the EtherCAT port
+    int cycle_us;                 // Cycle time of ecatthread (us)
+    int sync0_us;                 // DC SYNC0 period (us), 0 = follow cycle_us
+    int sync0_shift_us;           // DC SYNC0 shift (us)
+    int rt_priority;              // SCHED_FIFO priority of the process and of ecatthread
+    int cpu_main;                 // CPU of the process/main thread, or CPU_AUTO / CPU_NONE
+    int cpu_ecat;                 // CPU of ecatthread
+    int cpu_check;                // CPU of ecatcheck
+    int cpu_log;                  // CPU of logthread
+    int irq_steer;                // Non-zero: steer the NIC interrupts to cpu_ecat
+    int wait_strategy;            // WaitStrategy of ecatthread
+    int spin_us;                  // WAIT_HYBRID: time spent polling before the deadline (us)
+    int send_budget_us;           // Wake-up to send, see CycleBudget (us), 0 = half the cycle
+    int server_port;              // UDP port of the setpoint/telemetry server, 0 = no server
+    char server_bind[INET_ADDRSTRLEN]; // IPv4 address the server binds to
+    int server_batch;             // Telemetry samples per server datagram
+    int planner_mode;             // PlannerMode of every axis
+    int axis_count;               // Number of entries in axis_slave, 0 = one axis per slave
+    uint16_t axis_slave[MAX_AXES]; // Slave position of each axis
+    DcSyncParams dc;              // DC synchronisation controller
+};
+
+// Values used when the file does not set them (the former hard-coded settings)
+RuntimeConfig g_config = {"enp58s0", 500, 0, 0, 99, CPU_AUTO, CPU_AUTO, CPU_AUTO, CPU_AUTO, 0,
+                          WAIT_SLEEP, 50, 0, 0, CONFIG_SERVER_BIND_DEFAULT, 10, PLANNER_QUINTIC, 0, {0},
+                          DC_SYNC_DEFAULTS};
+
+// Parse an integer that must fill the whole token
+static bool config_parse_int(const char *text, int *value) {
+    char *end;
+    errno = 0;
+    long v = strtol(text, &end, 0);
+    if (end == text || *end != '\0' || errno != 0 || v < INT_MIN || v > INT_MAX) {
+        return false;
+    }
+    *value = (int)v;
+    return true;
+}
+
+static bool config_parse_double(const char *text, double *value) {
+    char *end;
+    errno = 0;
+    double v = strtod(text, &end);
+    if (end == text || *end != '\0' || errno != 0 || !isfinite(v)) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+// "1 2 5-8" or "1,2,5-8"
+static bool config_parse_axes(char *text, RuntimeConfig *config) {
+    config->axis_count = 0;
+    for (char *token = strtok(text, " \t,"); token != NULL; token = strtok(NULL, " \t,")) {
+        int first, last;
+        char *dash = strchr(token + 1, '-');
+        if (dash != NULL) {
+            *dash = '\0';
+            if (!config_parse_int(token, &first) || !config_parse_int(dash + 1, &last)) {
+                return false;
+            }
+        } else if (!config_parse_int(token, &first)) {
+            return false;
+        } else {
+            last = first;
+        }
+        for (int slave = first; slave <= last; slave++) {
+            if (config->axis_count >= MAX_AXES || slave < 1 || slave >= EC_MAXSLAVE) {
+                return false;
+            }
+            config->axis_slave[config->axis_count++] = (uint16_t)slave;
+        }
+    }
+    return config->axis_count > 0;
+}
+
+static char *config_trim(char *text) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    char *end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) {
+        *--end = '\0';
+    }
+    return text;
+}
+
+/*
+ * Read `path` into config (keys not in the file keep their value). Returns 0 on success, 1 if
+ * the file does not exist and -1 on a read or syntax error, which is printed with its line.
+ */
+int config_load(RuntimeConfig *config, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return errno == ENOENT ? 1 : -1;
+    }
+    char line[256];
+    int line_number = 0;
+    int errors = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *equal = strchr(line, '=');
+        char *key = config_trim(line);
+        if (*key == '\0') {
+            continue;
+        }
+        if (equal == NULL) {
+            printf("%s:%d: expected key = value\n", path, line_number);
+            errors++;
+            continue;
+        }
+        *equal = '\0';
+        key = config_trim(key);
+        char *value = config_trim(equal + 1);
+
+        int *number = NULL;
+        int *cpu = NULL;
+        double *real = NULL;
+        if (strcmp(key, "cycle_us") == 0) number = &config->cycle_us;
+        else if (strcmp(key, "sync0_us") == 0) number = &config->sync0_us;
+        else if (strcmp(key, "sync0_shift_us") == 0) number = &config->sync0_shift_us;
+        else if (strcmp(key, "rt_priority") == 0) number = &config->rt_priority;
+        else if (strcmp(key, "irq_steer") == 0) number = &config->irq_steer;
+        else if (strcmp(key, "spin_us") == 0) number = &config->spin_us;
+        else if (strcmp(key, "send_budget_us") == 0) number = &config->send_budget_us;
+        else if (strcmp(key, "server_port") == 0) number = &config->server_port;
+        else if (strcmp(key, "server_batch") == 0) number = &config->server_batch;
+        else if (strcmp(key, "cpu_main") == 0) cpu = &config->cpu_main;
+        else if (strcmp(key, "cpu_ecat") == 0) cpu = &config->cpu_ecat;
+        else if (strcmp(key, "cpu_check") == 0) cpu = &config->cpu_check;
+        else if (strcmp(key, "cpu_log") == 0) cpu = &config->cpu_log;
+        else if (strcmp(key, "dc_kp_acquire") == 0) real = &config->dc.kp_acquire;
+        else if (strcmp(key, "dc_ki_acquire") == 0) real = &config->dc.ki_acquire;
+        else if (strcmp(key, "dc_kp_lock") == 0) real = &config->dc.kp_lock;
+        else if (strcmp(key, "dc_ki_lock") == 0) real = &config->dc.ki_lock;
+        else if (strcmp(key, "dc_lock_ns") == 0) real = &config->dc.lock_ns;
+        else if (strcmp(key, "dc_max_drift_ppm") == 0) real = &config->dc.max_drift_ppm;
+
+        bool ok;
+        if (number != NULL) {
+            ok = config_parse_int(value, number);
+        } else if (real != NULL) {
+            ok = config_parse_double(value, real);
+        } else if (cpu != NULL) {
+            ok = true;
+            if (strcmp(value, "auto") == 0) {
+                *cpu = CPU_AUTO;
+            } else if (strcmp(value, "none") == 0) {
+                *cpu = CPU_NONE;
+            } else {
+                ok = config_parse_int(value, cpu) && *cpu >= 0;
+            }
+        } else if (strcmp(key, "ifname") == 0) {
+            ok = *value != '\0' && strlen(value) < sizeof(config->ifname);
+            if (ok) {
+                strcpy(config->ifname, value);
+            }
+        } else if (strcmp(key, "server_bind") == 0) {
+            ok = *value != '\0' && strlen(value) < sizeof(config->server_bind);
+            if (ok) {
+                strcpy(config->server_bind, value);
+            }
+        } else if (strcmp(key, "wait") == 0) {
+            ok = false;
+            for (int w = 0; w < WAIT_STRATEGY_COUNT; w++) {
+                if (strcmp(value, wait_strategy_names[w]) == 0) {
+                    config->wait_strategy = w;
+                    ok = true;
+                }
+            }
+        } else if (strcmp(key, "planner") == 0) {
+            ok = false;
+            for (int m = 0; m < PLANNER_MODE_COUNT; m++) {
+                if (strcmp(value, planner_mode_names[m]) == 0) {
+                    config->planner_mode = m;
+                    ok = true;
+                }
+            }
+        } else if (strcmp(key, "axes") == 0) {
+            ok = config_parse_axes(value, config);
+        } else {
+            printf("%s:%d: unknown key '%s'\n", path, line_number, key);
+            errors++;
+            continue;
+        }
+        if (!ok) {
+            printf("%s:%d: invalid value '%s' for %s\n", path, line_number, value, key);
+            errors++;
+        }
+    }
+    fclose(file);
+    return errors == 0 ? 0 : -1;
+}
+
+// Check a CPU number against the CPUs of this machine
+static bool config_cpu_valid(const char *name, int cpu) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpu < CPU_NONE || cpu >= CPU_SETSIZE || (cpus > 0 && cpu >= cpus)) {
+        printf("config: %s = %d, this machine has CPUs 0..%ld\n", name, cpu, cpus - 1);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Check the values on their own and against each other. Prints every problem and returns the
+ * number of errors. How the CPUs fit the machine's isolation is reported by topology_plan().
+ */
+int config_validate(RuntimeConfig *config) {
+    int errors = 0;
+    if (config->ifname[0] == '\0') {
+        printf("config: ifname is empty\n");
+        errors++;
+    }
+    if (config->cycle_us < CONFIG_MIN_CYCLE_US || config->cycle_us > CONFIG_MAX_CYCLE_US) {
+        printf("config: cycle_us = %d, must be %d..%d\n", config->cycle_us, CONFIG_MIN_CYCLE_US,
+               CONFIG_MAX_CYCLE_US);
+        errors++;
+    }
+    if (config->cycle_us < CONFIG_MIN_SLEEP_CYCLE_US && config->wait_strategy == WAIT_SLEEP) {
+        printf("config: cycle_us = %d needs wait = hybrid or spin, clock_nanosleep alone is only "
+               "used down to %d us\n", config->cycle_us, CONFIG_MIN_SLEEP_CYCLE_US);
+        errors++;
+    }
+    if (config->wait_strategy == WAIT_HYBRID &&
+        (config->spin_us <= 0 || config->spin_us >= config->cycle_us)) {
+        printf("config: spin_us = %d, must be 1..%d\n", config->spin_us, config->cycle_us - 1);
+        errors++;
+    }
+    if (config->wait_strategy == WAIT_SPIN && config->cpu_ecat == CPU_NONE) {
+        printf("config: wait = spin needs a CPU of its own for ecatthread (cpu_ecat = none)\n");
+        errors++;
+    }
+    if (config->send_budget_us < 0 || config->send_budget_us > config->cycle_us) {
+        printf("config: send_budget_us = %d, must be 1..%d (0 = half the cycle)\n", config->send_budget_us,
+               config->cycle_us);
+        errors++;
+    }
+    if (config->server_port < 0 || config->server_port > 65535) {
+        printf("config: server_port = %d, must be 1..65535 (0 = no server)\n", config->server_port);
+        errors++;
+    }
+    struct in_addr bind_address;
+    if (inet_pton(AF_INET, config->server_bind, &bind_address) != 1) {
+        printf("config: server_bind = %s, must be an IPv4 address\n", config->server_bind);
+        errors++;
+    } else if (config->server_port != 0 && ntohl(bind_address.s_addr) != INADDR_LOOPBACK) {
+        printf("config: warning: server_bind = %s accepts setpoints from any host that can reach "
+               "UDP port %d, without authentication\n", config->server_bind, config->server_port);
+    }
+    if (config->server_batch < 1 || config->server_batch > CONFIG_MAX_SERVER_BATCH) {
+        printf("config: server_batch = %d, must be 1..%d\n", config->server_batch, CONFIG_MAX_SERVER_BATCH);
+        errors++;
+    }
+    if (config->planner_mode < 0 || config->planner_mode >= PLANNER_MODE_COUNT) {
+        printf("config: planner = %d, must be quintic or online\n", config->planner_mode);
+        errors++;
+    }
+    if (config->sync0_us == 0) {
+        config->sync0_us = config->cycle_us; // SYNC0 follows the cycle unless set explicitly
+    } else if (config->sync0_us != config->cycle_us) {
+        printf("config: sync0_us = %d differs from cycle_us = %d; the drives would sample at a "
+               "different rate than the frames are sent\n", config->sync0_us, config->cycle_us);
+        errors++;
+    }
+    if (config->sync0_shift_us < 0 || config->sync0_shift_us >= config->cycle_us) {
+        printf("config: sync0_shift_us = %d, must be 0..%d\n", config->sync0_shift_us,
+               config->cycle_us - 1);
+        errors++;
+    }
+    int priority_max = sched_get_priority_max(SCHED_FIFO);
+    int priority_min = sched_get_priority_min(SCHED_FIFO);
+    if (config->rt_priority < priority_min || config->rt_priority > priority_max) {
+        printf("config: rt_priority = %d, must be %d..%d\n", config->rt_priority, priority_min,
+               priority_max);
+        errors++;
+    }
+    errors += !config_cpu_valid("cpu_main", config->cpu_main);
+    errors += !config_cpu_valid("cpu_ecat", config->cpu_ecat);
+    errors += !config_cpu_valid("cpu_check", config->cpu_check);
+    errors += !config_cpu_valid("cpu_log", config->cpu_log);
+    if (config->irq_steer && config->cpu_ecat == CPU_NONE) {
+        printf("config: irq_steer needs a CPU for ecatthread (cpu_ecat = none)\n");
+        errors++;
+    }
+    const struct { const char *name; double kp, ki; } gains[] = {
+        {"acquire", config->dc.kp_acquire, config->dc.ki_acquire},
+        {"lock", config->dc.kp_lock, config->dc.ki_lock}
+    };
+    for (const auto &g : gains) {
+        if (!(g.kp > 0.0 && g.kp < 2.0 && g.ki > 0.0 && 2.0 * g.kp + g.ki < 4.0)) {
+            printf("config: dc_kp_%s = %g, dc_ki_%s = %g make the DC loop unstable "
+                   "(need 0 < kp < 2, ki > 0, 2 kp + ki < 4)\n", g.name, g.kp, g.name, g.ki);
+            errors++;
+        }
+    }
+    if (config->dc.lock_ns <= 0.0 || 2.0 * config->dc.lock_ns >= config->dc.clamp_ns) {
+        printf("config: dc_lock_ns = %g, must be above 0 and below %g\n", config->dc.lock_ns,
+               config->dc.clamp_ns / 2.0);
+        errors++;
+    }
+    if (config->dc.max_drift_ppm <= 0.0) {
+        printf("config: dc_max_drift_ppm must be positive\n");
+        errors++;
+    }
+    for (int a = 0; a < config->axis_count; a++) {
+        for (int b = 0; b < a; b++) {
+            if (config->axis_slave[a] == config->axis_slave[b]) {
+                printf("config: slave %u is listed twice in axes\n", config->axis_slave[a]);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+// Make the validated configuration the one the threads and the planners run with
+void config_apply(const RuntimeConfig *config) {
+    ctime_thread = config->cycle_us;
+    MotionPlanner::CYCLE_TIME = config->cycle_us * 1e-6;
+    g_planner_mode = (uint8_t)config->planner_mode; // Taken by the axes at the next bring-up
+}
+
+static void config_print_cpu(FILE *file, const char *name, int cpu) {
+    if (cpu == CPU_AUTO) {
+        fprintf(file, "%s = auto\n", name);
+    } else if (cpu == CPU_NONE) {
+        fprintf(file, "%s = none\n", name);
+    } else {
+        fprintf(file, "%s = %d\n", name, cpu);
+    }
+}
+
+void config_print(FILE *file, const RuntimeConfig *config) {
+    fprintf(file, "ifname = %s\ncycle_us = %d\nsync0_us = %d\nsync0_shift_us = %d\nrt_priority = %d\n",
+            config->ifname, config->cycle_us, config->sync0_us, config->sync0_shift_us,
+            config->rt_priority);
+    config_print_cpu(file, "cpu_main", config->cpu_main);
+    config_print_cpu(file, "cpu_ecat", config->cpu_ecat);
+    config_print_cpu(file, "cpu_check", config->cpu_check);
+    config_print_cpu(file, "cpu_log", config->cpu_log);
+    fprintf(file, "irq_steer = %d\nwait = %s\nspin_us = %d\nsend_budget_us = %d\n", config->irq_steer,
+            wait_strategy_names[config->wait_strategy], config->spin_us, config->send_budget_us);
+    fprintf(file, "server_port = %d\nserver_bind = %s\nserver_batch = %d\n", config->server_port,
+            config->server_bind, config->server_batch);
+    fprintf(file, "dc_kp_acquire = %g\ndc_ki_acquire = %g\ndc_kp_lock = %g\ndc_ki_lock = %g\n",
+            config->dc.kp_acquire, config->dc.ki_acquire, config->dc.kp_lock, config->dc.ki_lock);
+    fprintf(file, "dc_lock_ns = %g\ndc_max_drift_ppm = %g\nplanner = %s\naxes =", config->dc.lock_ns,
+            config->dc.max_drift_ppm, planner_mode_names[config->planner_mode]);
+    if (config->axis_count == 0) {
+        fprintf(file, " # one per slave");
+    }
+    for (int a = 0; a < config->axis_count; a++) {
+        fprintf(file, " %u", config->axis_slave[a]);
+    }
+    fprintf(file, "\n");
+}
+
+//##################################################################################################
+// Cycle budget.
+// ecatthread has send_budget_us from the scheduled wake-up until its frame must be on the wire.
+// Mandatory work (receive, CiA402 state machines, outputs, DC sync, send) always runs. Optional
+// work only runs if its expected cost still fits: trajectory planning before the send (the targets
+// are extrapolated from the last planned velocity instead, and the planners catch up at the next
+// planned cycle), telemetry and the status log after the send, before the next wake-up. A late
+// cycle therefore still sends its frame early instead of pushing the whole cycle back, and the bus
+// stays in OP through transient load. A wake-up more than a whole cycle late drops the missed
+// cycles (keeping the phase) instead of running them back to back. Every shed stage and dropped
+// cycle is counted.
+
+#define BUDGET_MAX_PLAN_LAG 8 // Consecutive shed planning cycles before planning runs regardless
+
+enum CycleStage {
+    STAGE_PLANNING,   // trajectory_step_all (before the send)
+    STAGE_TELEMETRY,  // fill_telemetry + seqlock store (after the send)
+    STAGE_STATUS_LOG, // Periodic status records (after the send)
+    CYCLE_STAGE_COUNT
+};
+
+const char *cycle_stage_names[CYCLE_STAGE_COUNT] = {"planning", "telemetry", "status log"};
+
+struct CycleBudget {
+    int64 send_ns;                     // Wake-up deadline to send
+    int64 cycle_ns;                    // Wake-up deadline to the next one
+    int64 start_ns;                    // Wake-up deadline of the current cycle
+    int64 stage_start_ns;              // Start of the optional stage in progress
+    int64 tail_ns;                     // Expected cost of the mandatory work after planning
+    int64 cost_ns[CYCLE_STAGE_COUNT];  // Expected cost of each optional stage
+    std::atomic<uint32_t> shed[CYCLE_STAGE_COUNT]; // Times each stage was skipped
+    std::atomic<uint32_t> late;        // Cycles that started past their send budget
+    std::atomic<uint32_t> dropped;     // Cycles dropped after a wake-up more than a cycle late
+};
+
+CycleBudget g_budget;
+
+static inline int64 monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+// Expected cost: the peak of recent samples, decaying by 1/64 per sample
+static inline int64 budget_estimate(int64 estimate, int64 sample) {
+    return sample > estimate ? sample : estimate - (estimate >> 6);
+}
+
+// Single writer (ecatthread), relaxed readers
+static inline void budget_count(std::atomic<uint32_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void cycle_budget_reset(CycleBudget *b, int64 cycle_ns, int64 send_ns) {
+    b->send_ns = send_ns;
+    b->cycle_ns = cycle_ns;
+    b->start_ns = 0;
+    b->stage_start_ns = 0;
+    b->tail_ns = 0;
+    for (int s = 0; s < CYCLE_STAGE_COUNT; s++) {
+        b->cost_ns[s] = 0;
+        b->shed[s].store(0, std::memory_order_relaxed);
+    }
+    b->late.store(0, std::memory_order_relaxed);
+    b->dropped.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * Start of a cycle; deadline is the wake-up time the cycle was scheduled for. If it lies more than
+ * a cycle in the past, the missed cycles are dropped: deadline moves on by whole cycles to the
+ * latest slot that has started.
+ */
+static inline void cycle_budget_begin(CycleBudget *b, struct timespec *deadline, int64 now, int64 cycletime) {
+    b->start_ns = (int64)deadline->tv_sec * NSEC_PER_SEC + deadline->tv_nsec;
+    int64 missed = (now - b->start_ns) / cycletime;
+    if (missed > 0) {
+        add_timespec(deadline, missed * cycletime);
+        b->start_ns += missed * cycletime;
+        b->dropped.store(b->dropped.load(std::memory_order_relaxed) + (uint32_t)missed, std::memory_order_relaxed);
+    }
+    if (now - b->start_ns + b->tail_ns > b->send_ns) {
+        budget_count(b->late);
+    }
+}
+
+/*
+ * Decide whether an optional stage runs. It does if its expected cost (plus, for planning, the
+ * mandatory work still to come before the send) ends within its limit; otherwise it is counted as
+ * shed and false is returned.
+ */
+static inline bool cycle_budget_try(CycleBudget *b, int stage) {
+    int64 now = monotonic_ns();
+    int64 end = now - b->start_ns + b->cost_ns[stage];
+    bool fits = stage == STAGE_PLANNING ? end + b->tail_ns <= b->send_ns : end <= b->cycle_ns;
+    if (!fits) {
+        budget_count(b->shed[stage]);
+        return false;
+    }
+    b->stage_start_ns = now;
+    return true;
+}
+
+// End of an optional stage started by cycle_budget_try
+static inline void cycle_budget_done(CycleBudget *b, int stage) {
+    b->cost_ns[stage] = budget_estimate(b->cost_ns[stage], monotonic_ns() - b->stage_start_ns);
+}
+
+void cycle_budget_print(FILE *out, const CycleBudget *b) {
+    fprintf(out, "  budget: send %.0f us, %u late cycles, %u dropped cycles, shed", b->send_ns / 1000.0,
+            b->late.load(std::memory_order_relaxed), b->dropped.load(std::memory_order_relaxed));
+    for (int s = 0; s < CYCLE_STAGE_COUNT; s++) {
+        fprintf(out, " %s %u (%.1f us)", cycle_stage_names[s], b->shed[s].load(std::memory_order_relaxed),
+                b->cost_ns[s] / 1000.0);
+    }
+    fprintf(out, ", mandatory tail %.1f us\n", b->tail_ns / 1000.0);
+}
+
+//##################################################################################################
+// Multi-axis state.
+// Every eRob joint is one axis. Per-axis data is kept as a structure of arrays so the cyclic
+// processing is a tight loop over contiguous arrays instead of one struct shared by all slaves.
+
+#define CIA402_DWELL_CYCLES 20    // Minimum cycles spent in a drive state before the next command
+#define CIA402_FAULT_RESET_CYCLES 100 // Cycles to hold the fault reset bit before re-arming it
+
+// CiA402 modes of operation (0x6060) supported by the cyclic engine
+enum OperationMode : uint8_t {
+    MODE_CSP = 8,    // Cyclic synchronous position: setpoint is a target position (counts)
+    MODE_CSV = 9,    // Cyclic synchronous velocity: setpoint is a target velocity (counts/s)
+    MODE_CST = 10    // Cyclic synchronous torque: setpoint is a target torque (0.1 % rated torque)
+};
+
+#define TORQUE_SLEW_PER_CYCLE 5 // Maximum change of the CST torque command per cycle (0.1 % rated torque)
+
+// CiA402 drive state decoded from the statusword (0x6041)
+enum Cia402State : uint8_t {
+    CIA402_NOT_READY,
+    CIA402_SWITCH_ON_DISABLED,
+    CIA402_READY_TO_SWITCH_ON,
+    CIA402_SWITCHED_ON,
+    CIA402_OPERATION_ENABLED,
+    CIA402_QUICK_STOP_ACTIVE,
+    CIA402_FAULT_REACTION_ACTIVE,
+    CIA402_FAULT
+};
+
+struct AxisArray {
+    int count;                           // Number of active axes
+    uint16_t slave[MAX_AXES];            // EtherCAT slave index of each axis
+
+    // Typed views into IOmap, resolved once after ec_config_map(). The structs are packed
+    // (alignment 1), so the compiler emits alignment-safe accesses for any offset.
+    txpdo_t *in[MAX_AXES];               // Slave input image, read in place
+    rxpdo_t *out[MAX_AXES];              // Slave output image, written in place
+
+    // Inputs (from TXPDO)
+    uint16_t statusword[MAX_AXES];
+    int32_t actual_position[MAX_AXES];
+    int32_t actual_velocity[MAX_AXES];
+    int16_t actual_torque[MAX_AXES];
+    uint8_t mode_display[MAX_AXES];      // Mode the drive is running (0x6061)
+
+    // Outputs (to RXPDO)
+    uint16_t controlword[MAX_AXES];
+    int32_t target_position[MAX_AXES];
+    int32_t target_velocity[MAX_AXES];
+    int16_t target_torque[MAX_AXES];
+    uint8_t mode[MAX_AXES];              // OperationMode written to 0x6060
+
+    // Per-axis control state
+    uint8_t state[MAX_AXES];             // Cia402State
+    uint16_t state_cycles[MAX_AXES];     // Cycles spent in the current state
+    int32_t setpoint[MAX_AXES];          // Last setpoint received for the axis, in requested_mode units
+    uint8_t has_setpoint[MAX_AXES];      // Non-zero once a setpoint has been received
+    uint8_t requested_mode[MAX_AXES];    // Mode of the last setpoint; applied at the next cycle
+    double velocity_command[MAX_AXES];   // CSV: slew-limited velocity command (counts/s)
+    int16_t torque_command[MAX_AXES];    // CST: slew-limited torque command
+    uint8_t external_controlword[MAX_AXES]; // Non-zero: controlword set by the application, not the state machine
+    uint16_t application_controlword[MAX_AXES];
+    uint8_t offline[MAX_AXES];           // Non-zero while the axis' slave is in recovery (axes_sync_offline)
+    int plan_lag;                        // Cycles the planners are behind after planning was shed
+};
+
+AxisArray g_axes;
+
+uint8_t cia402_decode(uint16_t statusword) {
+    if ((statusword & 0x004F) == 0x0008) return CIA402_FAULT;
+    if ((statusword & 0x004F) == 0x000F) return CIA402_FAULT_REACTION_ACTIVE;
+    if ((statusword & 0x004F) == 0x0040) return CIA402_SWITCH_ON_DISABLED;
+    if ((statusword & 0x006F) == 0x0021) return CIA402_READY_TO_SWITCH_ON;
+    if ((statusword & 0x006F) == 0x0023) return CIA402_SWITCHED_ON;
+    if ((statusword & 0x006F) == 0x0027) return CIA402_OPERATION_ENABLED;
+    if ((statusword & 0x006F) == 0x0007) return CIA402_QUICK_STOP_ACTIVE;
+    return CIA402_NOT_READY;
+}
+
+// Assign the axes of g_config (one axis per slave if it lists none) and resolve their views
+// into IOmap. Must be called after ec_config_map(). Returns false if a listed slave was not found
+// or a slave's mapped image does not match rxpdo_t/txpdo_t.
+bool axes_init(AxisArray *axes, int slave_count) {
+    memset(axes, 0, sizeof(*axes));
+    if (g_config.axis_count > 0) {
+        axes->count = g_config.axis_count;
+    } else {
+        axes->count = slave_count < MAX_AXES ? slave_count : MAX_AXES;
+    }
+    for (int a = 0; a < axes->count; a++) {
+        int slave = g_config.axis_count > 0 ? g_config.axis_slave[a] : a + 1;
+        if (slave > slave_count) {
+            printf("Axis %d: slave %d is not on the network (%d slaves found)\n", a, slave, slave_count);
+            return false;
+        }
+        if (ec_slave[slave].Obytes != sizeof(rxpdo_t) || ec_slave[slave].Ibytes != sizeof(txpdo_t)) {
+            printf("Slave %d process image mismatch: outputs %u bytes (expected %zu), inputs %u bytes (expected %zu)\n",
+                   slave, (unsigned)ec_slave[slave].Obytes, sizeof(rxpdo_t),
+                   (unsigned)ec_slave[slave].Ibytes, sizeof(txpdo_t));
+            return false;
+        }
+        if (ec_slave[slave].Ostartbit != 0 || ec_slave[slave].Istartbit != 0 ||
+            !ec_slave[slave].outputs || !ec_slave[slave].inputs) {
+            printf("Slave %d process image is not byte aligned in IOmap\n", slave);
+            return false;
+        }
+        axes->slave[a] = slave;
+        axes->out[a] = (rxpdo_t *)ec_slave[slave].outputs;
+        axes->in[a] = (txpdo_t *)ec_slave[slave].inputs;
+        axes->controlword[a] = 0x0080; // Start with a fault reset
+        axes->mode[a] = MODE_CSP;
+        axes->requested_mode[a] = MODE_CSP;
+        g_motion_planner[a].mode = g_planner_mode;
+    }
+    return true;
+}
+
+// Read each slave's TXPDO fields straight from IOmap into the per-axis arrays
+void axes_read_inputs(AxisArray *axes) {
+    for (int a = 0; a < axes->count; a++) {
+        if (axes->offline[a]) {
+            axes->statusword[a] = 0; // Not ready; the last measured position is held
+            continue;
+        }
+        const txpdo_t *in = axes->in[a];
+        axes->statusword[a] = in->statusword;
+        axes->actual_position[a] = in->actual_position;
+        axes->actual_velocity[a] = in->actual_velocity;
+        axes->actual_torque[a] = in->actual_torque;
+        axes->mode_display[a] = in->mode_display;
+    }
+}
+
+// Switch one axis to another mode of operation. The new mode's command starts from the state
+// the axis is in, and axes_update() keeps the targets of the inactive modes on the measured
+// state, so the outputs are continuous whichever mode the drive applies in the switching cycle.
+static void axes_switch_mode(AxisArray *axes, int a, uint8_t mode) {
+    MotionPlanner *planner = &g_motion_planner[a];
+    double velocity; // Velocity the axis is moving at under the current mode
+    switch (axes->mode[a]) {
+    case MODE_CSP: velocity = planner->current_velocity; break;
+    case MODE_CSV: velocity = axes->velocity_command[a]; break;
+    default: velocity = axes->actual_velocity[a]; break;
+    }
+    switch (mode) {
+    case MODE_CSP:
+        planner_seed(planner, axes->actual_position[a], velocity);
+        break;
+    case MODE_CSV:
+        axes->velocity_command[a] = velocity;
+        break;
+    case MODE_CST:
+        axes->torque_command[a] = axes->actual_torque[a];
+        break;
+    default:
+        return; // Unsupported mode: keep the current one
+    }
+    axes->mode[a] = mode;
+}
+
+// Move value towards target by at most step
+static inline double slew_toward(double value, double target, double step) {
+    if (target > value + step) return value + step;
+    if (target < value - step) return value - step;
+    return target;
+}
+
+// Run every axis' CiA402 state machine and compute its target. Without `plan` (the cycle budget shed
+// the planning) the CSP targets continue at the last planned velocity and the planners catch up
+// at the next cycle that plans.
+void axes_update(AxisArray *axes, bool plan) {
+    for (int a = 0; a < axes->count; a++) {
+        uint8_t state = cia402_decode(axes->statusword[a]);
+        if (state != axes->state[a]) {
+            axes->state[a] = state;
+            axes->state_cycles[a] = 0;
+        } else if (axes->state_cycles[a] < UINT16_MAX) {
+            axes->state_cycles[a]++;
+        }
+        bool settled = axes->state_cycles[a] >= CIA402_DWELL_CYCLES;
+        uint16_t cw = axes->controlword[a];
+
+        switch (state) {
+        case CIA402_FAULT:
+            // Drop the pending setpoint so a recovered axis never resumes an old move
+            axes->has_setpoint[a] = 0;
+            // Fault reset acts on the rising edge of bit 7: re-arm it if the fault persists
+            cw = (axes->state_cycles[a] % CIA402_FAULT_RESET_CYCLES) < CIA402_FAULT_RESET_CYCLES - 1 ? 0x0080 : 0x0000;
+            break;
+        case CIA402_SWITCH_ON_DISABLED:
+            if (settled) cw = 0x0006; // Shutdown
+            break;
+        case CIA402_READY_TO_SWITCH_ON:
+            if (settled) cw = 0x0007; // Switch on
+            break;
+        case CIA402_SWITCHED_ON:
+            if (settled) cw = 0x000F; // Enable operation
+            break;
+        case CIA402_OPERATION_ENABLED:
+            cw = 0x000F;
+            break;
+        case CIA402_QUICK_STOP_ACTIVE:
+            cw = 0x0000; // Disable voltage, restart from switch on disabled
+            break;
+        default:
+            break; // Not ready / fault reaction: the drive moves on by itself
+        }
+        if (axes->external_controlword[a]) {
+            cw = axes->application_controlword[a];
+        }
+        if (axes->offline[a]) {
+            // The drive restarts from switch on disabled once its slave is back in OP
+            cw = 0x0000;
+            axes->has_setpoint[a] = 0;
+        }
+        axes->controlword[a] = cw;
+
+        MotionPlanner *planner = &g_motion_planner[a];
+        bool enabled = state == CIA402_OPERATION_ENABLED;
+        if (axes->requested_mode[a] != axes->mode[a]) {
+            axes_switch_mode(axes, a, axes->requested_mode[a]);
+        }
+
+        if (!enabled) {
+            // Hold the actual position so enabling never causes a jump
+            planner_reset(planner, axes->actual_position[a]);
+            axes->velocity_command[a] = 0.0;
+            axes->torque_command[a] = 0;
+        } else if (axes->mode[a] == MODE_CSP) {
+            // Follow the trajectory to the latest position setpoint
+            if (axes->has_setpoint[a]) {
+                planner->target_position = axes->setpoint[a];
+            }
+        } else if (axes->mode[a] == MODE_CSV) {
+            double target = axes->has_setpoint[a] ? axes->setpoint[a] : 0.0;
+            axes->velocity_command[a] = slew_toward(axes->velocity_command[a], target,
+                                                    MotionPlanner::MAX_ACCELERATION * MotionPlanner::CYCLE_TIME);
+        } else {
+            double target = axes->has_setpoint[a] ? axes->setpoint[a] : 0.0;
+            axes->torque_command[a] = (int16_t)slew_toward(axes->torque_command[a], target, TORQUE_SLEW_PER_CYCLE);
+        }
+    }
+
+    // Evaluate all trajectories in one batch
+    if (plan || axes->plan_lag >= BUDGET_MAX_PLAN_LAG) {
+        trajectory_step_all(g_motion_planner, axes->actual_position, axes->count, &g_trajectory_batch,
+                            1 + axes->plan_lag);
+        axes->plan_lag = 0;
+    } else {
+        axes->plan_lag++;
+    }
+
+    // Active mode: its own command. Inactive modes: the measured state, extrapolated by one cycle
+    // for position, so a drive still running the previous mode holds its motion.
+    for (int a = 0; a < axes->count; a++) {
+        const MotionPlanner *planner = &g_motion_planner[a];
+        if (axes->state[a] != CIA402_OPERATION_ENABLED) {
+            axes->target_position[a] = planner->current_position;
+            axes->target_velocity[a] = 0;
+            axes->target_torque[a] = 0;
+        } else if (axes->mode[a] == MODE_CSP) {
+            axes->target_position[a] = axes->plan_lag == 0 ? planner->current_position :
+                planner->current_position + (int32_t)lround(planner->current_velocity * MotionPlanner::CYCLE_TIME *
+                                                             axes->plan_lag);
+            axes->target_velocity[a] = (int32_t)lround(planner->current_velocity);
+            axes->target_torque[a] = axes->actual_torque[a];
+        } else if (axes->mode[a] == MODE_CSV) {
+            axes->target_position[a] = axes->actual_position[a] +
+                                       (int32_t)lround(axes->velocity_command[a] * MotionPlanner::CYCLE_TIME);
+            axes->target_velocity[a] = (int32_t)lround(axes->velocity_command[a]);
+            axes->target_torque[a] = axes->actual_torque[a];
+        } else {
+            axes->target_position[a] = axes->actual_position[a] +
+                                       (int32_t)lround(axes->actual_velocity[a] * MotionPlanner::CYCLE_TIME);
+            axes->target_velocity[a] = axes->actual_velocity[a];
+            axes->target_torque[a] = axes->torque_command[a];
+        }
+    }
+}
+
+// Write the per-axis outputs straight into each slave's RXPDO in IOmap
+void axes_write_outputs(const AxisArray *axes) {
+    for (int a = 0; a < axes->count; a++) {
+        rxpdo_t *out = axes->out[a];
+        out->controlword = axes->controlword[a];
+        out->target_position = axes->target_position[a];
+        out->target_velocity = axes->target_velocity[a];
+        out->target_torque = axes->target_torque[a];
+        out->mode_of_operation = axes->mode[a];
+        out->padding = 0;
+    }
+}
+
+//##################################################################################################
+// Lock-free channel between ecatthread and the rest of the process.
+// Setpoints go in through a wait-free single-producer/single-consumer ring, status comes out
+// through a seqlock. The RT thread never takes a lock and never waits on another thread.
+
+// Kind of command sent to the RT thread
+enum CommandKind : uint8_t {
+    CMD_SETPOINT,            // value is a setpoint in `mode`
+    CMD_CONTROLWORD,         // value is the controlword; the application drives the CiA402 state machine
+    CMD_RELEASE_CONTROLWORD  // Hand the controlword back to the built-in state machine
+};
+
+// Setpoint command sent to the RT thread
+struct SetpointCmd {
+    uint16_t axis;           // Axis index (0-based)
+    uint8_t kind;            // CommandKind
+    uint8_t mode;            // OperationMode the value is meant for
+    int32_t value;           // Target position, velocity or torque, depending on mode
+};
+
+// Per-axis part of the telemetry snapshot
+struct AxisTelemetry {
+    txpdo_t txpdo;           // Status data received from the slave
+    int32_t target_position; // Target position sent to the slave
+    uint16_t controlword;    // Controlword sent to the slave
+    uint8_t state;           // Cia402State
+    uint8_t mode;            // OperationMode requested from the slave
+};
+
+// Snapshot published by the RT thread once per cycle
+struct TelemetrySnapshot {
+    uint32_t cycle;          // Value of dorun when the snapshot was taken
+    int32_t wkc;             // Work counter of that cycle
+    int32_t axis_count;      // Number of valid entries in axes[]
+    DcSyncStatus dc;         // DC synchronisation state after the previous frame
+    AxisTelemetry axes[MAX_AXES];
+};
+
+// Wait-free single-producer/single-consumer ring buffer (N must be a power of two)
+template <typename T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of two");
+public:
+    SpscRing() : head(0), tail_cache(0), tail(0), head_cache(0) {}
+
+    // Producer side. Returns false if the ring is full; the caller decides whether to retry.
+    bool push(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail_cache >= N) {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h - tail_cache >= N) {
+                return false;
+            }
+        }
+        buffer[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head_cache) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t == head_cache) {
+                return false;
+            }
+        }
+        item = buffer[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Producer and consumer indices live on separate cache lines to avoid false sharing
+    alignas(64) std::atomic<size_t> head; // Next slot to write (owned by the producer)
+    size_t tail_cache;                    // Producer's cached copy of tail
+    alignas(64) std::atomic<size_t> tail; // Next slot to read (owned by the consumer)
+    size_t head_cache;                    // Consumer's cached copy of head
+    alignas(64) T buffer[N];
+};
+
+// Single-writer seqlock. The writer never waits; readers retry if they raced with a write.
+// The payload is copied through relaxed atomic words so concurrent access is well defined.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock payload must be trivially copyable");
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+public:
+    SeqLock() : seq(0) {
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Writer side (one thread only)
+    void store(const T &value) {
+        uint64_t tmp[WORDS] = {0};
+        memcpy(tmp, &value, sizeof(T));
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed); // Odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i].store(tmp[i], std::memory_order_relaxed);
+        }
+        seq.store(s + 2, std::memory_order_release); // Even: snapshot is consistent
+    }
+
+    // Reader side (any thread)
+    T load() const {
+        uint64_t tmp[WORDS];
+        uint32_t s0, s1;
+        do {
+            s0 = seq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; i++) {
+                tmp[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s1 = seq.load(std::memory_order_relaxed);
+        } while ((s0 & 1) || s0 != s1);
+        T value;
+        memcpy(&value, tmp, sizeof(T));
+        return value;
+    }
+
+private:
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> words[WORDS];
+};
+
+#define SETPOINT_RING_SIZE 64 // Pending setpoints the RT thread can buffer
+
+SpscRing<SetpointCmd, SETPOINT_RING_SIZE> g_setpoint_ring; // Non-RT producer -> ecatthread
+SeqLock<TelemetrySnapshot> g_telemetry;                    // ecatthread -> non-RT consumers
+
+// Queue a setpoint for one axis in the given mode of operation. Switching the mode is bumpless and
+// takes effect in the cycle that receives the command. Never blocks; returns false if the ring is
+// full or the mode is not supported.
+bool send_command(int axis, uint8_t mode, int32_t value) {
+    if (mode != MODE_CSP && mode != MODE_CSV && mode != MODE_CST) {
+        return false;
+    }
+    SetpointCmd cmd;
+    cmd.axis = (uint16_t)axis;
+    cmd.kind = CMD_SETPOINT;
+    cmd.mode = mode;
+    cmd.value = value;
+    return g_setpoint_ring.push(cmd);
+}
+
+// Queue a new target position (CSP) for one axis
+bool send_setpoint(int axis, int32_t target) {
+    return send_command(axis, MODE_CSP, target);
+}
+
+// Drive the axis' controlword from the application (e.g. a Python enable sequence) instead of the
+// built-in CiA402 state machine, until release_controlword() is called
+bool send_controlword(int axis, uint16_t controlword) {
+    SetpointCmd cmd;
+    cmd.axis = (uint16_t)axis;
+    cmd.kind = CMD_CONTROLWORD;
+    cmd.mode = 0;
+    cmd.value = controlword;
+    return g_setpoint_ring.push(cmd);
+}
+
+bool release_controlword(int axis) {
+    SetpointCmd cmd;
+    cmd.axis = (uint16_t)axis;
+    cmd.kind = CMD_RELEASE_CONTROLWORD;
+    cmd.mode = 0;
+    cmd.value = 0;
+    return g_setpoint_ring.push(cmd);
+}
+
+// Apply one command from the ring to the per-axis arrays (RT thread)
+void axes_apply_command(AxisArray *axes, const SetpointCmd &cmd) {
+    if (cmd.axis >= axes->count) {
+        return;
+    }
+    switch (cmd.kind) {
+    case CMD_SETPOINT:
+        axes->setpoint[cmd.axis] = cmd.value;
+        axes->requested_mode[cmd.axis] = cmd.mode;
+        axes->has_setpoint[cmd.axis] = 1;
+        break;
+    case CMD_CONTROLWORD:
+        axes->application_controlword[cmd.axis] = (uint16_t)cmd.value;
+        axes->external_controlword[cmd.axis] = 1;
+        break;
+    case CMD_RELEASE_CONTROLWORD:
+        axes->external_controlword[cmd.axis] = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+// The inputs of one axis as a TXPDO image
+static inline void axes_txpdo(const AxisArray *axes, int a, txpdo_t *txpdo) {
+    txpdo->statusword = axes->statusword[a];
+    txpdo->actual_position = axes->actual_position[a];
+    txpdo->actual_velocity = axes->actual_velocity[a];
+    txpdo->actual_torque = axes->actual_torque[a];
+    txpdo->mode_display = axes->mode_display[a];
+    txpdo->padding = 0;
+}
+
+// Fill the snapshot from the per-axis arrays
+void fill_telemetry(TelemetrySnapshot *snapshot, const AxisArray *axes, uint32_t cycle, int32_t wkc_value) {
+    snapshot->cycle = cycle;
+    snapshot->wkc = wkc_value;
+    snapshot->axis_count = axes->count;
+    snapshot->dc = g_dc_sync.status;
+    for (int a = 0; a < axes->count; a++) {
+        AxisTelemetry &t = snapshot->axes[a];
+        axes_txpdo(axes, a, &t.txpdo);
+        t.target_position = axes->target_position[a];
+        t.controlword = axes->controlword[a];
+        t.state = axes->state[a];
+        t.mode = axes->mode[a];
+    }
+}
+
+//##################################################################################################
+// Setpoint/telemetry server.
+// A host controller streams setpoints in and receives telemetry over UDP on server_port (0 = off).
+// There is no authentication: whoever can reach the port can move the motors. The socket is bound
+// to server_bind, 127.0.0.1 unless the configuration names the address of a dedicated host NIC.
+// start_server runs on logthread's CPU, never on the RT one, and waits in epoll on the socket and
+// on a timerfd that ticks once per cycle:
+//  - Setpoint frames are drained with recvmmsg, checked, and their commands copied unchanged into
+//    g_server_ring, a second SPSC ring next to g_setpoint_ring (each ring keeps a single producer).
+//    ecatthread applies them in the same step as the local setpoints and publishes the sequence
+//    number of the last frame it applied.
+//  - Each tick appends the latest telemetry snapshot to a batch that is sent to the last sender
+//    once it holds server_batch samples and carries the last applied sequence number. When a new
+//    frame was applied since the host was last told, a header-only acknowledgement goes out in
+//    between, at most once per SERVER_ACK_MIN_NS, so a streaming host does not break up the batch.
+// Wire format (host byte order, which is little endian on every target of this program):
+//   host -> server: ServerFrameHeader + count * SetpointCmd (8 bytes each)
+//   server -> host: ServerTelemetryHeader + samples * (ServerSample + axes * ServerAxisSample)
+// A frame with count 0 only subscribes to the telemetry. Commands that do not fit into the ring
+// are dropped and counted in `rejected`; the host resends what applied_seq does not cover.
+
+#define SERVER_MAGIC_SETPOINT 0x5345   // "ES"
+#define SERVER_MAGIC_TELEMETRY 0x5445  // "ET"
+#define SERVER_VERSION 1
+#define SERVER_RING_SIZE 256           // Commands from the server the RT thread can buffer
+#define SERVER_RECV_BATCH 16           // Datagrams per recvmmsg
+#define SERVER_MAX_FRAME (8 + 255 * 8) // Header and 255 commands
+#define SERVER_MAX_DATAGRAM 8192       // Telemetry datagram size limit
+#define SERVER_ACK_MIN_NS 1000000      // Shortest gap between two acknowledgements (1 ms)
+
+struct ServerFrameHeader {
+    uint16_t magic;          // SERVER_MAGIC_SETPOINT
+    uint8_t version;         // SERVER_VERSION
+    uint8_t count;           // Commands following the header
+    uint32_t seq;            // Frame number chosen by the host, echoed as applied_seq
+} __attribute__((__packed__));
+
+struct ServerTelemetryHeader {
+    uint16_t magic;          // SERVER_MAGIC_TELEMETRY
+    uint8_t version;         // SERVER_VERSION
+    uint8_t samples;         // Samples following the header
+    uint16_t axes;           // Axes per sample
+    uint16_t reserved;
+    uint32_t applied_seq;    // seq of the last frame ecatthread applied
+    uint32_t rejected;       // Commands dropped so far (invalid or ring full)
+} __attribute__((__packed__));
+
+struct ServerSample {
+    uint32_t cycle;          // dorun of the snapshot
+    int32_t wkc;
+} __attribute__((__packed__));
+
+struct ServerAxisSample {
+    int32_t actual_position;
+    int32_t actual_velocity;
+    int32_t target_position;
+    int16_t actual_torque;
+    uint16_t statusword;
+    uint16_t controlword;
+    uint8_t state;           // Cia402State
+    uint8_t mode_display;
+} __attribute__((__packed__));
+
+static_assert(sizeof(SetpointCmd) == 8, "SetpointCmd is part of the server wire format");
+static_assert(sizeof(ServerAxisSample) == 20, "ServerAxisSample is part of the server wire format");
+
+// Command queued by the server, with the frame it came from
+struct ServerCommand {
+    SetpointCmd cmd;
+    uint32_t seq;
+};
+
+// Server counters, for the latency report and the benchmark
+struct ServerStats {
+    std::atomic<uint32_t> frames;      // Setpoint frames received
+    std::atomic<uint32_t> commands;    // Commands queued for ecatthread
+    std::atomic<uint32_t> rejected;    // Commands dropped (invalid or ring full)
+    std::atomic<uint32_t> invalid;     // Datagrams that are not setpoint frames
+    std::atomic<uint32_t> telemetry;   // Telemetry datagrams sent
+};
+
+SpscRing<ServerCommand, SERVER_RING_SIZE> g_server_ring; // start_server -> ecatthread
+std::atomic<uint32_t> g_server_applied(0);               // ecatthread -> start_server
+std::atomic<int> g_server_port(0);                       // Bound port while start_server runs
+ServerStats g_server_stats;
+
+// Apply the commands queued by the server and acknowledge the last frame (RT thread)
+static inline void server_drain(AxisArray *axes) {
+    ServerCommand net;
+    bool applied = false;
+    uint32_t seq = 0;
+    while (g_server_ring.pop(net)) {
+        axes_apply_command(axes, net.cmd);
+        seq = net.seq;
+        applied = true;
+    }
+    if (applied) {
+        g_server_applied.store(seq, std::memory_order_release);
+    }
+}
+
+static bool server_command_valid(const SetpointCmd &cmd) {
+    if (cmd.axis >= MAX_AXES) {
+        return false;
+    }
+    if (cmd.kind == CMD_SETPOINT) {
+        return cmd.mode == MODE_CSP || cmd.mode == MODE_CSV || cmd.mode == MODE_CST;
+    }
+    return cmd.kind == CMD_CONTROLWORD || cmd.kind == CMD_RELEASE_CONTROLWORD;
+}
+
+// Decode one datagram into the ring. Returns false if it is not a setpoint frame.
+static bool server_decode(const uint8_t *data, size_t length) {
+    ServerFrameHeader header;
+    if (length < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SERVER_MAGIC_SETPOINT || header.version != SERVER_VERSION ||
+        length != sizeof(header) + header.count * sizeof(SetpointCmd)) {
+        return false;
+    }
+    g_server_stats.frames.fetch_add(1, std::memory_order_relaxed);
+    uint32_t queued = 0;
+    ServerCommand net;
+    net.seq = header.seq;
+    for (int i = 0; i < header.count; i++) {
+        memcpy(&net.cmd, data + sizeof(header) + i * sizeof(SetpointCmd), sizeof(SetpointCmd));
+        if (server_command_valid(net.cmd) && g_server_ring.push(net)) {
+            queued++;
+        }
+    }
+    g_server_stats.commands.fetch_add(queued, std::memory_order_relaxed);
+    if (queued < header.count) {
+        g_server_stats.rejected.fetch_add(header.count - queued, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// Telemetry batch being filled by start_server
+struct ServerBatch {
+    uint8_t data[SERVER_MAX_DATAGRAM];
+    size_t length;           // Bytes used, 0 while empty
+    int samples;
+    int axes;
+    int limit;               // Samples that fit, at most server_batch
+    uint32_t last_cycle;     // Cycle of the last sample, to skip unchanged snapshots
+    uint32_t sent_applied;   // applied_seq of the last datagram (batch or acknowledgement)
+    int64 ack_ns;            // CLOCK_MONOTONIC time of the last acknowledgement
+};
+
+static void server_batch_add(ServerBatch *batch, const TelemetrySnapshot &snapshot, int max_samples) {
+    if (batch->length == 0) {
+        batch->axes = snapshot.axis_count;
+        size_t sample_size = sizeof(ServerSample) + batch->axes * sizeof(ServerAxisSample);
+        batch->limit = (int)((SERVER_MAX_DATAGRAM - sizeof(ServerTelemetryHeader)) / sample_size);
+        if (batch->limit > max_samples) {
+            batch->limit = max_samples;
+        }
+        batch->length = sizeof(ServerTelemetryHeader);
+        batch->samples = 0;
+    }
+    ServerSample sample;
+    sample.cycle = snapshot.cycle;
+    sample.wkc = snapshot.wkc;
+    memcpy(batch->data + batch->length, &sample, sizeof(sample));
+    batch->length += sizeof(sample);
+    for (int a = 0; a < batch->axes; a++) {
+        const AxisTelemetry &t = snapshot.axes[a];
+        ServerAxisSample axis;
+        axis.actual_position = t.txpdo.actual_position;
+        axis.actual_velocity = t.txpdo.actual_velocity;
+        axis.target_position = t.target_position;
+        axis.actual_torque = t.txpdo.actual_torque;
+        axis.statusword = t.txpdo.statusword;
+        axis.controlword = t.controlword;
+        axis.state = t.state;
+        axis.mode_display = (uint8_t)t.txpdo.mode_display;
+        memcpy(batch->data + batch->length, &axis, sizeof(axis));
+        batch->length += sizeof(axis);
+    }
+    batch->samples++;
+    batch->last_cycle = snapshot.cycle;
+}
+
+static void server_header(ServerTelemetryHeader *header, int samples, int axes, uint32_t applied) {
+    header->magic = SERVER_MAGIC_TELEMETRY;
+    header->version = SERVER_VERSION;
+    header->samples = (uint8_t)samples;
+    header->axes = (uint16_t)axes;
+    header->reserved = 0;
+    header->applied_seq = applied;
+    header->rejected = g_server_stats.rejected.load(std::memory_order_relaxed);
+}
+
+static void server_send(int sock, const void *data, size_t length, const struct sockaddr_in *client) {
+    if (sendto(sock, data, length, MSG_DONTWAIT, (const struct sockaddr *)client, sizeof(*client)) >= 0) {
+        g_server_stats.telemetry.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Send the batch (which must hold samples) with the applied sequence number and empty it
+static void server_batch_send(ServerBatch *batch, int sock, const struct sockaddr_in *client,
+                              uint32_t applied) {
+    ServerTelemetryHeader header;
+    server_header(&header, batch->samples, batch->axes, applied);
+    memcpy(batch->data, &header, sizeof(header));
+    server_send(sock, batch->data, batch->length, client);
+    batch->length = 0;
+    batch->samples = 0;
+    batch->sent_applied = applied;
+}
+
+// Header-only acknowledgement; the batch being filled is left alone
+static void server_ack_send(ServerBatch *batch, int sock, const struct sockaddr_in *client,
+                            uint32_t applied, int64 now) {
+    ServerTelemetryHeader header;
+    server_header(&header, 0, 0, applied);
+    server_send(sock, &header, sizeof(header), client);
+    batch->sent_applied = applied;
+    batch->ack_ns = now;
+}
+
+/*
+ * Setpoint/telemetry server thread (non-RT). arg points to the UDP port; 0 binds an ephemeral
+ * port, published in g_server_port. Runs until ecat_stop is set.
+ */
+void *start_server(void *arg) {
+    int port = *(int *)arg;
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (sock < 0 || timer < 0 || ep < 0) {
+        perror("start_server");
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, g_config.server_bind, &address.sin_addr) != 1) {
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // config_validate rejects this
+    }
+    socklen_t address_length = sizeof(address);
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        getsockname(sock, (struct sockaddr *)&address, &address_length) != 0) {
+        perror("start_server: bind");
+        close(sock);
+        close(timer);
+        close(ep);
+        return NULL;
+    }
+
+    // Sample the telemetry once per cycle
+    struct itimerspec tick;
+    tick.it_interval.tv_sec = 0;
+    tick.it_interval.tv_nsec = (long)ctime_thread * 1000;
+    tick.it_value = tick.it_interval;
+    timerfd_settime(timer, 0, &tick, NULL);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &event);
+    event.data.fd = timer;
+    epoll_ctl(ep, EPOLL_CTL_ADD, timer, &event);
+
+    static uint8_t frames[SERVER_RECV_BATCH][SERVER_MAX_FRAME];
+    static struct iovec iov[SERVER_RECV_BATCH];
+    static struct sockaddr_in peers[SERVER_RECV_BATCH];
+    static struct mmsghdr messages[SERVER_RECV_BATCH];
+    static ServerBatch batch;
+    static TelemetrySnapshot snapshot;
+    memset(&batch, 0, sizeof(batch));
+    struct sockaddr_in client;
+    bool subscribed = false;
+    int max_samples = g_config.server_batch;
+    batch.sent_applied = g_server_applied.load(std::memory_order_acquire);
+
+    g_server_port.store(ntohs(address.sin_port), std::memory_order_release);
+    printf("Setpoint server listening on UDP %s:%d\n", g_config.server_bind, ntohs(address.sin_port));
+
+    while (!ecat_stop.load(std::memory_order_relaxed)) {
+        struct epoll_event events[2];
+        int ready = epoll_wait(ep, events, 2, 100);
+        for (int e = 0; e < ready; e++) {
+            if (events[e].data.fd == sock) {
+                int received;
+                do {
+                    for (int i = 0; i < SERVER_RECV_BATCH; i++) {
+                        iov[i].iov_base = frames[i];
+                        iov[i].iov_len = SERVER_MAX_FRAME;
+                        memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+                        messages[i].msg_hdr.msg_iov = &iov[i];
+                        messages[i].msg_hdr.msg_iovlen = 1;
+                        messages[i].msg_hdr.msg_name = &peers[i];
+                        messages[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+                    }
+                    received = recvmmsg(sock, messages, SERVER_RECV_BATCH, MSG_DONTWAIT, NULL);
+                    for (int i = 0; i < received; i++) {
+                        if (server_decode(frames[i], messages[i].msg_len)) {
+                            client = peers[i];
+                            subscribed = true;
+                        } else {
+                            g_server_stats.invalid.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                } while (received == SERVER_RECV_BATCH);
+            } else {
+                uint64_t expirations;
+                if (read(timer, &expirations, sizeof(expirations)) < 0 || !subscribed) {
+                    continue;
+                }
+                snapshot = g_telemetry.load();
+                if (batch.length > 0 && snapshot.axis_count != batch.axes) {
+                    server_batch_send(&batch, sock, &client, batch.sent_applied);
+                }
+                if (snapshot.cycle != batch.last_cycle) {
+                    server_batch_add(&batch, snapshot, max_samples);
+                }
+                uint32_t applied = g_server_applied.load(std::memory_order_acquire);
+                if (batch.length > 0 && batch.samples >= batch.limit) {
+                    server_batch_send(&batch, sock, &client, applied);
+                } else if (applied != batch.sent_applied) {
+                    int64 now = monotonic_ns();
+                    if (now - batch.ack_ns >= SERVER_ACK_MIN_NS) {
+                        server_ack_send(&batch, sock, &client, applied, now);
+                    }
+                }
+            }
+        }
+    }
+
+    g_server_port.store(0, std::memory_order_release);
+    close(ep);
+    close(timer);
+    close(sock);
+    return NULL;
+}
+
+void server_print(FILE *out) {
+    if (g_server_port.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    fprintf(out, "  server: port %d, %u frames, %u commands, %u rejected, %u invalid datagrams, "
+            "%u telemetry datagrams, applied seq %u\n", g_server_port.load(),
+            g_server_stats.frames.load(), g_server_stats.commands.load(), g_server_stats.rejected.load(),
+            g_server_stats.invalid.load(), g_server_stats.telemetry.load(), g_server_applied.load());
+}
+
+//##################################################################################################
+// Slave supervision events.
+// ecatcheck does not poll wkc and inOP: ecatthread posts an event when the working counter drops
+// below expectedWKC and when it is back, erob_start/erob_stop post state changes, and ecatcheck
+// sleeps on an eventfd until one arrives. Events are bits in g_check_pending; the eventfd is only
+// written when the word goes from empty to non-empty, so ecatthread does at most one write() per
+// ecatcheck pass and none while the bus is healthy.
+
+#define CHECK_RETRY_MS 5 // Recovery retry period of ecatcheck while a slave is not OP or WKC is low
+
+enum CheckEvent {
+    CHECK_EVENT_WKC_DROP = 1 << 0,  // Working counter fell below expectedWKC
+    CHECK_EVENT_WKC_OK = 1 << 1,    // Working counter is back at expectedWKC
+    CHECK_EVENT_STATE = 1 << 2,     // inOP changed or a slave was seen outside OP
+    CHECK_EVENT_STOP = 1 << 3,      // ecat_stop was set
+    CHECK_EVENT_FORCE_INIT = 1 << 4 // A slave is to be requested to INIT (g_check_force_init)
+};
+
+std::atomic<uint32_t> g_check_pending(0);    // CheckEvent bits not yet taken by ecatcheck
+std::atomic<int32_t> g_check_wkc(0);         // Working counter of the last WKC error
+std::atomic<uint32_t> g_check_bad_cycles(0); // Consecutive cycles with a WKC error, 0 when healthy
+std::atomic<uint32_t> g_check_wakeups(0);    // ecatcheck passes, for the latency report
+int g_check_fd = -1;                         // eventfd ecatcheck sleeps on, -1 when closed
+std::atomic<uint8_t> g_check_force_init[EC_MAXSLAVE]; // Slaves ecatcheck is to request to INIT
+
+// Create the eventfd; without it ecatcheck falls back to polling every CHECK_RETRY_MS
+bool check_events_open() {
+    g_check_pending.store(0);
+    g_check_bad_cycles.store(0);
+    g_check_wakeups.store(0);
+    g_check_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_check_fd < 0) {
+        printf("eventfd failed (%s), ecatcheck polls every %d ms\n", strerror(errno), CHECK_RETRY_MS);
+        return false;
+    }
+    return true;
+}
+
+void check_events_close() {
+    if (g_check_fd >= 0) {
+        close(g_check_fd);
+        g_check_fd = -1;
+    }
+}
+
+// AL states of the slaves for readers outside the EtherCAT threads. While inOP only ecatcheck
+// reads the states from the bus and changes them; everyone else takes this snapshot, which
+// erob_start publishes before setting inOP and ecatcheck after every pass that did work.
+struct SlaveStates {
+    uint16 count;
+    uint16 group_state;
+    uint16 state[EC_MAXSLAVE];
+    uint16 al_status[EC_MAXSLAVE];
+};
+
+SeqLock<SlaveStates> g_slave_states; // erob_start, then ecatcheck -> any thread
+
+// Copy the states SOEM last read into states (index 0 is unused, as in ec_slave)
+void slave_states_capture(SlaveStates *states) {
+    states->count = (uint16)(ec_slavecount < EC_MAXSLAVE ? ec_slavecount : EC_MAXSLAVE - 1);
+    states->group_state = ec_slave[0].state;
+    for (int i = 1; i <= states->count; i++) {
+        states->state[i] = ec_slave[i].state;
+        states->al_status[i] = ec_slave[i].ALstatuscode;
+    }
+}
+
+// Publish the current states (single writer: erob_start before inOP, ecatcheck while inOP)
+void slave_states_publish() {
+    SlaveStates states;
+    slave_states_capture(&states);
+    g_slave_states.store(states);
+}
+
+// Post CheckEvent bits (any thread; wait-free apart from the eventfd write on the empty -> set edge)
+static inline void check_event_post(uint32_t events) {
+    uint32_t before = g_check_pending.fetch_or(events, std::memory_order_release);
+    if (before == 0 && g_check_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(g_check_fd, &one, sizeof(one));
+        (void)written; // Only fails if the counter would overflow, which still leaves it readable
+    }
+}
+
+/*
+ * Ask ecatcheck to request INIT from a slave (any thread). ec_writestate is a blocking acyclic
+ * transfer and the slave states belong to ecatcheck's recovery, so callers only record the request.
+ */
+static inline void check_request_init(uint16 slave) {
+    if (slave < EC_MAXSLAVE) {
+        g_check_force_init[slave].store(1, std::memory_order_relaxed);
+        check_event_post(CHECK_EVENT_FORCE_INIT);
+    }
+}
+
+/*
+ * Wait until an event is posted or timeout_ms expires (-1 = no timeout) and take the pending bits.
+ * Returns 0 on timeout.
+ */
+uint32_t check_event_wait(int timeout_ms) {
+    uint32_t events = g_check_pending.exchange(0, std::memory_order_acquire);
+    if (events == 0) {
+        if (g_check_fd >= 0) {
+            struct pollfd pfd = {g_check_fd, POLLIN, 0};
+            poll(&pfd, 1, timeout_ms);
+        } else {
+            osal_usleep(CHECK_RETRY_MS * 1000);
+        }
+        events = g_check_pending.exchange(0, std::memory_order_acquire);
+    }
+    if (g_check_fd >= 0) {
+        uint64_t count;
+        ssize_t got = read(g_check_fd, &count, sizeof(count)); // Reset the counter, EAGAIN if already 0
+        (void)got;
+    }
+    return events;
+}
+
+//##################################################################################################
+// Per-slave recovery.
+// Every slave has its own recovery state machine, driven by ecatcheck. One ecatcheck pass moves
+// each faulty slave on by at most one step, and every step is a few datagrams to that slave alone:
+// an AL status read (ec_FPRD), then an AL control write (ec_writestate) that is not waited for.
+// Waiting for the slave to change state is spread over the following passes (CHECK_RETRY_MS
+// apart) instead of statecheck loops. A slave that came back in INIT/PRE-OP (power cycle) is
+// reconfigured the way ec_reconfig_slave would do it, but one step per pass: INIT, then its sync
+// managers and PRE-OP, then the PDO mapping one SDO transfer per pass, then FMMUs, DC SYNC0 and
+// SAFE-OP. Only a slave that lost its address needs ec_recover_slave, with a short timeout.
+// While a slave is in recovery it is offline for ecatthread: its share of the working counter is
+// not expected and its axes are held disabled, so the axes of the healthy slaves keep running.
+
+#define REC_STEP_TIMEOUT_MS 500  // A step that shows no progress for this long is repeated
+#define REC_MAX_ATTEMPTS 3       // Repeats before moving on to the next, heavier step
+#define REC_PROBE_MS 100         // Period of ec_recover_slave for a lost slave
+
+enum SlaveRecoveryState {
+    REC_OK,          // In OP, not in recovery
+    REC_ACK_ERROR,   // SAFE_OP + ERROR acknowledged, waiting for SAFE_OP
+    REC_REQUEST_OP,  // OP requested, waiting for OP
+    REC_INIT,        // Reconfiguration: INIT requested, waiting for INIT
+    REC_PRE_OP,      // Sync managers written and PRE-OP requested, waiting for PRE-OP
+    REC_CONFIG,      // Writing the PDO mapping, one SDO transfer per pass
+    REC_SAFE_OP,     // FMMUs and SYNC0 written and SAFE-OP requested, waiting for SAFE-OP
+    REC_LOST         // Not answering, probing for it
+};
+const char *slave_recovery_names[] = {"ok", "ack error", "request op", "init", "pre-op", "config", "safe-op",
+                                      "lost"};
+
+struct SlaveRecovery {
+    uint8_t state;          // SlaveRecoveryState
+    uint8_t attempts;       // Times the current step was issued
+    int64 fault_ns;         // CLOCK_MONOTONIC time the fault was detected
+    int64 step_ns;          // Time the current step was issued
+    int config_next;        // REC_CONFIG: next write of the PDO mapping plan
+    bool config_ca;         // REC_CONFIG: the slave takes Complete Access writes
+    uint32_t recoveries;    // Completed recoveries
+    uint32_t retries;       // Steps repeated after REC_STEP_TIMEOUT_MS
+    int64 last_ns;          // Fault detection to OP of the last recovery
+    int64 max_ns;           // Longest recovery
+};
+
+// AL status registers, as read from ECT_REG_ALSTAT
+struct SlaveAlStatus {
+    uint16 alstatus;
+    uint16 reserved;
+    uint16 alstatuscode;
+} __attribute__((__packed__));
+
+SlaveRecovery g_recovery[EC_MAXSLAVE];            // Written by ecatcheck only, read by the reports
+std::atomic<uint8_t> g_slave_offline[EC_MAXSLAVE]; // Non-zero while the slave is in recovery
+std::atomic<int32_t> g_offline_wkc(0);             // Working counter share of the offline slaves
+std::atomic<uint32_t> g_offline_epoch(0);          // Bumped after every change of the offline set
+
+static int64 recovery_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+// Working counter share of one slave in an LRW frame: 2 for its outputs, 1 for its inputs
+static int slave_wkc_share(int slave) {
+    return (ec_slave[slave].Obytes > 0 ? 2 : 0) + (ec_slave[slave].Ibytes > 0 ? 1 : 0);
+}
+
+void recovery_reset() {
+    memset(g_recovery, 0, sizeof(g_recovery));
+    for (int slave = 0; slave < EC_MAXSLAVE; slave++) {
+        g_slave_offline[slave].store(0, std::memory_order_relaxed);
+    }
+    g_offline_wkc.store(0, std::memory_order_relaxed);
+    g_offline_epoch.fetch_add(1, std::memory_order_release);
+}
+
+static void recovery_set_offline(int slave, bool offline) {
+    if ((g_slave_offline[slave].load(std::memory_order_relaxed) != 0) == offline) {
+        return;
+    }
+    g_slave_offline[slave].store(offline, std::memory_order_relaxed);
+    g_offline_wkc.fetch_add(offline ? slave_wkc_share(slave) : -slave_wkc_share(slave), std::memory_order_relaxed);
+    g_offline_epoch.fetch_add(1, std::memory_order_release);
+}
+
+// Read the AL status of one slave into ec_slave[slave]; false if it did not answer
+static bool slave_read_state(int slave) {
+    SlaveAlStatus al;
+    if (ec_FPRD(ec_slave[slave].configadr, ECT_REG_ALSTAT, sizeof(al), &al, EC_TIMEOUTRET) <= 0) {
+        ec_slave[slave].state = EC_STATE_NONE;
+        return false;
+    }
+    ec_slave[slave].state = al.alstatus;
+    ec_slave[slave].ALstatuscode = al.alstatuscode;
+    return true;
+}
+
+// Request an AL state from one slave (one datagram, the state change is not waited for)
+static void recovery_request(int slave, uint16 state) {
+    ec_slave[slave].state = state;
+    ec_writestate(slave);
+}
+
+static void recovery_enter(SlaveRecovery *rec, uint8_t next, int64 now) {
+    rec->attempts = next == rec->state ? rec->attempts + 1 : 1;
+    rec->state = next;
+    rec->step_ns = now;
+}
+
+// Issue the step that moves a slave on from its current AL state
+static void recovery_issue(int slave, SlaveRecovery *rec, int64 now) {
+    uint16 state = ec_slave[slave].state;
+    if (state == (EC_STATE_SAFE_OP + EC_STATE_ERROR)) {
+        printf("ERROR: Slave %d is in SAFE_OP + ERROR (%s), attempting ack.\n", slave,
+               ec_ALstatuscode2string(ec_slave[slave].ALstatuscode));
+        recovery_request(slave, EC_STATE_SAFE_OP + EC_STATE_ACK);
+        recovery_enter(rec, REC_ACK_ERROR, now);
+    } else if (state == EC_STATE_SAFE_OP) {
+        printf("WARNING: Slave %d is in SAFE_OP, changing to OPERATIONAL.\n", slave);
+        recovery_request(slave, EC_STATE_OPERATIONAL);
+        recovery_enter(rec, REC_REQUEST_OP, now);
+    } else {
+        // INIT/PRE-OP after a power cycle, or an error in another state: redo the configuration
+        printf("MESSAGE: Slave %d in state 0x%02x, reconfiguring\n", slave, state);
+        recovery_request(slave, EC_STATE_INIT + ((state & EC_STATE_ERROR) ? EC_STATE_ACK : 0));
+        recovery_enter(rec, REC_INIT, now);
+    }
+}
+
+// Reconfiguration, INIT reached: sync managers as ec_config_map set them up, then PRE-OP
+static void recovery_pre_op(int slave, SlaveRecovery *rec, int64 now) {
+    uint16 configadr = ec_slave[slave].configadr;
+    ec_eeprom2pdi(slave);
+    for (int sm = 0; sm < EC_MAXSM; sm++) {
+        if (ec_slave[slave].SM[sm].StartAddr != 0) {
+            ec_FPWR(configadr, ECT_REG_SM0 + sm * sizeof(ec_smt), sizeof(ec_smt), &ec_slave[slave].SM[sm],
+                    EC_TIMEOUTRET);
+        }
+    }
+    recovery_request(slave, EC_STATE_PRE_OP);
+    recovery_enter(rec, REC_PRE_OP, now);
+}
+
+// Reconfiguration, PDO mapping written: FMMUs, DC SYNC0, then SAFE-OP
+static void recovery_safe_op(int slave, SlaveRecovery *rec, int64 now) {
+    uint16 configadr = ec_slave[slave].configadr;
+    for (int fmmu = 0; fmmu < ec_slave[slave].FMMUunused; fmmu++) {
+        ec_FPWR(configadr, ECT_REG_FMMU0 + fmmu * sizeof(ec_fmmut), sizeof(ec_fmmut), &ec_slave[slave].FMMU[fmmu],
+                EC_TIMEOUTRET);
+    }
+    ecx_dcsync0(&ecx_context, slave, TRUE, (uint32)g_config.sync0_us * 1000, g_config.sync0_shift_us * 1000);
+    recovery_request(slave, EC_STATE_SAFE_OP);
+    recovery_enter(rec, REC_SAFE_OP, now);
+}
+
+/*
+ * Start the recovery of a slave that ecatcheck found outside OP. The slave goes offline for
+ * ecatthread before the first step is issued.
+ */
+void recovery_begin(int slave) {
+    SlaveRecovery *rec = &g_recovery[slave];
+    int64 now = recovery_now_ns();
+    rec->fault_ns = now;
+    rec->attempts = 0;
+    recovery_set_offline(slave, true);
+    if (ec_slave[slave].state == EC_STATE_NONE) {
+        ec_slave[slave].islost = TRUE;
+        rec->state = REC_LOST;
+        rec->step_ns = 0; // Probe at the next pass
+        printf("ERROR: Slave %d lost\n", slave);
+        return;
+    }
+    rec->state = REC_OK;
+    recovery_issue(slave, rec, now);
+}
+
+static void recovery_finish(int slave, SlaveRecovery *rec, int64 now) {
+    rec->last_ns = now - rec->fault_ns;
+    if (rec->last_ns > rec->max_ns) {
+        rec->max_ns = rec->last_ns;
+    }
+    rec->recoveries++;
+    rec->state = REC_OK;
+    recovery_set_offline(slave, false);
+    printf("MESSAGE: Slave %d back in OPERATIONAL after %.1f ms\n", slave, rec->last_ns / 1e6);
+}
+
+/*
+ * Advance the recovery of one slave by one step. Returns true while the slave is still in
+ * recovery.
+ */
+bool recovery_step(int slave) {
+    SlaveRecovery *rec = &g_recovery[slave];
+    int64 now = recovery_now_ns();
+    bool timed_out = now - rec->step_ns >= (int64)REC_STEP_TIMEOUT_MS * 1000000;
+
+    if (rec->state == REC_LOST) {
+        if (slave_read_state(slave)) {
+            ec_slave[slave].islost = FALSE;
+            printf("MESSAGE: Slave %d found\n", slave);
+        } else if (now - rec->step_ns >= (int64)REC_PROBE_MS * 1000000) {
+            rec->step_ns = now;
+            if (ec_recover_slave(slave, EC_TIMEOUTRET) <= 0 || !slave_read_state(slave)) {
+                return true;
+            }
+            ec_slave[slave].islost = FALSE;
+            printf("MESSAGE: Slave %d recovered\n", slave);
+        } else {
+            return true;
+        }
+        rec->state = REC_OK;
+        recovery_issue(slave, rec, now);
+        return true;
+    }
+
+    if (!slave_read_state(slave)) {
+        ec_slave[slave].islost = TRUE;
+        rec->state = REC_LOST;
+        rec->step_ns = 0;
+        printf("ERROR: Slave %d lost\n", slave);
+        return true;
+    }
+    uint16 state = ec_slave[slave].state;
+    if (state == EC_STATE_OPERATIONAL) {
+        recovery_finish(slave, rec, now);
+        return false;
+    }
+
+    // Reconfiguration: each step is issued once the slave reached the state the previous one asked
+    // for. An error on the way starts it over from INIT.
+    bool reconfiguring = rec->state >= REC_INIT && rec->state <= REC_SAFE_OP;
+    if (reconfiguring && (state & EC_STATE_ERROR)) {
+        rec->retries++;
+        recovery_issue(slave, rec, now);
+    } else if (rec->state == REC_INIT && state == EC_STATE_INIT) {
+        recovery_pre_op(slave, rec, now);
+    } else if (rec->state == REC_PRE_OP && state == EC_STATE_PRE_OP) {
+        rec->config_next = 0;
+        rec->config_ca = (ec_slave[slave].CoEdetails & ECT_COEDET_SDOCA) != 0;
+        recovery_enter(rec, REC_CONFIG, now);
+    } else if (rec->state == REC_CONFIG && state == EC_STATE_PRE_OP) {
+        if (!pdo_mapping_step(slave, &rec->config_next, &rec->config_ca)) {
+            recovery_safe_op(slave, rec, now);
+        }
+    } else if (rec->state == REC_SAFE_OP && state == EC_STATE_SAFE_OP) {
+        printf("MESSAGE: Slave %d reconfigured\n", slave);
+        recovery_issue(slave, rec, now);
+    } else if (!reconfiguring &&
+               ((rec->state == REC_ACK_ERROR && state == EC_STATE_SAFE_OP) ||
+                (rec->state == REC_REQUEST_OP && state == (EC_STATE_SAFE_OP + EC_STATE_ERROR)) ||
+                (state & 0x0F) < EC_STATE_SAFE_OP)) { // Power cycled
+        recovery_issue(slave, rec, now);
+    } else if (timed_out) {
+        // No progress for REC_STEP_TIMEOUT_MS: repeat the step, after REC_MAX_ATTEMPTS reconfigure
+        rec->retries++;
+        if (reconfiguring || rec->attempts >= REC_MAX_ATTEMPTS) {
+            ec_slave[slave].state = EC_STATE_INIT; // Escalate to a (new) reconfiguration
+        }
+        recovery_issue(slave, rec, now);
+    }
+    return true;
+}
+
+/*
+ * Find the slaves of a group that left OP and start their recovery. One broadcast read of the AL
+ * status (ORed over all slaves, the group state) tells whether every slave is in OP; only if not
+ * are the slaves that are not in recovery yet read one by one.
+ */
+void recovery_scan(uint8 group) {
+    uint16 alstatus = 0;
+    int wkc_state = ec_BRD(0x0000, ECT_REG_ALSTAT, sizeof(alstatus), &alstatus, EC_TIMEOUTRET);
+    ec_slave[0].state = alstatus;
+    if (wkc_state >= ec_slavecount && alstatus == EC_STATE_OPERATIONAL) {
+        return;
+    }
+    for (int slave = 1; slave <= ec_slavecount; slave++) {
+        if (ec_slave[slave].group == group && g_recovery[slave].state == REC_OK &&
+            (!slave_read_state(slave) || ec_slave[slave].state != EC_STATE_OPERATIONAL)) {
+            recovery_begin(slave);
+        }
+    }
+}
+
+// Number of slaves currently in recovery
+int recovery_active() {
+    int active = 0;
+    for (int slave = 1; slave <= ec_slavecount; slave++) {
+        active += g_recovery[slave].state != REC_OK;
+    }
+    return active;
+}
+
+// Per-slave recovery counters and latencies, for the latency report
+void recovery_print(FILE *out) {
+    for (int slave = 1; slave <= ec_slavecount; slave++) {
+        const SlaveRecovery &rec = g_recovery[slave];
+        if (rec.recoveries == 0 && rec.state == REC_OK) {
+            continue;
+        }
+        fprintf(out, "  slave %d: %s, %u recoveries, last %.1f ms, max %.1f ms, %u retried steps\n", slave,
+                slave_recovery_names[rec.state], rec.recoveries, rec.last_ns / 1e6, rec.max_ns / 1e6, rec.retries);
+    }
+}
+
+// Mark the axes of offline slaves (ecatthread, when g_offline_epoch changed). Returns the working
+// counter share of the offline slaves.
+int32_t axes_sync_offline(AxisArray *axes) {
+    for (int a = 0; a < axes->count; a++) {
+        axes->offline[a] = g_slave_offline[axes->slave[a]].load(std::memory_order_relaxed);
+    }
+    return g_offline_wkc.load(std::memory_order_relaxed);
+}
+
+//##################################################################################################
+// RT-safe deferred logger.
+// ecatthread never calls printf: it writes fixed-size binary records into a preallocated ring and
+// the non-RT logthread formats and prints them.
+
+enum RtLogKind : uint8_t {
+    RTLOG_DEBUG,             // Periodic debug line (fault injection state)
+    RTLOG_STATUS,            // Periodic motor status
+    RTLOG_WKC_ERROR,         // Working counter below expected
+    RTLOG_CYCLE_OVERRUN,     // Cycle took longer than 1.5x the cycle time
+    RTLOG_SLEEP_INTERRUPTED, // clock_nanosleep returned an error
+    RTLOG_CLOCK_RESYNC,      // Too many missed cycles, cycle clock resynchronized
+    RTLOG_DC_LOCK,           // DC synchronisation locked (aux: cycles it took, aux2: offset ns)
+    RTLOG_DC_UNLOCK,         // DC synchronisation lost its lock (aux: phase error ns)
+    RTLOG_FAULT_START,       // Fault injected (aux: FaultKind, aux2: value, axis: lost slave)
+    RTLOG_FAULT_RECOVERED    // Loop healthy after a fault (aux: FaultKind, aux2: recovery us)
+};
+
+// Flag bits stored in RtLogRecord::flags
+#define RTLOG_FLAG_FAULT_ACTIVE 0x01
+
+// One log entry (32 bytes, no pointers, copied by value into the ring)
+struct RtLogRecord {
+    uint32_t cycle;  // dorun when the record was written
+    int32_t wkc;     // Work counter of the cycle
+    int32_t pos;     // Actual position
+    int32_t vel;     // Actual velocity
+    int32_t aux;     // Kind specific: target, expected WKC, cycle time, missed cycles...
+    int32_t aux2;    // Kind specific: active faults, expected cycle time...
+    int16_t torque;  // Actual torque
+    uint8_t kind;    // RtLogKind
+    uint8_t flags;   // RTLOG_FLAG_* bits
+    uint16_t axis;   // Axis the record refers to
+};
+
+#define RTLOG_RING_SIZE 4096 // Records buffered between the RT thread and logthread
+
+SpscRing<RtLogRecord, RTLOG_RING_SIZE> g_rtlog_ring;
+std::atomic<uint32_t> g_rtlog_dropped(0); // Records lost because the ring was full
+
+// Write a log record from the RT thread. Never blocks: if the ring is full the record is counted
+// as dropped and discarded.
+void rt_log(uint8_t kind, uint32_t cycle, int32_t wkc_value, const txpdo_t *status,
+            int32_t aux, int32_t aux2, uint8_t flags, uint16_t axis = 0) {
+    RtLogRecord rec;
+    rec.cycle = cycle;
+    rec.wkc = wkc_value;
+    rec.pos = status ? status->actual_position : 0;
+    rec.vel = status ? status->actual_velocity : 0;
+    rec.torque = status ? status->actual_torque : 0;
+    rec.axis = axis;
+    rec.aux = aux;
+    rec.aux2 = aux2;
+    rec.kind = kind;
+    rec.flags = flags;
+    if (!g_rtlog_ring.push(rec)) {
+        g_rtlog_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Format one record the way ecatthread used to print it
+void format_rt_log(FILE *out, const RtLogRecord &rec) {
+    switch (rec.kind) {
+    case RTLOG_DEBUG:
+        fprintf(out, "DEBUG: dorun=%u, wkc=%d, faults active=0x%x\n", rec.cycle, rec.wkc, (uint32_t)rec.aux2);
+        break;
+    case RTLOG_STATUS:
+        fprintf(out, "Status: axis=%u, pos=%d, target=%d, vel=%d, torque=%d\n",
+                rec.axis, rec.pos, rec.aux, rec.vel, rec.torque);
+        if (rec.flags & RTLOG_FLAG_FAULT_ACTIVE) {
+            fprintf(out, ">>> FAULT INJECTION ACTIVE (faults 0x%x) <<<\n", (uint32_t)rec.aux2);
+        }
+        break;
+    case RTLOG_WKC_ERROR:
+        fprintf(out, "WARNING: Working counter error (wkc: %d, expected: %d)\n", rec.wkc, rec.aux);
+        break;
+    case RTLOG_CYCLE_OVERRUN:
+        fprintf(out, "WARNING: Cycle time exceeded: %d ns (expected: %d ns)\n", rec.aux, rec.aux2);
+        break;
+    case RTLOG_SLEEP_INTERRUPTED:
+        fprintf(out, "WARNING: Clock sleep interrupted, missed cycles: %d\n", rec.aux);
+        break;
+    case RTLOG_CLOCK_RESYNC:
+        fprintf(out, "ERROR: Too many missed cycles, attempting recovery...\n");
+        break;
+    case RTLOG_DC_LOCK:
+        fprintf(out, "DC sync locked after %d cycles, offset %d ns\n", rec.aux, rec.aux2);
+        break;
+    case RTLOG_DC_UNLOCK:
+        fprintf(out, "WARNING: DC sync lost lock, phase error %d ns\n", rec.aux);
+        break;
+    case RTLOG_FAULT_START:
+        if (rec.axis != 0) {
+            fprintf(out, "FAULT: injecting %s on slave %u\n", fault_kind_name(rec.aux), rec.axis);
+        } else {
+            fprintf(out, "FAULT: injecting %s (value %d)\n", fault_kind_name(rec.aux), rec.aux2);
+        }
+        break;
+    case RTLOG_FAULT_RECOVERED:
+        fprintf(out, "FAULT: recovered from %s after %d us\n", fault_kind_name(rec.aux), rec.aux2);
+        break;
+    default:
+        fprintf(out, "Unknown log record kind %d at cycle %u\n", rec.kind, rec.cycle);
+        break;
+    }
+}
+
+// Format and print everything currently queued. Returns the number of records written.
+int drain_rt_log(FILE *out) {
+    RtLogRecord rec;
+    int count = 0;
+    while (g_rtlog_ring.pop(rec)) {
+        format_rt_log(out, rec);
+        count++;
+    }
+    uint32_t dropped = g_rtlog_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+        fprintf(out, "WARNING: RT log ring full, %u records dropped\n", dropped);
+    }
+    return count;
+}
+
+
+//##################################################################################################
+// Per-cycle latency histograms.
+// HDR-style log-linear buckets: values below 2 * LAT_SUB_BUCKETS ns are exact, above that every
+// power of two is split into LAT_SUB_BUCKETS linear buckets (about 3% relative error). Recording is
+// a handful of relaxed atomic operations with no allocation, so it is safe on the RT thread.
+
+#define LAT_SUB_BITS 5                      // log2 of the sub-buckets per power of two
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS 32                     // Values are clamped to 2^32 - 1 ns (about 4.3 s)
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() { reset(); }
+
+    // Record one sample. Single writer (the RT thread); readers may run concurrently.
+    void record(int64 ns) {
+        if (ns < 0) {
+            ns = 0;
+        }
+        uint64_t v = (uint64_t)ns;
+        if (v > 0xFFFFFFFFull) {
+            v = 0xFFFFFFFFull;
+        }
+        bump(buckets[bucket_index(v)]);
+        bump(total);
+        sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        if (v < min.load(std::memory_order_relaxed)) {
+            min.store(v, std::memory_order_relaxed);
+        }
+        if (v > max.load(std::memory_order_relaxed)) {
+            max.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    // Not synchronized with record(): only call while the writer is idle
+    void reset() {
+        for (int i = 0; i < LAT_BUCKETS; i++) {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(UINT64_MAX, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t min_ns() const { return count() ? min.load(std::memory_order_relaxed) : 0; }
+    uint64_t max_ns() const { return max.load(std::memory_order_relaxed); }
+    double avg_ns() const {
+        uint64_t n = count();
+        return n ? (double)sum.load(std::memory_order_relaxed) / n : 0.0;
+    }
+
+    // Highest value equivalent to the bucket holding the given percentile (0..100)
+    uint64_t percentile_ns(double pct) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)ceil(pct / 100.0 * n);
+        if (rank == 0) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < LAT_BUCKETS; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t upper = bucket_upper(i);
+                return upper < max_ns() ? upper : max_ns();
+            }
+        }
+        return max_ns();
+    }
+
+    void print(FILE *out, const char *label) const {
+        fprintf(out, "  %-16s n=%-10" PRIu64 " min=%8.2f avg=%8.2f p99=%8.2f p99.9=%8.2f max=%8.2f us\n",
+                label, count(), min_ns() / 1000.0, avg_ns() / 1000.0,
+                percentile_ns(99.0) / 1000.0, percentile_ns(99.9) / 1000.0, max_ns() / 1000.0);
+    }
+
+private:
+    static int bucket_index(uint64_t v) {
+        if (v < 2 * LAT_SUB_BUCKETS) {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - LAT_SUB_BITS;
+        return shift * LAT_SUB_BUCKETS + (int)(v >> shift);
+    }
+
+    static uint64_t bucket_upper(int index) {
+        if (index < 2 * LAT_SUB_BUCKETS) {
+            return (uint64_t)index;
+        }
+        int shift = index / LAT_SUB_BUCKETS - 1;
+        uint64_t mantissa = (uint64_t)(index - shift * LAT_SUB_BUCKETS);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    static void bump(std::atomic<uint64_t> &counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[LAT_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+};
+
+// Stages of one ecatthread cycle
+enum LatencyStage {
+    LAT_WAKEUP,  // Cycle deadline to actual wake-up (kernel/timer, or spin granularity)
+    LAT_RECEIVE, // ec_receive_processdata (NIC / frame round trip)
+    LAT_COMPUTE, // Control logic between receive and send (our code)
+    LAT_SEND,    // ec_send_processdata
+    LAT_STAGE_COUNT
+};
+
+const char *latency_stage_names[LAT_STAGE_COUNT] = {"wake-up", "receive", "compute", "send"};
+
+LatencyHistogram g_latency[LAT_STAGE_COUNT];
+std::atomic<bool> g_latency_report_requested(false); // Set by SIGUSR1, handled by logthread
+
+void print_latency_report(FILE *out) {
+    fprintf(out, "Cycle latency report (wait = %s", wait_strategy_names[g_config.wait_strategy]);
+    if (g_config.wait_strategy == WAIT_HYBRID) {
+        fprintf(out, ", spin %d us", g_config.spin_us);
+    }
+    fprintf(out, "):\n");
+    TelemetrySnapshot snapshot = g_telemetry.load();
+    if (snapshot.dc.state != DC_UNSYNCED) {
+        fprintf(out, "  DC sync %s, offset %d ns, last error %d ns, drift %.2f ppm, locked %u cycles, "
+                "max locked error %d ns\n", dc_sync_state_names[snapshot.dc.state], snapshot.dc.offset_ns,
+                snapshot.dc.delta_ns, snapshot.dc.drift_ppm, snapshot.dc.locked_cycles,
+                snapshot.dc.max_locked_ns);
+    }
+    fprintf(out, "  ecatcheck: %u wake-ups, %u consecutive WKC errors, %d slaves in recovery\n",
+            g_check_wakeups.load(), g_check_bad_cycles.load(), recovery_active());
+    cycle_budget_print(out, &g_budget);
+    recovery_print(out);
+    server_print(out);
+    for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+        g_latency[i].print(out, latency_stage_names[i]);
+    }
+    fault_print(out);
+}
+
+// SIGUSR1 handler: only raises a flag, the report is printed by logthread
+void request_latency_report(int sig) {
+    (void)sig;
+    g_latency_report_requested.store(true, std::memory_order_relaxed);
+}
+
+//##################################################################################################
+// Fault injection.
+// Resilience tests script faults into the running loop. Build with -DEROB_FAULT_INJECTION and start
+// with "--faults <file>"; without the define every hook below is an empty inline function and the
+// cycle compiles as if they were not there. One fault per line, '#' starts a comment:
+//     <kind> <schedule> key=value ...
+//   kinds:     delay    extra compute time of value us (default 1500) after the control logic
+//              drop     the cycle's frame is not sent, so the next receive finds none
+//              wkc      the working counter is reduced by value (default 1)
+//              lost     slave `slave` disconnects; the simulation reconnects it after the duration,
+//                       real hardware is requested to INIT and brought back by ecatcheck
+//              dc_step  the DC reference time jumps by value ns and stays there
+//   schedules: once     at cycle `start`
+//              periodic every `period` cycles from `start`
+//              random   from `start`, on average once every `period` cycles (xorshift, `seed`)
+//   keys:      start, duration (cycles, default 1), period, value, slave, seed
+// Example, the former hard-coded delay test plus a lost slave:
+//     delay once start=15000 duration=1000 value=1500
+//     lost once start=20000 duration=2000 slave=1
+// When an injection ends the time until the loop is healthy again (expected working counter, no
+// slave in recovery, DC phase in the lock band) and stays so for FAULT_SETTLE_CYCLES is recorded in
+// a latency histogram per kind.
+
+enum FaultKind {
+    FAULT_DELAY,        // Extra compute time
+    FAULT_DROP_FRAME,   // Lost frame
+    FAULT_CORRUPT_WKC,  // Working counter too low
+    FAULT_SLAVE_LOSS,   // Slave disconnected
+    FAULT_DC_STEP,      // Step of the DC reference time
+    FAULT_KIND_COUNT
+};
+
+const char *fault_kind_names[FAULT_KIND_COUNT] = {"delay", "drop", "wkc", "lost", "dc_step"};
+
+const char *fault_kind_name(int kind) {
+    return kind >= 0 && kind < FAULT_KIND_COUNT ? fault_kind_names[kind] : "?";
+}
+
+#ifdef EROB_FAULT_INJECTION
+
+#define FAULT_MAX 16            // Faults per script
+#define FAULT_SETTLE_CYCLES 200 // Healthy cycles in a row that count as recovered
+
+enum FaultSchedule {
+    FAULT_ONCE,
+    FAULT_PERIODIC,
+    FAULT_RANDOM
+};
+
+const char *fault_schedule_names[] = {"once", "periodic", "random"};
+
+struct Fault {
+    uint8_t kind;        // FaultKind
+    uint8_t schedule;    // FaultSchedule
+    uint16_t slave;      // lost: slave position
+    uint32_t start;      // First cycle
+    uint32_t duration;   // Cycles per injection
+    uint32_t period;     // periodic: cycles between injections, random: mean cycles between them
+    int32_t value;       // delay: us, wkc: decrement, dc_step: ns
+    uint32_t next;       // Cycle of the next injection, UINT32_MAX when there is none
+    uint32_t until;      // End of the current injection (exclusive), 0 when not injecting
+    int64 ended_ns;      // End of the last injection while waiting for recovery, 0 otherwise
+    uint32_t injections; // Injections so far
+    uint32_t recovered;  // Injections after which the loop recovered
+};
+
+struct FaultPlan {
+    int count;
+    Fault faults[FAULT_MAX];
+    uint64_t rng;         // xorshift64 state of the random schedules
+    int64 dc_offset_ns;   // Sum of the DC steps injected so far
+    uint32_t active;      // Bit per fault injecting in this cycle
+    int32_t delay_us;     // Extra compute time of this cycle
+    int32_t wkc_delta;    // Working counter reduction of this cycle
+    bool drop;            // Frame of this cycle is not sent
+    uint32_t healthy;     // Healthy cycles in a row
+    int64 healthy_ns;     // Start of that streak
+};
+
+FaultPlan g_faults;
+LatencyHistogram g_fault_recovery[FAULT_KIND_COUNT]; // End of an injection to a healthy cycle
+
+static uint32_t fault_random_gap(FaultPlan *plan, uint32_t period) {
+    plan->rng ^= plan->rng << 13;
+    plan->rng ^= plan->rng >> 7;
+    plan->rng ^= plan->rng << 17;
+    return 1 + (uint32_t)(plan->rng % (2 * (uint64_t)period)); // Mean is period
+}
+
+// Parse one script line into plan. Returns false on a syntax error.
+static bool fault_parse(FaultPlan *plan, char *line) {
+    char *save = NULL;
+    char *kind = strtok_r(line, " \t\r\n", &save);
+    char *schedule = strtok_r(NULL, " \t\r\n", &save);
+    if (kind == NULL || schedule == NULL || plan->count >= FAULT_MAX) {
+        return false;
+    }
+    Fault f;
+    memset(&f, 0, sizeof(f));
+    f.kind = FAULT_KIND_COUNT;
+    for (int k = 0; k < FAULT_KIND_COUNT; k++) {
+        if (strcmp(kind, fault_kind_names[k]) == 0) {
+            f.kind = k;
+        }
+    }
+    f.schedule = 0xFF;
+    for (int s = 0; s <= FAULT_RANDOM; s++) {
+        if (strcmp(schedule, fault_schedule_names[s]) == 0) {
+            f.schedule = s;
+        }
+    }
+    if (f.kind == FAULT_KIND_COUNT || f.schedule == 0xFF) {
+        return false;
+    }
+    int start = 0, duration = 1, period = 0, slave = 1, seed = 0;
+    int value = f.kind == FAULT_DELAY ? 1500 : f.kind == FAULT_CORRUPT_WKC ? 1 : 0;
+    char *token;
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        char *equal = strchr(token, '=');
+        if (equal == NULL) {
+            return false;
+        }
+        *equal = '\0';
+        int *field = strcmp(token, "start") == 0 ? &start : strcmp(token, "duration") == 0 ? &duration :
+                     strcmp(token, "period") == 0 ? &period : strcmp(token, "value") == 0 ? &value :
+                     strcmp(token, "slave") == 0 ? &slave : strcmp(token, "seed") == 0 ? &seed : NULL;
+        if (field == NULL || !config_parse_int(equal + 1, field)) {
+            return false;
+        }
+    }
+    if (start < 0 || duration < 1 || period < 0 || slave < 1 || slave >= EC_MAXSLAVE ||
+        (f.schedule != FAULT_ONCE && period < 1)) {
+        return false;
+    }
+    f.start = start;
+    f.duration = duration;
+    f.period = period;
+    f.value = value;
+    f.slave = slave;
+    f.next = start;
+    if (seed != 0) {
+        plan->rng = (uint64_t)seed;
+    }
+    plan->faults[plan->count++] = f;
+    return true;
+}
+
+/*
+ * Load a fault script (format above). Call before erob_start.
+ * Returns false if the file cannot be read or has errors; nothing is injected then.
+ */
+bool fault_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    FaultPlan *plan = &g_faults;
+    memset(plan, 0, sizeof(*plan));
+    plan->rng = 0x9E3779B97F4A7C15ull;
+    char line[256];
+    int line_number = 0;
+    int errors = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        if (*config_trim(line) == '\0') {
+            continue;
+        }
+        if (!fault_parse(plan, line)) {
+            printf("%s:%d: invalid fault\n", path, line_number);
+            errors++;
+        }
+    }
+    fclose(file);
+    if (errors > 0) {
+        plan->count = 0;
+        return false;
+    }
+    for (int i = 0; i < FAULT_KIND_COUNT; i++) {
+        g_fault_recovery[i].reset();
+    }
+    printf("Fault injection: %d faults from %s\n", plan->count, path);
+    return true;
+}
+
+static void fault_start(FaultPlan *plan, Fault *f) {
+    switch (f->kind) {
+    case FAULT_SLAVE_LOSS:
+#ifdef EROB_SIM
+        sim_slave_set_lost(f->slave, true);
+#else
+        // A cable cannot be pulled from software: ecatcheck requests INIT from the slave instead
+        if (f->slave <= ec_slavecount) {
+            check_request_init(f->slave);
+        }
+#endif
+        break;
+    case FAULT_DC_STEP:
+        plan->dc_offset_ns += f->value;
+        break;
+    default:
+        break;
+    }
+}
 
-// Add these global variables after the other global declarations
-volatile int target_position = 0;
-pthread_mutex_t target_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t target_position_cond = PTHREAD_COND_INITIALIZER;
-bool target_updated = false;
-int32_t received_target = 0;
+static void fault_end(Fault *f) {
+#ifdef EROB_SIM
+    if (f->kind == FAULT_SLAVE_LOSS) {
+        sim_slave_set_lost(f->slave, false);
+    }
+#else
+    (void)f;
+#endif
+}
 
-// Add in the global variable declaration section at the beginning of the file
-rxpdo_t rxpdo;  // Global variable, used for sending data to slaves
-txpdo_t txpdo;  // Global variable, used for receiving data from slaves
+/*
+ * Start and end the scheduled injections at the beginning of a cycle and collect what the
+ * active ones do to it. RT thread only.
+ */
+static inline void fault_cycle_begin(uint32_t cycle) {
+    FaultPlan *plan = &g_faults;
+    plan->active = 0;
+    plan->delay_us = 0;
+    plan->wkc_delta = 0;
+    plan->drop = false;
+    for (int i = 0; i < plan->count; i++) {
+        Fault *f = &plan->faults[i];
+        if (f->until == 0 && cycle >= f->next) {
+            f->until = cycle + f->duration;
+            f->ended_ns = 0; // A measurement still open is superseded
+            f->injections++;
+            if (f->schedule == FAULT_ONCE) {
+                f->next = UINT32_MAX;
+            } else if (f->schedule == FAULT_PERIODIC) {
+                f->next = cycle + f->period;
+            } else {
+                f->next = cycle + fault_random_gap(plan, f->period);
+            }
+            fault_start(plan, f);
+            rt_log(RTLOG_FAULT_START, cycle, 0, NULL, f->kind, f->value, 0,
+                   f->kind == FAULT_SLAVE_LOSS ? f->slave : 0);
+        }
+        if (f->until == 0) {
+            continue;
+        }
+        if (cycle < f->until) {
+            plan->active |= 1u << i;
+            if (f->kind == FAULT_DELAY) {
+                plan->delay_us += f->value;
+            } else if (f->kind == FAULT_DROP_FRAME) {
+                plan->drop = true;
+            } else if (f->kind == FAULT_CORRUPT_WKC) {
+                plan->wkc_delta += f->value;
+            }
+        } else {
+            f->until = 0;
+            f->ended_ns = monotonic_ns();
+            fault_end(f);
+        }
+    }
+}
 
-// 在全局变量区域添加
-struct MotorStatus {
-    bool is_operational;
-    uint16_t status_word;
-    int32_t actual_position;
-    int32_t actual_velocity;
-    int16_t actual_torque;
-} motor_status;
+// Working counter of the cycle as the injected faults leave it
+static inline int fault_filter_wkc(int wkc_value) {
+    return wkc_value - g_faults.wkc_delta;
+}
 
+// True if the cycle's frame is to be dropped: it is never sent, so neither the slaves apply its
+// outputs nor the next receive finds it
+static inline bool fault_skip_send() {
+    return g_faults.drop;
+}
 
-void update_motor_status(int slave_id);  // Add function declaration
+// Extra compute time of the cycle
+static inline void fault_compute_delay() {
+    if (g_faults.delay_us > 0) {
+        struct timespec delay = {0, (long)g_faults.delay_us * 1000};
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, NULL);
+    }
+}
 
-// 在文件开头，其他宏定义之后添加
-#undef MAX_VELOCITY  // Ensure there are no naming conflicts
-#undef MAX_ACCELERATION
+// Offset added to the DC reference time
+static inline int64 fault_dc_offset() {
+    return g_faults.dc_offset_ns;
+}
 
-// 在全局变量声明区域添加
-struct MotionPlanner {
-    int32_t start_position;    // Start position
-    int32_t target_position;   // Final target position
-    int32_t smooth_target;     // Smoothed target position for transition
-    int32_t current_position;  // Current planned position
-    double current_velocity;   // Current velocity
-    double start_time;         // Start time
-    double total_time;         // Total time
-    double current_time;       // Current time
-    bool is_moving;            // Movement state
-    
-    // Motion parameters
-    static constexpr double MAX_VELOCITY = 50000.0;     // Maximum velocity limit
-    static constexpr double CYCLE_TIME = 0.0005;          // Cycle time (1ms)
-    static constexpr double SMOOTH_FACTOR = 0.002;        // Smoothing factor for target position
+// Bit per fault injecting in this cycle
+static inline uint32_t fault_active() {
+    return g_faults.active;
+}
 
-    // Quintic polynomial coefficients
-    double a0, a1, a2, a3, a4, a5;
+static inline bool fault_plan_loaded() {
+    return g_faults.count > 0;
+}
 
-    MotionPlanner() : start_position(0), target_position(0), smooth_target(0),
-                      current_position(0), current_velocity(0.0),
-                      start_time(0.0), total_time(0.0), current_time(0.0),
-                      is_moving(false) {}
+// Close the recovery measurements of ended injections once the loop has settled
+static inline void fault_cycle_end(uint32_t cycle, bool healthy) {
+    FaultPlan *plan = &g_faults;
+    if (!healthy) {
+        plan->healthy = 0;
+        return;
+    }
+    if (plan->healthy++ == 0) {
+        plan->healthy_ns = monotonic_ns();
+    }
+    if (plan->healthy < FAULT_SETTLE_CYCLES) {
+        return;
+    }
+    for (int i = 0; i < plan->count; i++) {
+        Fault *f = &plan->faults[i];
+        if (f->ended_ns != 0) {
+            int64 ns = plan->healthy_ns > f->ended_ns ? plan->healthy_ns - f->ended_ns : 0;
+            g_fault_recovery[f->kind].record(ns);
+            f->recovered++;
+            f->ended_ns = 0;
+            rt_log(RTLOG_FAULT_RECOVERED, cycle, 0, NULL, f->kind, (int32_t)(ns / 1000), 0);
+        }
+    }
+}
+
+void fault_print(FILE *out) {
+    const FaultPlan *plan = &g_faults;
+    if (plan->count == 0) {
+        return;
+    }
+    fprintf(out, "  Fault injection:\n");
+    for (int i = 0; i < plan->count; i++) {
+        const Fault *f = &plan->faults[i];
+        fprintf(out, "    %-8s %-8s start %u, %u cycles, value %d", fault_kind_names[f->kind],
+                fault_schedule_names[f->schedule], f->start, f->duration, f->value);
+        if (f->kind == FAULT_SLAVE_LOSS) {
+            fprintf(out, ", slave %u", f->slave);
+        }
+        fprintf(out, ": %u injected, %u recovered%s\n", f->injections, f->recovered,
+                f->until != 0 ? " (active)" : f->ended_ns != 0 ? " (recovering)" : "");
+    }
+    for (int k = 0; k < FAULT_KIND_COUNT; k++) {
+        if (g_fault_recovery[k].count() > 0) {
+            char label[32];
+            snprintf(label, sizeof(label), "recover %s", fault_kind_names[k]);
+            g_fault_recovery[k].print(out, label);
+        }
+    }
+}
+
+#else // !EROB_FAULT_INJECTION
+
+bool fault_load(const char *path) {
+    printf("%s: built without EROB_FAULT_INJECTION, no faults injected\n", path);
+    return false;
+}
+
+void fault_print(FILE *out) {
+    (void)out;
+}
+
+static inline void fault_cycle_begin(uint32_t) {}
+static inline int fault_filter_wkc(int wkc_value) { return wkc_value; }
+static inline bool fault_skip_send() { return false; }
+static inline void fault_compute_delay() {}
+static inline int64 fault_dc_offset() { return 0; }
+static inline uint32_t fault_active() { return 0; }
+static inline bool fault_plan_loaded() { return false; }
+static inline void fault_cycle_end(uint32_t, bool) {}
+
+#endif // EROB_FAULT_INJECTION
+
+//##################################################################################################
+// Batched SDO configuration.
+// The PDO mapping is described once as a list of SDO writes and applied to every slave by
+// sdo_config_run(). Each slave gets its own worker thread, so the mailbox round trips of different
+// slaves overlap instead of being paid one after another. SOEM serialises access to the frame
+// buffers internally and every slave has its own mailbox, but SDO aborts and mailbox errors are
+// pushed onto the context's error list without any locking. Each job therefore talks to SOEM
+// through its own copy of ecx_context with a private error list (slaves, port and frame buffers
+// stay shared), and sdo_config_run prints the collected errors after all workers have joined.
+// The writes for one slave stay strictly in order.
+// Mapping and assignment objects are written whole with Complete Access (one transfer per object).
+// Each CA write is followed in the plan by the equivalent per-subindex writes, which only run if
+// the slave does not support CA or rejects the transfer.
+
+#define SDO_MAX_ENTRIES 8                          // Maximum entries of one mapping/assignment object
+#define SDO_MAX_DATA (2 + 4 * SDO_MAX_ENTRIES)     // Largest SDO payload in bytes (CA image)
+#define SDO_PLAN_MAX_WRITES 64                     // Maximum number of writes in one plan
+
+// One SDO download
+struct SdoWrite {
+    uint16 index;
+    uint8 subindex;
+    uint8 size;
+    boolean ca;          // Complete Access transfer
+    uint8 fallback;      // For CA writes: number of following writes that replace it on failure
+    uint8 data[SDO_MAX_DATA];
 };
 
-// Define static member variables
-constexpr double MotionPlanner::MAX_VELOCITY;
-constexpr double MotionPlanner::CYCLE_TIME;
-constexpr double MotionPlanner::SMOOTH_FACTOR;
+// Ordered list of SDO writes applied to one slave
+struct SdoPlan {
+    int count;
+    SdoWrite writes[SDO_PLAN_MAX_WRITES];
+};
 
-// Global variable
-MotionPlanner g_motion_planner;
+// Performs one SDO write. Same contract as ec_SDOwrite: returns the working counter, > 0 on success.
+typedef int (*SdoWriteFunc)(uint16 slave, uint16 index, uint8 subindex, boolean ca, int size,
+                            const void *data, int timeout);
 
-// Function declaration
-int32_t plan_trajectory(MotionPlanner* planner, int32_t actual_position);
+// Performs one SDO read. Same contract as ec_SDOread.
+typedef int (*SdoReadFunc)(uint16 slave, uint16 index, uint8 subindex, boolean ca, int *size,
+                           void *data, int timeout);
+
+// Configuration work for one slave and its outcome
+struct SdoJob {
+    uint16 slave;
+    const SdoPlan *plan;
+    SdoWriteFunc write;
+    SdoReadFunc read;
+    bool verify;          // Without CA: read the objects back first and skip the plan if unchanged
+    bool unchanged;       // Plan skipped: the slave already held the mapping
+    bool complete_access; // Slave supports CA (ECT_COEDET_SDOCA); cleared if it rejects a CA write
+    int result;           // Sum of the write return values
+    int failed;           // Number of writes that returned <= 0
+    int transfers;        // Number of SDO transfers (mailbox round trips) issued
+    int64 elapsed_ns;     // Time spent on this slave
+    ecx_contextt context; // ecx_context with the error list below, used by the job's transfers
+    ec_eringt errors;     // SDO aborts and mailbox errors of this job
+    boolean error;        // Set by SOEM when an error is pushed onto errors
+};
 
-// 在全局变量声明区域添加这些变量（在文件开头其他全局变量之后）
-bool delay_test_enabled = false;
-bool delay_test_active = false;
-int delay_test_start_cycle = 5000;  // Start delay test after this many cycles
-int delay_test_duration = 1000;     // Run delay test for this many cycles
-int delay_test_counter = 0;
+// Context the SOEM SDO calls of the current thread use; NULL outside a job (ecx_context)
+static thread_local ecx_contextt *sdo_context = NULL;
 
-// 在其他函数声明之后，添加这些函数声明
-void start_delay_test(int start_after_cycles, int test_duration);
-void* start_server(void* arg);
+// ecx_SDOwrite behind the SdoWriteFunc signature
+int sdo_write_soem(uint16 slave, uint16 index, uint8 subindex, boolean ca, int size,
+                   const void *data, int timeout) {
+    ecx_contextt *context = sdo_context != NULL ? sdo_context : &ecx_context;
+    return ecx_SDOwrite(context, slave, index, subindex, ca, size, (void *)data, timeout);
+}
+
+// ecx_SDOread behind the SdoReadFunc signature
+int sdo_read_soem(uint16 slave, uint16 index, uint8 subindex, boolean ca, int *size,
+                  void *data, int timeout) {
+    ecx_contextt *context = sdo_context != NULL ? sdo_context : &ecx_context;
+    return ecx_SDOread(context, slave, index, subindex, ca, size, data, timeout);
+}
+
+// Append a write of the low `size` bytes of value (little-endian, as the slave expects)
+void sdo_plan_add(SdoPlan *plan, uint16 index, uint8 subindex, uint32 value, int size) {
+    if (plan->count >= SDO_PLAN_MAX_WRITES || size <= 0 || size > SDO_MAX_DATA) {
+        printf("SDO plan: cannot add 0x%4.4x:%02x\n", index, subindex);
+        return;
+    }
+    SdoWrite &w = plan->writes[plan->count++];
+    w.index = index;
+    w.subindex = subindex;
+    w.size = (uint8)size;
+    w.ca = FALSE;
+    w.fallback = 0;
+    for (int k = 0; k < size; k++) {
+        w.data[k] = (uint8)(value >> (8 * k));
+    }
+}
+
+// Append a whole mapping (entry_size 4) or assignment (entry_size 2) object. The CA image is
+// subindex 0 padded to 16 bits followed by the entries; the fallback clears subindex 0, writes the
+// entries one by one and sets subindex 0 to the entry count.
+void sdo_plan_add_object(SdoPlan *plan, uint16 index, const uint32 *entries, int count, int entry_size) {
+    if (count > SDO_MAX_ENTRIES || plan->count + count + 3 > SDO_PLAN_MAX_WRITES) {
+        printf("SDO plan: cannot add object 0x%4.4x\n", index);
+        return;
+    }
+    SdoWrite &w = plan->writes[plan->count++];
+    w.index = index;
+    w.subindex = 0x00;
+    w.ca = TRUE;
+    w.fallback = (uint8)(count + 2);
+    w.data[0] = (uint8)count;
+    w.data[1] = 0;
+    for (int e = 0; e < count; e++) {
+        for (int k = 0; k < entry_size; k++) {
+            w.data[2 + e * entry_size + k] = (uint8)(entries[e] >> (8 * k));
+        }
+    }
+    w.size = (uint8)(2 + count * entry_size);
+
+    sdo_plan_add(plan, index, 0x00, 0, 1);
+    for (int e = 0; e < count; e++) {
+        sdo_plan_add(plan, index, (uint8)(e + 1), entries[e], entry_size);
+    }
+    sdo_plan_add(plan, index, 0x00, (uint32)count, 1);
+}
+
+static_assert(pdo_entry_count(rxpdo_mapping) <= SDO_MAX_ENTRIES, "RXPDO has too many entries");
+static_assert(pdo_entry_count(txpdo_mapping) <= SDO_MAX_ENTRIES, "TXPDO has too many entries");
+
+// The RXPDO/TXPDO mapping used by this program (rxpdo_t / txpdo_t)
+void build_pdo_mapping_plan(SdoPlan *plan) {
+    static const uint32 rxpdo_assign[] = {0x1600};
+    static const uint32 txpdo_assign[] = {0x1A00};
+
+    plan->count = 0;
+    sdo_plan_add_object(plan, 0x1600, rxpdo_mapping, pdo_entry_count(rxpdo_mapping), 4); // RXPDO mapping
+    sdo_plan_add_object(plan, 0x1C12, rxpdo_assign, 1, 2);    // RXPDO assignment -> 0x1600
+    sdo_plan_add_object(plan, 0x1A00, txpdo_mapping, pdo_entry_count(txpdo_mapping), 4); // TXPDO mapping
+    sdo_plan_add_object(plan, 0x1C13, txpdo_assign, 1, 2);    // TXPDO assignment -> 0x1A00
+}
+
+// Print the process image layout, one entry per line:
+// "<rx|tx> <field> 0x<index>:<subindex> <bits> <byte offset>"
+template <size_t N>
+void print_pdo_entries(FILE *out, const char *direction, const uint32 (&mapping)[N], const char *const (&names)[N]) {
+    for (size_t k = 0; k < N; k++) {
+        fprintf(out, "%s %-20s 0x%04x:%02x %2u %2u\n", direction, names[k], (unsigned)(mapping[k] >> 16),
+                (unsigned)((mapping[k] >> 8) & 0xFF), (unsigned)(mapping[k] & 0xFF),
+                (unsigned)pdo_entry_offset(mapping, k));
+    }
+}
+
+void print_pdo_layout(FILE *out) {
+    print_pdo_entries(out, "rx", rxpdo_mapping, rxpdo_names);
+    print_pdo_entries(out, "tx", txpdo_mapping, txpdo_names);
+}
+
+bool pdo_mapping_unchanged(SdoJob *job);
+
+// Issue the next transfer of a plan to one slave, starting at write *next, and move *next past it.
+// CA writes are skipped while *complete_access is false; one that succeeds also skips its
+// fallback, one the slave rejects clears *complete_access so the fallback runs instead. Returns
+// false when the plan is done (no transfer issued), otherwise the working counter in *wkc and
+// whether it was a CA write in *ca.
+static bool sdo_plan_step(const SdoPlan *plan, SdoWriteFunc write, uint16 slave, int *next,
+                          bool *complete_access, int *wkc, bool *ca) {
+    int k = *next;
+    while (k < plan->count && plan->writes[k].ca && !*complete_access) {
+        k++; // Not supported: use the per-subindex writes that follow
+    }
+    if (k >= plan->count) {
+        *next = k;
+        return false;
+    }
+    const SdoWrite &w = plan->writes[k];
+    *wkc = write(slave, w.index, w.subindex, w.ca, w.size, w.data, EC_TIMEOUTSAFE);
+    *ca = w.ca;
+    *next = k + 1;
+    if (w.ca) {
+        if (*wkc > 0) {
+            *next += w.fallback; // Whole object written, skip its fallback
+        } else {
+            *complete_access = false; // Rejected: per-subindex writes from now on
+        }
+    }
+    return true;
+}
+
+// Apply a job's plan to its slave, in order, unless a readback shows it already holds the mapping
+void sdo_job_run(SdoJob *job) {
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    job->result = 0;
+    job->failed = 0;
+    job->transfers = 0;
+    job->errors.head = 0;
+    job->errors.tail = 0;
+    job->error = FALSE;
+    job->context = ecx_context;
+    job->context.elist = &job->errors;
+    job->context.ecaterror = &job->error;
+    sdo_context = &job->context;
+    job->unchanged = job->verify && !job->complete_access && pdo_mapping_unchanged(job);
+    int next = 0, wkc_write;
+    bool ca;
+    while (!job->unchanged &&
+           sdo_plan_step(job->plan, job->write, job->slave, &next, &job->complete_access, &wkc_write, &ca)) {
+        job->transfers++;
+        if (wkc_write > 0) {
+            job->result += wkc_write;
+        } else if (!ca) {
+            job->failed++; // A rejected CA write is not a failure, its fallback follows
+        }
+    }
+    sdo_context = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    job->elapsed_ns = timespec_diff_ns(&t_start, &t_end);
+}
+
+// PDO mapping plan of erob_test, also written by the recovery of a power-cycled slave
+SdoPlan g_pdo_plan;
+
+/*
+ * One transfer of the PDO mapping for a slave that ecatcheck reconfigures. Returns false once the
+ * mapping is written. Runs in the ecatcheck thread, with ecx_context like the other recovery steps.
+ */
+bool pdo_mapping_step(uint16 slave, int *next, bool *complete_access) {
+    int wkc_write;
+    bool ca;
+    if (!sdo_plan_step(&g_pdo_plan, sdo_write_soem, slave, next, complete_access, &wkc_write, &ca)) {
+        return false;
+    }
+    if (wkc_write <= 0 && !ca) {
+        printf("WARNING: Slave %d rejected a PDO mapping write during recovery\n", slave);
+    }
+    return true;
+}
+
+void *sdo_job_thread(void *ptr) {
+    sdo_job_run((SdoJob *)ptr);
+    return NULL;
+}
+
+// Run all jobs, one thread per slave when parallel is set (jobs whose thread cannot be created run
+// inline), then print the SOEM errors each job collected. Returns the total number of failed writes.
+int sdo_config_run(SdoJob *jobs, int count, bool parallel) {
+    static pthread_t workers[EC_MAXSLAVE];
+    static bool started[EC_MAXSLAVE];
+    int failed = 0;
+
+    for (int k = 0; k < count; k++) {
+        started[k] = parallel && k < EC_MAXSLAVE &&
+                     pthread_create(&workers[k], NULL, sdo_job_thread, &jobs[k]) == 0;
+        if (!started[k]) {
+            sdo_job_run(&jobs[k]);
+        }
+    }
+    for (int k = 0; k < count; k++) {
+        if (started[k]) {
+            pthread_join(workers[k], NULL);
+        }
+        failed += jobs[k].failed;
+        while (ecx_iserror(&jobs[k].context)) {
+            printf("Slave %d SDO error: %s", jobs[k].slave, ecx_elist2string(&jobs[k].context));
+        }
+    }
+    return failed;
+}
+
+//##################################################################################################
+// PDO mapping readback.
+// A slave that already holds the mapping (a restart without a power cycle) does not need it written
+// again. With Complete Access the whole plan is four transfers, fewer than any readback, so those
+// slaves are always written. Without CA the plan costs sub 0, every entry and sub 0 again per
+// object; the readback reads sub 0 and the entries once and stops at the first difference, so it
+// saves the clearing and the final sub 0 writes when nothing changed and costs little when
+// something did. A drive remapped by another tool reads back differently even when the remapped
+// entries have the same size. axes_init() still checks the mapped image after ec_config_map(); on a
+// mismatch erob_test writes the mapping again.
+
+// Entries of an object written whole by the plan, as 32-bit values. Returns the entry count.
+static int sdo_object_entries(const SdoWrite &w, uint32 *entries) {
+    int entry_size = w.data[0] > 0 ? (w.size - 2) / w.data[0] : 4;
+    for (int e = 0; e < w.data[0]; e++) {
+        entries[e] = 0;
+        for (int b = 0; b < entry_size; b++) {
+            entries[e] |= (uint32)w.data[2 + e * entry_size + b] << (8 * b);
+        }
+    }
+    return w.data[0];
+}
+
+// Read the plan's mapping and assignment objects back per subindex. Returns true if the slave
+// holds every one of them as the plan would write it, so the plan can be skipped.
+bool pdo_mapping_unchanged(SdoJob *job) {
+    for (int k = 0; k < job->plan->count; k++) {
+        const SdoWrite &w = job->plan->writes[k];
+        if (!w.ca) {
+            continue;
+        }
+        uint32 expected[SDO_MAX_ENTRIES];
+        int count = sdo_object_entries(w, expected);
+        int entry_size = count > 0 ? (w.size - 2) / count : 4;
+        uint8 n = 0;
+        int size = sizeof(n);
+        job->transfers++;
+        if (job->read(job->slave, w.index, 0x00, FALSE, &size, &n, EC_TIMEOUTSAFE) <= 0 || n != count) {
+            return false;
+        }
+        for (int e = 0; e < count; e++) {
+            uint32 entry = 0;
+            size = entry_size;
+            job->transfers++;
+            if (job->read(job->slave, w.index, (uint8)(e + 1), FALSE, &size, &entry, EC_TIMEOUTSAFE) <= 0 ||
+                entry != expected[e]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
 
 //##################################################################################################
 // Function: Set the CPU affinity for a thread
@@ -178,12 +3240,309 @@ void set_thread_affinity(pthread_t thread, int cpu_core) {
 }
 
 //##################################################################################################
-// Function prototype for the EtherCAT test function
+// CPU topology planner.
+// Wake-up jitter of ecatthread is lowest when it has a core to itself: no other thread of this
+// process, no housekeeping work of the kernel (isolcpus=, nohz_full=, rcu_nocbs=) and the NIC
+// interrupt on the same core, so the frame that wakes the thread is received where it runs.
+// topology_plan() resolves the "auto" CPUs of the configuration:
+//     ecatthread        highest isolated CPU, else the highest online CPU
+//     main/check/log    the housekeeping CPUs (online, not isolated, not the ecatthread CPU)
+// and reports every choice that conflicts with the kernel's isolation settings. With irq_steer
+// topology_steer_nic() also moves the NIC's IRQs and RPS/XPS queues to the ecatthread CPU.
+
+struct CpuTopology {
+    cpu_set_t online;
+    cpu_set_t isolated;           // isolcpus= (/sys/devices/system/cpu/isolated)
+    cpu_set_t nohz_full;          // nohz_full= (/sys/devices/system/cpu/nohz_full)
+    cpu_set_t housekeeping;       // CPUs of the non real-time threads
+};
+
+CpuTopology g_topology;
+
+// Parse a kernel CPU list ("0-3,6,8-9"). Returns false if the file cannot be read.
+static bool read_cpu_list(const char *path, cpu_set_t *set) {
+    CPU_ZERO(set);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char text[256];
+    bool ok = fgets(text, sizeof(text), file) != NULL;
+    fclose(file);
+    if (!ok) {
+        return true; // Empty list
+    }
+    for (char *token = strtok(text, ",\n"); token != NULL; token = strtok(NULL, ",\n")) {
+        int first, last;
+        int fields = sscanf(token, "%d-%d", &first, &last);
+        if (fields < 1) {
+            continue;
+        }
+        if (fields == 1) {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+    }
+    return true;
+}
+
+static void print_cpu_set(const char *label, const cpu_set_t *set) {
+    printf("%-14s", label);
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set)) {
+            printf(" %d", cpu);
+            count++;
+        }
+    }
+    printf(count == 0 ? " -\n" : "\n");
+}
+
+void topology_read(CpuTopology *topology) {
+    if (!read_cpu_list("/sys/devices/system/cpu/online", &topology->online) ||
+        CPU_COUNT(&topology->online) == 0) {
+        sched_getaffinity(0, sizeof(topology->online), &topology->online);
+    }
+    read_cpu_list("/sys/devices/system/cpu/isolated", &topology->isolated);
+    read_cpu_list("/sys/devices/system/cpu/nohz_full", &topology->nohz_full);
+    CPU_AND(&topology->isolated, &topology->isolated, &topology->online);
+    CPU_AND(&topology->nohz_full, &topology->nohz_full, &topology->online);
+}
+
+// CPUs the interrupts of `ifname` may run on; false if none were found
+static bool nic_irq_cpus(const char *ifname, cpu_set_t *cpus);
+
+/*
+ * Fill in the CPU_AUTO entries of config and g_topology.housekeeping. Prints the plan and every
+ * conflict with the isolation settings; returns the number of conflicts (the plan is usable
+ * either way, the conflicts only cost jitter).
+ */
+int topology_plan(RuntimeConfig *config, CpuTopology *topology) {
+    int conflicts = 0;
+    int online = CPU_COUNT(&topology->online);
+
+    if (config->cpu_ecat == CPU_AUTO) {
+        const cpu_set_t *candidates = CPU_COUNT(&topology->isolated) > 0 ? &topology->isolated
+                                                                           : &topology->online;
+        for (int cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--) {
+            if (CPU_ISSET(cpu, candidates)) {
+                config->cpu_ecat = cpu;
+                break;
+            }
+        }
+    }
+
+    // Housekeeping: online and not isolated, without the ecatthread CPU if anything is left
+    CPU_ZERO(&topology->housekeeping);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &topology->online) && !CPU_ISSET(cpu, &topology->isolated) &&
+            cpu != config->cpu_ecat) {
+            CPU_SET(cpu, &topology->housekeeping);
+        }
+    }
+    if (CPU_COUNT(&topology->housekeeping) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &topology->online) && (cpu != config->cpu_ecat || online == 1)) {
+                CPU_SET(cpu, &topology->housekeeping);
+            }
+        }
+    }
+
+    printf("CPU topology:\n");
+    print_cpu_set("  online", &topology->online);
+    print_cpu_set("  isolated", &topology->isolated);
+    print_cpu_set("  nohz_full", &topology->nohz_full);
+    print_cpu_set("  housekeeping", &topology->housekeeping);
+    printf("%-14s %d\n", "  ecatthread", config->cpu_ecat);
+
+    if (config->cpu_ecat >= 0) {
+        int rt = config->cpu_ecat;
+        if (online == 1) {
+            printf("  conflict: only one CPU online, ecatthread shares it with everything else\n");
+            conflicts++;
+        }
+        if (CPU_COUNT(&topology->isolated) == 0) {
+            printf("  conflict: no isolated CPUs; boot with isolcpus=%d nohz_full=%d rcu_nocbs=%d\n",
+                   rt, rt, rt);
+            conflicts++;
+        } else if (!CPU_ISSET(rt, &topology->isolated)) {
+            printf("  conflict: ecatthread CPU %d is not in isolcpus\n", rt);
+            conflicts++;
+        }
+        if (CPU_COUNT(&topology->isolated) > 0 && !CPU_ISSET(rt, &topology->nohz_full)) {
+            printf("  conflict: ecatthread CPU %d is not in nohz_full, the scheduler tick keeps running\n", rt);
+            conflicts++;
+        }
+        const struct { const char *name; int cpu; } others[] = {
+            {"main", config->cpu_main}, {"ecatcheck", config->cpu_check}, {"logthread", config->cpu_log}
+        };
+        for (const auto &other : others) {
+            if (other.cpu == rt && online > 1) {
+                printf("  conflict: %s is pinned to the ecatthread CPU %d\n", other.name, rt);
+                conflicts++;
+            } else if (other.cpu >= 0 && CPU_ISSET(other.cpu, &topology->isolated)) {
+                printf("  conflict: %s is pinned to isolated CPU %d\n", other.name, other.cpu);
+                conflicts++;
+            }
+        }
+        if (config->wait_strategy == WAIT_SPIN && !CPU_ISSET(rt, &topology->isolated)) {
+            printf("  conflict: wait = spin on CPU %d, which is not isolated; it takes the whole CPU\n", rt);
+            conflicts++;
+        }
+        cpu_set_t irq_cpus;
+        if (!config->irq_steer && nic_irq_cpus(config->ifname, &irq_cpus) && !CPU_ISSET(rt, &irq_cpus)) {
+            printf("  conflict: %s interrupts are not on CPU %d (set irq_steer = 1)\n", config->ifname, rt);
+            conflicts++;
+        }
+    }
+    return conflicts;
+}
+
+// Pin a thread to `cpu`, the housekeeping CPUs (CPU_AUTO) or nowhere (CPU_NONE)
+void pin_thread(pthread_t thread, int cpu) {
+    if (cpu >= 0) {
+        set_thread_affinity(thread, cpu);
+    } else if (cpu == CPU_AUTO && pthread_setaffinity_np(thread, sizeof(cpu_set_t),
+                                                         &g_topology.housekeeping) != 0) {
+        printf("Unable to bind thread to the housekeeping CPUs\n");
+    }
+}
+
+// IRQ numbers of the NIC: its MSI vectors, else the /proc/interrupts lines that name it
+static int nic_irqs(const char *ifname, int *irqs, int max) {
+    int count = 0;
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", ifname);
+    DIR *dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL && count < max) {
+            if (entry->d_name[0] >= '0' && entry->d_name[0] <= '9') {
+                irqs[count++] = atoi(entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    if (count > 0) {
+        return count;
+    }
+    FILE *file = fopen("/proc/interrupts", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL && count < max) {
+        int irq;
+        if (strstr(line, ifname) != NULL && sscanf(line, " %d:", &irq) == 1) {
+            irqs[count++] = irq;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static bool nic_irq_cpus(const char *ifname, cpu_set_t *cpus) {
+    int irqs[64];
+    int count = nic_irqs(ifname, irqs, 64);
+    CPU_ZERO(cpus);
+    for (int k = 0; k < count; k++) {
+        char path[64];
+        cpu_set_t irq_cpus;
+        snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irqs[k]);
+        if (read_cpu_list(path, &irq_cpus)) {
+            CPU_OR(cpus, cpus, &irq_cpus);
+        }
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+static bool write_text(const char *path, const char *text) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = fputs(text, file) >= 0;
+    return fclose(file) == 0 && ok;
+}
+
+/*
+ * Move the interrupts of `ifname` to `cpu` and point its receive (RPS) and transmit (XPS) queue
+ * steering at the same CPU. Needs root; returns the number of settings that could not be written.
+ */
+int topology_steer_nic(const char *ifname, int cpu) {
+    int failed = 0;
+    char path[256];
+    char value[32];
+    int irqs[64];
+    int count = nic_irqs(ifname, irqs, 64);
+    if (count == 0) {
+        printf("No interrupts found for %s\n", ifname);
+    }
+    snprintf(value, sizeof(value), "%d", cpu);
+    for (int k = 0; k < count; k++) {
+        snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irqs[k]);
+        if (!write_text(path, value)) {
+            printf("Unable to move IRQ %d to CPU %d\n", irqs[k], cpu);
+            failed++;
+        }
+    }
+
+    // rps_cpus/xps_cpus take a hex mask in comma separated 32-bit groups
+    char mask[CPU_SETSIZE / 4 + CPU_SETSIZE / 32 + 1];
+    int groups = cpu / 32 + 1;
+    int length = 0;
+    for (int g = groups - 1; g >= 0; g--) {
+        length += snprintf(mask + length, sizeof(mask) - length, g == groups - 1 ? "%x" : ",%08x",
+                           g == cpu / 32 ? 1u << (cpu % 32) : 0u);
+    }
+    snprintf(path, sizeof(path), "/sys/class/net/%s/queues", ifname);
+    DIR *dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            const char *file = strncmp(entry->d_name, "rx-", 3) == 0 ? "rps_cpus"
+                             : strncmp(entry->d_name, "tx-", 3) == 0 ? "xps_cpus" : NULL;
+            if (file == NULL) {
+                continue;
+            }
+            char queue[sizeof(path) + 300];
+            snprintf(queue, sizeof(queue), "%s/%s/%s", path, entry->d_name, file);
+            if (!write_text(queue, mask)) {
+                printf("Unable to write %s\n", queue);
+                failed++;
+            }
+        }
+        closedir(dir);
+    }
+    printf("%s: %d IRQs and the RPS/XPS queues steered to CPU %d, %d failed\n", ifname, count, cpu,
+           failed);
+    return failed;
+}
+
+//##################################################################################################
+// Function prototypes for the EtherCAT bring-up and shutdown
+int erob_start(const char *ifname);
+void erob_stop();
 int erob_test();
 
+// OSAL_THREAD_HANDLE is a pthread_t *, but osal_thread_create stores the pthread_t in the handle itself
+static pthread_t osal_pthread(OSAL_THREAD_HANDLE *handle) {
+    pthread_t thread;
+    memcpy(&thread, handle, sizeof(thread));
+    return thread;
+}
+
 uint16_t data_R;
 
-int erob_test() {
+/*
+ * Bring the network on `ifname` up to OP and start the EtherCAT threads (STEP 1-9).
+ * Cycle, SYNC0, priority and CPUs come from g_config (config_apply and topology_plan must have
+ * been called). Returns 0 once all slaves are in OP, 1 if the threads run but OP was not reached, -1 if the bring-up failed before the threads were started.
+ * Used by erob_test and by the Python extension (erob_rt_module.cpp).
+ */
+int erob_start(const char *ifname) {
     int rdl; // Variable to hold read data length
     SLAVE_ID = 1; // Set the slave ID to 1
     int i, j, oloop, iloop, chk; // Loop control variables
@@ -191,7 +3550,7 @@ int erob_test() {
     // 1. Call ec_config_init() to move from INIT to PRE-OP state.
     printf("__________STEP 1___________________\n");
     // Initialize EtherCAT master on the specified network interface
-    if (ec_init("enp58s0") <= 0) {
+    if (ec_init(ifname) <= 0) {
         printf("Error: Could not initialize EtherCAT master!\n");
         printf("No socket connection on Ethernet port. Execute as root.\n");
         printf("___________________________________________\n");
@@ -233,119 +3592,64 @@ int erob_test() {
                 printf("State changed to EC_STATE_PRE_OP: %d \n", EC_STATE_PRE_OP);
                 printf("___________________________________________\n");
             } else {
-                printf("State EC_STATE_PRE_OP cannot be changed in step 2\n");
-                return -1; // Return error if state change fails
-            }
-        }
-    }
-
-//##################################################################################################
-    //3.- Map RXPOD
-    printf("__________STEP 3___________________\n");
-
-    // Clear RXPDO mapping
-    int retval = 0; // Variable to hold the return value of SDO write operations
-    uint16 map_1c12; // Variable to hold the mapping for PDO
-    uint8 zero_map = 0; // Variable to clear the PDO mapping
-    uint32 map_object; // Variable to hold the mapping object
-    uint16 clear_val = 0x0000; // Value to clear the mapping
-
-    for(int i = 1; i <= ec_slavecount; i++) { // Loop through each slave
-        // 1. First, disable PDO
-        retval += ec_SDOwrite(i, 0x1600, 0x00, FALSE, sizeof(zero_map), &zero_map, EC_TIMEOUTSAFE);
-        
-        // 2. Configure new PDO mapping
-        // Control Word
-        map_object = 0x60400010;  // 0x6040:0 Control Word, 16 bits
-        retval += ec_SDOwrite(i, 0x1600, 0x01, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-        
-        // Target Position
-        map_object = 0x607A0020;  // 0x607A:0 Target Position, 32 bits
-        retval += ec_SDOwrite(i, 0x1600, 0x02, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-        
-        // Mode of Operation
-        map_object = 0x60600008;  // 0x6060:0 Mode of Operation, 8 bits
-        retval += ec_SDOwrite(i, 0x1600, 0x03, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-        
-        // Padding (8 bits)
-        map_object = 0x00000008;  // 8 bits padding
-        retval += ec_SDOwrite(i, 0x1600, 0x04, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-        
-        // Set number of mapped objects
-        uint8 map_count = 4;
-        retval += ec_SDOwrite(i, 0x1600, 0x00, FALSE, sizeof(map_count), &map_count, EC_TIMEOUTSAFE);
-        
-        // 4. Configure RXPDO allocation
-        clear_val = 0x0000; // Clear the mapping
-        retval += ec_SDOwrite(i, 0x1c12, 0x00, FALSE, sizeof(clear_val), &clear_val, EC_TIMEOUTSAFE);
-        map_1c12 = 0x1600; // Set the mapping to the new PDO
-        retval += ec_SDOwrite(i, 0x1c12, 0x01, FALSE, sizeof(map_1c12), &map_1c12, EC_TIMEOUTSAFE);
-        map_1c12 = 0x0001; // Set the mapping index
-        retval += ec_SDOwrite(i, 0x1c12, 0x00, FALSE, sizeof(map_1c12), &map_1c12, EC_TIMEOUTSAFE);
-    }
-
-    printf("PDO mapping configuration result: %d\n", retval);
-    if (retval < 0) {
-        printf("PDO mapping failed\n");
-        return -1;
+                printf("State EC_STATE_PRE_OP cannot be changed in step 2\n");
+                return -1; // Return error if state change fails
+            }
+        }
     }
 
-    printf("RXPOD Mapping set correctly.\n");
-    printf("___________________________________________\n");
-
-    //........................................................................................
-    // Map TXPOD
-    retval = 0;
-    uint16 map_1c13;
-    for(int i = 1; i <= ec_slavecount; i++) {
-        // First, clear the TXPDO mapping
-        clear_val = 0x0000;
-        retval += ec_SDOwrite(i, 0x1A00, 0x00, FALSE, sizeof(clear_val), &clear_val, EC_TIMEOUTSAFE);
-
-        // Configure TXPDO mapping entries
-        // Status Word (0x6041:0, 16 bits)
-        map_object = 0x60410010;
-        retval += ec_SDOwrite(i, 0x1A00, 0x01, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-
-        // Actual Position (0x6064:0, 32 bits)
-        map_object = 0x60640020;
-        retval += ec_SDOwrite(i, 0x1A00, 0x02, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-
-        // Actual Velocity (0x606C:0, 32 bits)
-        map_object = 0x606C0020;
-        retval += ec_SDOwrite(i, 0x1A00, 0x03, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
-
-        // Actual Torque (0x6077:0, 16 bits)
-        map_object = 0x60770010;
-        retval += ec_SDOwrite(i, 0x1A00, 0x04, FALSE, sizeof(map_object), &map_object, EC_TIMEOUTSAFE);
+//##################################################################################################
+    //3.- Map RXPOD and TXPOD
+    printf("__________STEP 3___________________\n");
 
-        // Set the number of mapped objects (4 objects)
-        uint8 map_count = 4;
-        retval += ec_SDOwrite(i, 0x1A00, 0x00, FALSE, sizeof(map_count), &map_count, EC_TIMEOUTSAFE);
+    // Every slave gets the same mapping. The SDO writes of different slaves run in parallel,
+    // one mailbox worker per slave. Slaves without CA that still hold the mapping are skipped.
+    static SdoJob sdo_jobs[EC_MAXSLAVE];
+    build_pdo_mapping_plan(&g_pdo_plan);
 
-        // Configure TXPDO assignment
-        // First, clear the assignment
-        clear_val = 0x0000;
-        retval += ec_SDOwrite(i, 0x1C13, 0x00, FALSE, sizeof(clear_val), &clear_val, EC_TIMEOUTSAFE);
+    int job_count = 0;
+    for(int i = 1; i <= ec_slavecount && job_count < EC_MAXSLAVE; i++) { // One job per slave
+        sdo_jobs[job_count].slave = i;
+        sdo_jobs[job_count].plan = &g_pdo_plan;
+        sdo_jobs[job_count].write = sdo_write_soem;
+        sdo_jobs[job_count].read = sdo_read_soem;
+        sdo_jobs[job_count].verify = true;
+        sdo_jobs[job_count].complete_access = (ec_slave[i].CoEdetails & ECT_COEDET_SDOCA) != 0;
+        job_count++;
+    }
 
-        // Assign TXPDO to 0x1A00
-        map_1c13 = 0x1A00;
-        retval += ec_SDOwrite(i, 0x1C13, 0x01, FALSE, sizeof(map_1c13), &map_1c13, EC_TIMEOUTSAFE);
+    struct timespec t_map_start, t_map_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_map_start);
+    int failed_writes = sdo_config_run(sdo_jobs, job_count, true);
+    int total_transfers = 0;
+    int unchanged_slaves = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t_map_end);
 
-        // Set the number of assigned PDOs (1 PDO)
-        map_1c13 = 0x0001;
-        retval += ec_SDOwrite(i, 0x1C13, 0x00, FALSE, sizeof(map_1c13), &map_1c13, EC_TIMEOUTSAFE);
+    int retval = 0; // Sum of the SDO write results
+    for(int k = 0; k < job_count; k++) {
+        retval += sdo_jobs[k].result;
+        total_transfers += sdo_jobs[k].transfers;
+        if (sdo_jobs[k].unchanged) {
+            unchanged_slaves++;
+            printf("Slave %d PDO mapping unchanged (read back), %d SDO transfers, %.1f ms\n",
+                   sdo_jobs[k].slave, sdo_jobs[k].transfers, sdo_jobs[k].elapsed_ns / 1e6);
+            continue;
+        }
+        printf("Slave %d PDO mapping: %d SDO transfers (%s), %d failed, %.1f ms\n", sdo_jobs[k].slave,
+               sdo_jobs[k].transfers, sdo_jobs[k].complete_access ? "complete access" : "per subindex",
+               sdo_jobs[k].failed, sdo_jobs[k].elapsed_ns / 1e6);
     }
 
-    printf("Slave %d TXPDO mapping configuration result: %d\n", SLAVE_ID, retval);
-
+    printf("PDO mapping configuration result: %d (%d transfers, %d failed, %d unchanged, %.1f ms total)\n",
+           retval, total_transfers, failed_writes, unchanged_slaves,
+           timespec_diff_ns(&t_map_start, &t_map_end) / 1e6);
     if (retval < 0) {
-        printf("TXPDO Mapping failed\n");
+        printf("PDO mapping failed\n");
         printf("___________________________________________\n");
         return -1;
     }
 
-    printf("TXPDO Mapping set successfully\n");
+    printf("RXPOD and TXPDO Mapping set successfully\n");
     printf("___________________________________________\n");
 
    //##################################################################################################
@@ -367,12 +3671,31 @@ int erob_test() {
         printf("Slave %d: Type %d, Address 0x%02x, State Machine actual %d, required %d\n", 
                i, ec_slave[i].eep_id, ec_slave[i].configadr, ec_slave[i].state, EC_STATE_INIT);
         printf("___________________________________________\n");
-        ecx_dcsync0(&ecx_context, i, TRUE, 500000, 0);  //Synchronize the distributed clock for the slave
+        ecx_dcsync0(&ecx_context, i, TRUE, (uint32)g_config.sync0_us * 1000,
+                    g_config.sync0_shift_us * 1000);  //Synchronize the distributed clock for the slave
     }
 
     // Map the configured PDOs to the IOmap
     ec_config_map(&IOmap);
 
+    // Resolve the per-axis PDO views into IOmap and check the mapped sizes
+    bool image_ok = axes_init(&g_axes, ec_slavecount);
+    if (!image_ok && unchanged_slaves > 0) {
+        // A slave skipped after the readback did not give the expected image: write it and map again
+        printf("PDO image does not match the mapping read back, rewriting the mapping\n");
+        for(int k = 0; k < job_count; k++) {
+            sdo_jobs[k].verify = false;
+        }
+        sdo_config_run(sdo_jobs, job_count, true);
+        ec_config_map(&IOmap);
+        unchanged_slaves = 0;
+        image_ok = axes_init(&g_axes, ec_slavecount);
+    }
+    if (!image_ok) {
+        printf("PDO image does not match rxpdo_t/txpdo_t\n");
+        return -1;
+    }
+
     printf("__________STEP 5___________________\n");
 
     // Ensure all slaves are in PRE-OP state
@@ -440,10 +3763,31 @@ int erob_test() {
     // Start the EtherCAT thread for real-time processing
     printf("Setting start_ecatthread_thread to TRUE\n");
     start_ecatthread_thread = TRUE;
+    ecat_stop.store(false);
+    check_events_open();
+    recovery_reset();
     osal_thread_create_rt(&thread1, stack64k * 2, (void *)&ecatthread, (void *)&ctime_thread); // Create the real-time EtherCAT thread
-    // set_thread_affinity(*thread1, 4); // Optional: Set CPU affinity for the thread
     osal_thread_create(&thread2, stack64k * 2, (void *)&ecatcheck, NULL); // Create the EtherCAT check thread
-    // set_thread_affinity(*thread2, 5); // Optional: Set CPU affinity for the thread
+    osal_thread_create(&thread3, stack64k, (void *)&logthread, NULL); // Create the log drain thread
+
+    // osal_thread_create_rt uses a fixed priority; give ecatthread the configured one
+    struct sched_param rt_param;
+    rt_param.sched_priority = g_config.rt_priority;
+    if (pthread_setschedparam(osal_pthread(&thread1), SCHED_FIFO, &rt_param) != 0) {
+        printf("Unable to set priority %d for the EtherCAT thread\n", g_config.rt_priority);
+    }
+    pin_thread(osal_pthread(&thread1), g_config.cpu_ecat);
+    pin_thread(osal_pthread(&thread2), g_config.cpu_check);
+    pin_thread(osal_pthread(&thread3), g_config.cpu_log);
+    if (g_config.server_port != 0) {
+        // Non-RT like logthread, so it shares its CPU
+        server_started = pthread_create(&server_thread, NULL, start_server, &g_config.server_port) == 0;
+        if (server_started) {
+            pin_thread(server_thread, g_config.cpu_log);
+        } else {
+            printf("Unable to start the setpoint server\n");
+        }
+    }
     printf("___________________________________________\n");
 
     my_RA = 0; // Reset read access variable
@@ -463,6 +3807,10 @@ int erob_test() {
     // Wait for the state transition to complete
     if ((ec_statecheck(0, EC_STATE_OPERATIONAL, 5 * EC_TIMEOUTSTATE)) == EC_STATE_OPERATIONAL) {
         printf("State changed to EC_STATE_OPERATIONAL: %d\n", EC_STATE_OPERATIONAL); // Confirm successful state change
+        ec_readstate();
+        slave_states_publish();
+        inOP = TRUE; // From here on ecatcheck supervises the slaves
+        check_event_post(CHECK_EVENT_STATE);
         printf("___________________________________________\n");
     } else {
         printf("State could not be changed to EC_STATE_OPERATIONAL\n"); // Error message if state change fails
@@ -485,55 +3833,74 @@ int erob_test() {
 
     if (ec_slave[0].state == EC_STATE_OPERATIONAL) {
         printf("Operational state reached for all slaves.\n");
-        
-
-        uint8 operation_mode = 8;
-        uint16_t Control_Word = 128;
+        return 0;
+    }
 
-        for (int i = 1; i <= ec_slavecount; i++) {
-            ec_SDOwrite(i, 0x6040, 0x00, FALSE, sizeof(Control_Word), &Control_Word, EC_TIMEOUTSAFE);
-            ec_SDOwrite(i, 0x6060, 0x00, FALSE, sizeof(operation_mode), &operation_mode, EC_TIMEOUTSAFE);
+    return 1;
+}
 
-        }
-  // The main loop only needs to keep the program running
-        while(1) {
-            osal_usleep(100000); // Sleep for 100ms to reduce CPU usage
-        }
+/*
+ * Stop the threads started by erob_start, request INIT for all slaves and close the socket.
+ */
+void erob_stop() {
+    ecat_stop.store(true);
+    check_event_post(CHECK_EVENT_STOP);
+    pthread_join(osal_pthread(&thread1), NULL);
+    pthread_join(osal_pthread(&thread2), NULL);
+    pthread_join(osal_pthread(&thread3), NULL);
+    if (server_started) {
+        pthread_join(server_thread, NULL);
+        server_started = false;
     }
+    check_events_close();
+    inOP = FALSE;
+    start_ecatthread_thread = FALSE;
 
-    osal_usleep(1e6);
+    printf("\nRequest init state for all slaves\n");
+    ec_slave[0].state = EC_STATE_INIT;
+    /* request INIT state for all slaves */
+    ec_writestate(0);
 
     ec_close();
+    printf("EtherCAT master closed.\n");
+}
 
-     printf("\nRequest init state for all slaves\n");
-     ec_slave[0].state = EC_STATE_INIT;
-     /* request INIT state for all slaves */
-     ec_writestate(0);
+int erob_test() {
+    int result = erob_start(g_config.ifname);
+    if (result < 0) {
+        return -1;
+    }
 
-    printf("EtherCAT master closed.\n");
+    if (result == 0) {
+        // The main loop only needs to keep the program running
+        while (!ecat_stop.load()) {
+            osal_usleep(100000); // Sleep for 100ms to reduce CPU usage
+        }
+    }
+
+    osal_usleep(1e6);
+    erob_stop();
 
     return 0;
 }
 
 /* 
- * PI calculation to synchronize Linux time with the Distributed Clock (DC) time.
- * This function calculates the offset time needed to align the Linux time with the DC time.
+ * Synchronize Linux time with the Distributed Clock (DC) time.
+ * Runs the DC controller (g_dc_sync) for the frame's reference time and returns the offset to add
+ * to the next wake-up; lock changes are reported through the RT log.
  */
 void ec_sync(int64 reftime, int64 cycletime, int64 *offsettime) {
-    static int64 integral = 0; // Integral term for PI controller
-    int64 delta; // Variable to hold the difference between reference time and cycle time
-    delta = (reftime) % cycletime; // Calculate the delta time
-    if (delta > (cycletime / 2)) {
-        delta = delta - cycletime; // Adjust delta if it's greater than half the cycle time
-    }
-    if (delta > 0) {
-        integral++; // Increment integral if delta is positive
-    }
-    if (delta < 0) {
-        integral--; // Decrement integral if delta is negative
+    uint8_t state = g_dc_sync.status.state;
+    *offsettime = dc_sync_update(&g_dc_sync, reftime, cycletime);
+    gl_delta = g_dc_sync.status.delta_ns; // Update global delta variable
+    if (g_dc_sync.status.state != state && state != DC_UNSYNCED) {
+        if (g_dc_sync.status.state == DC_LOCKED) {
+            rt_log(RTLOG_DC_LOCK, dorun, wkc, NULL, (int32_t)g_dc_sync.status.time_to_lock,
+                   g_dc_sync.status.offset_ns, 0);
+        } else {
+            rt_log(RTLOG_DC_UNLOCK, dorun, wkc, NULL, g_dc_sync.status.delta_ns, 0, 0);
+        }
     }
-    *offsettime = -(delta / 100) - (integral / 20); // Calculate the offset time
-    gl_delta = delta; // Update global delta variable
 }
 
 /* 
@@ -554,101 +3921,197 @@ void add_timespec(struct timespec *ts, int64 addtime) {
     }
 }
 
+/* 
+ * Compute the difference between two timespec structures in nanoseconds.
+ */
+int64 timespec_diff_ns(const struct timespec *start, const struct timespec *end) {
+    return (int64)(end->tv_sec - start->tv_sec) * NSEC_PER_SEC + (end->tv_nsec - start->tv_nsec);
+}
+
 /* 
  * EtherCAT check thread function
  * This function monitors the state of the EtherCAT slaves and attempts to recover 
- * any slaves that are not in the operational state.
+ * any slaves that are not in the operational state. It sleeps until ecatthread or
+ * erob_start/erob_stop post a supervision event. Slaves found outside OP are recovered one
+ * step per pass by their own state machine (recovery_step); while any is in recovery or the
+ * working counter stays low, a pass runs every CHECK_RETRY_MS.
  */
 OSAL_THREAD_FUNC ecatcheck(void *ptr) {
     int slave; // Variable to hold the current slave index
     (void)ptr; // Not used
-    int consecutive_errors = 0;
-    const int MAX_CONSECUTIVE_ERRORS = 5;
+    const uint32_t MAX_CONSECUTIVE_ERRORS = 5;
+    int recovering = 0; // Slaves in recovery after the last pass
 
-    while (1) {
-        if (inOP && ((wkc < expectedWKC) || ec_group[currentgroup].docheckstate)) {
-            if (needlf) {
-                needlf = FALSE;
-                printf("\n");
-            }
-            
-            // Increase the consecutive error count
-            if (wkc < expectedWKC) {
-                consecutive_errors++;
-                printf("WARNING: Working counter error (%d/%d), consecutive errors: %d\n", 
-                       wkc, expectedWKC, consecutive_errors);
-            } else {
-                consecutive_errors = 0;
+    while (!ecat_stop.load(std::memory_order_relaxed)) {
+        uint32_t bad_cycles = g_check_bad_cycles.load(std::memory_order_relaxed);
+        bool retry = recovering > 0 || bad_cycles > 0;
+        uint32_t events = check_event_wait(retry ? CHECK_RETRY_MS : -1);
+        if (events & CHECK_EVENT_STOP) {
+            break;
+        }
+        if (!inOP) {
+            continue;
+        }
+        if (events & CHECK_EVENT_FORCE_INIT) {
+            for (slave = 1; slave <= ec_slavecount; slave++) {
+                if (g_check_force_init[slave].exchange(0, std::memory_order_relaxed)) {
+                    printf("MESSAGE: Requesting INIT from slave %d\n", slave);
+                    ec_slave[slave].state = EC_STATE_INIT;
+                    ec_writestate(slave);
+                    events |= CHECK_EVENT_STATE; // The scan below starts its recovery
+                }
             }
+        }
+        if ((events & CHECK_EVENT_WKC_OK) && recovering == 0) {
+            printf("MESSAGE: Working counter back to %d\n", expectedWKC);
+        }
+        bad_cycles = g_check_bad_cycles.load(std::memory_order_relaxed);
+        bool scan = bad_cycles > 0 || (events & (CHECK_EVENT_WKC_DROP | CHECK_EVENT_STATE));
+        if (!scan && recovering == 0) {
+            continue;
+        }
+        g_check_wakeups.fetch_add(1, std::memory_order_relaxed);
+        if (needlf) {
+            needlf = FALSE;
+            printf("\n");
+        }
 
-            // If the consecutive errors exceed the threshold, attempt reinitialization
-            if (consecutive_errors >= MAX_CONSECUTIVE_ERRORS) {
+        if (bad_cycles > 0) {
+            printf("WARNING: Working counter error (%d/%d), consecutive errors: %u\n",
+                   g_check_wkc.load(std::memory_order_relaxed), expectedWKC - g_offline_wkc.load(), bad_cycles);
+            // If the consecutive errors exceed the threshold, the scan below starts the recovery
+            if (bad_cycles >= MAX_CONSECUTIVE_ERRORS) {
                 printf("ERROR: Too many consecutive errors, attempting recovery...\n");
-                ec_group[currentgroup].docheckstate = TRUE;
-                // Reset the error count
-                consecutive_errors = 0;
             }
+        }
 
-            ec_group[currentgroup].docheckstate = FALSE;
-            ec_readstate();
-            for (slave = 1; slave <= ec_slavecount; slave++) {
-                if ((ec_slave[slave].group == currentgroup) && (ec_slave[slave].state != EC_STATE_OPERATIONAL)) {
-                    ec_group[currentgroup].docheckstate = TRUE;
-                    if (ec_slave[slave].state == (EC_STATE_SAFE_OP + EC_STATE_ERROR)) {
-                        printf("ERROR: Slave %d is in SAFE_OP + ERROR, attempting ack.\n", slave);
-                        ec_slave[slave].state = (EC_STATE_SAFE_OP + EC_STATE_ACK);
-                        ec_writestate(slave);
-                    } else if (ec_slave[slave].state == EC_STATE_SAFE_OP) {
-                        printf("WARNING: Slave %d is in SAFE_OP, changing to OPERATIONAL.\n", slave);
-                        ec_slave[slave].state = EC_STATE_OPERATIONAL;
-                        ec_writestate(slave);
-                    } else if (ec_slave[slave].state > EC_STATE_NONE) {
-                        if (ec_reconfig_slave(slave, EC_TIMEOUTMON)) {
-                            ec_slave[slave].islost = FALSE;
-                            printf("MESSAGE: Slave %d reconfigured\n", slave);
-                        }
-                    } else if (!ec_slave[slave].islost) {
-                        ec_statecheck(slave, EC_STATE_OPERATIONAL, EC_TIMEOUTRET);
-                        if (!ec_slave[slave].state) {
-                            ec_slave[slave].islost = TRUE;
-                            printf("ERROR: Slave %d lost\n", slave);
-                        }
-                    }
-                }
-                if (ec_slave[slave].islost) {
-                    if (!ec_slave[slave].state) {
-                        if (ec_recover_slave(slave, EC_TIMEOUTMON)) {
-                            ec_slave[slave].islost = FALSE;
-                            printf("MESSAGE: Slave %d recovered\n", slave);
-                        }
-                    } else {
-                        ec_slave[slave].islost = FALSE;
-                        printf("MESSAGE: Slave %d found\n", slave);
-                    }
-                }
-            }
-            if (!ec_group[currentgroup].docheckstate) {
-                printf("OK: All slaves resumed OPERATIONAL.\n");
+        // Find the slaves that left OP (a single broadcast read while all are in OP)
+        if (scan) {
+            recovery_scan(currentgroup);
+        }
+
+        // One step for each slave in recovery; the others are not addressed
+        int was_recovering = recovering;
+        recovering = 0;
+        for (slave = 1; slave <= ec_slavecount; slave++) {
+            if (g_recovery[slave].state != REC_OK) {
+                recovering += recovery_step(slave);
             }
         }
-        osal_usleep(500); 
+        ec_group[currentgroup].docheckstate = recovering > 0;
+        if (recovering == 0 && was_recovering > 0) {
+            printf("OK: All slaves resumed OPERATIONAL.\n");
+        }
+        slave_states_publish();
     }
 }
 
 /* 
- * RT EtherCAT thread function
- * This function handles the real-time processing of EtherCAT data. 
- * It sends and receives process data in a loop, synchronizing with the 
- * distributed clock if available, and ensuring timely execution based on 
- * the specified cycle time.
+ * Log drain thread function
+ * This function formats and prints the records written by ecatthread, so the RT thread
+ * never blocks in printf.
  */
-OSAL_THREAD_FUNC_RT ecatthread(void *ptr) {
-    struct timespec ts, tleft;
+OSAL_THREAD_FUNC logthread(void *ptr) {
+    (void)ptr; // Not used
+
+    while (!ecat_stop.load(std::memory_order_relaxed)) {
+        int printed = drain_rt_log(stdout);
+        if (g_latency_report_requested.exchange(false, std::memory_order_relaxed)) {
+            print_latency_report(stdout);
+            printed++;
+        }
+        if (printed > 0) {
+            fflush(stdout);
+        }
+        osal_usleep(2000); // Records are buffered in the ring, no need to poll faster
+    }
+}
+
+//##################################################################################################
+// Process data transport.
+// ecat_loop is a template on the transport, so the backend is selected at compile time and the
+// cycle compiles down to direct calls. A transport provides:
+//   bool running()                  false ends the loop
+//   int wait(struct timespec *ts)   sleep until the absolute deadline *ts (clock_nanosleep contract:
+//                                   0 on success); may move *ts if it does not sleep
+//   int receive()                   working counter of the returned frame, <= 0 if none
+//   void send()                     send the outputs currently in the process image
+//   bool dc_time(int64 *reftime)    DC reference time of the last frame; false without DC
+// SoemTransport is the NIC through SOEM (or the simulated bus with -DEROB_SIM); LoopbackTransport
+// (erob_bench.cpp) is an in-memory drive model for deterministic, free-running cycles.
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/*
+ * Wait until the absolute CLOCK_MONOTONIC deadline with the given WaitStrategy. Returns 0, or the
+ * clock_nanosleep error if the sleep part was interrupted. Polling ends at the first clock reading
+ * past the deadline, so the wake-up error of WAIT_SPIN is one clock_gettime call.
+ */
+static inline int cycle_wait(const struct timespec *deadline, int strategy, int64 spin_ns) {
+    struct timespec tleft;
+    if (strategy == WAIT_SLEEP) {
+        return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, &tleft);
+    }
+    if (strategy == WAIT_HYBRID) {
+        struct timespec early = *deadline; // Deadline minus spin_ns (< 1 s)
+        early.tv_nsec -= spin_ns;
+        if (early.tv_nsec < 0) {
+            early.tv_sec--;
+            early.tv_nsec += NSEC_PER_SEC;
+        }
+        int result = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &early, &tleft);
+        if (result != 0) {
+            return result;
+        }
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (timespec_diff_ns(&now, deadline) > 0) {
+        cpu_relax();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    return 0;
+}
+
+struct SoemTransport {
+    int strategy;  // WaitStrategy
+    int64 spin_ns; // WAIT_HYBRID polling time
+
+    bool running() const { return !ecat_stop.load(std::memory_order_relaxed); }
+
+    int wait(struct timespec *ts) { return cycle_wait(ts, strategy, spin_ns); }
+
+    int receive() { return ec_receive_processdata(EC_TIMEOUTRET); }
+
+    void send() { ec_send_processdata(); }
+
+    bool dc_time(int64 *reftime) {
+        *reftime = ec_DCtime;
+        return ec_slave[0].hasdc;
+    }
+};
+
+/* 
+ * Cyclic process data exchange on the given transport.
+ * Receives the last frame, runs the per-axis control logic, sends the outputs and
+ * sleeps until the next cycle, synchronizing with the distributed clock if available.
+ * Optional work is shed when it would push the send past send_budget after the wake-up
+ * (see CycleBudget).
+ */
+template <typename Transport>
+void ecat_loop(Transport &transport, int64 cycletime, int64 send_budget) {
+    struct timespec ts;
     int ht;
-    int64 cycletime;
     int missed_cycles = 0;
     const int MAX_MISSED_CYCLES = 10;
     struct timespec cycle_start, cycle_end;
+    struct timespec t_wake, t_rx_done, t_tx_start, t_tx_done;
     long cycle_time_ns;
 
     clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -658,61 +4121,39 @@ OSAL_THREAD_FUNC_RT ecatthread(void *ptr) {
         ts.tv_sec++;
         ts.tv_nsec -= NSEC_PER_SEC;
     }
-    cycletime = *(int *)ptr * 1000;
 
     toff = 0;
     dorun = 0;
+    dc_sync_reset(&g_dc_sync, &g_config.dc);
+    cycle_budget_reset(&g_budget, cycletime > send_budget ? cycletime : send_budget, send_budget);
     
-    // Initialize PDO data
-    rxpdo_t rxpdo;
-    txpdo_t txpdo;
-    
-    rxpdo.controlword = 0x0080;
-    rxpdo.target_position = 0;
-    rxpdo.mode_of_operation = 8;
-    rxpdo.padding = 0;
-    
-    // Send initial process data
-    for (int slave = 1; slave <= ec_slavecount; slave++) {
-        memcpy(ec_slave[slave].outputs, &rxpdo, sizeof(rxpdo_t));
-    }
-    ec_send_processdata();
+    // Send the initial per-axis outputs (fault reset, target 0) once
+    axes_write_outputs(&g_axes);
+    transport.send();
 
-    int step = 0;
-    bool need_update = false;
-    int32_t new_target = 0;
+    SetpointCmd cmd;
+    static TelemetrySnapshot snapshot; // Large, keep it off the RT stack
+    uint32_t bad_cycles = 0; // Consecutive WKC errors, published for ecatcheck
+    uint32_t offline_epoch = g_offline_epoch.load(std::memory_order_acquire);
+    int32_t offline_wkc = axes_sync_offline(&g_axes); // Working counter share of slaves in recovery
+    txpdo_t status;
 
-    while (1) {
+    while (transport.running()) {
         clock_gettime(CLOCK_MONOTONIC, &cycle_start);
         
-        // 每1000个周期打印一次调试信息
-        if (dorun % 1000 == 0) {
-            printf("DEBUG: dorun=%d, delay_enabled=%d, delay_start=%d, delay_active=%d, delay_counter=%d\n",
-                   dorun, delay_test_enabled, delay_test_start_cycle, delay_test_active, delay_test_counter);
+        // 每1000个周期打印一次调试信息 (only while a fault script is loaded)
+        if (fault_plan_loaded() && dorun % 1000 == 0) {
+            rt_log(RTLOG_DEBUG, dorun, wkc, NULL, 0, (int32_t)fault_active(), 0);
         }
         
         add_timespec(&ts, cycletime + toff);
         
-        // Check if delay test should be activated
-        if (delay_test_enabled && dorun >= delay_test_start_cycle && 
-            dorun < (delay_test_start_cycle + delay_test_duration)) {
-            
-            // 更新延迟测试计数器
-            delay_test_counter = dorun - delay_test_start_cycle;
-            delay_test_active = true;
-            
-            // 使用与周期时间匹配的延迟
-            usleep(1500); // 5毫秒延迟
-        } else {
-            delay_test_active = false;
-        }
-        
-        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, &tleft) != 0) {
+        if (transport.wait(&ts) != 0) {
             // If sleep is interrupted, record the error
             missed_cycles++;
-            printf("WARNING: Clock sleep interrupted, missed cycles: %d\n", missed_cycles);
+            rt_log(RTLOG_SLEEP_INTERRUPTED, dorun, wkc, NULL, missed_cycles, 0, 0);
             if (missed_cycles >= MAX_MISSED_CYCLES) {
-                printf("ERROR: Too many missed cycles, attempting recovery...\n");
+                rt_log(RTLOG_CLOCK_RESYNC, dorun, wkc, NULL, missed_cycles, 0, 0);
                 // Reset the counter
                 missed_cycles = 0;
                 // Resynchronize the clock
@@ -726,79 +4167,103 @@ OSAL_THREAD_FUNC_RT ecatthread(void *ptr) {
         } else {
             missed_cycles = 0;
         }
+        clock_gettime(CLOCK_MONOTONIC, &t_wake);
+        g_latency[LAT_WAKEUP].record(timespec_diff_ns(&ts, &t_wake));
+        cycle_budget_begin(&g_budget, &ts, (int64)t_wake.tv_sec * NSEC_PER_SEC + t_wake.tv_nsec, cycletime);
         
         dorun++;
+        fault_cycle_begin(dorun);
 
         if (start_ecatthread_thread) {
             // Receive process data
-            wkc = ec_receive_processdata(EC_TIMEOUTRET);
-
-            if (wkc >= expectedWKC) {
-                // Retrieve the current motor status
-                for (int slave = 1; slave <= ec_slavecount; slave++) {
-                    memcpy(&txpdo, ec_slave[slave].inputs, sizeof(txpdo_t));
-                }
+            wkc = fault_filter_wkc(transport.receive());
+            clock_gettime(CLOCK_MONOTONIC, &t_rx_done);
 
-                // State machine control
-                if (step <= 4000) {
-                    rxpdo.controlword = 0x0080;
-                    rxpdo.target_position = 0;
-                } else if (step <= 6000) {
-                    rxpdo.controlword = 0x0006;
-                    rxpdo.target_position = txpdo.actual_position;
-                } else if (step <= 8000) {
-                    rxpdo.controlword = 0x0007;
-                    rxpdo.target_position = txpdo.actual_position;
-                } else if (step <= 10000) {
-                    rxpdo.controlword = 0x000F;
-                    rxpdo.target_position = txpdo.actual_position;
-                } else {
-                    // Normal operational mode
-                    // Execute trajectory planning
-                    //int32_t planned_pos = plan_trajectory(&g_motion_planner, txpdo.actual_position);
-                    // Update output PDO
-                    rxpdo.controlword = 0x000F;
-                    rxpdo.target_position = txpdo.actual_position + 20;
-                    rxpdo.mode_of_operation = 8;
-                }
+            // Consume pending setpoints without blocking
+            while (g_setpoint_ring.pop(cmd)) {
+                axes_apply_command(&g_axes, cmd);
+            }
+            server_drain(&g_axes);
 
-                // Send PDO data to the slaves
-                for (int slave = 1; slave <= ec_slavecount; slave++) {
-                    memcpy(ec_slave[slave].outputs, &rxpdo, sizeof(rxpdo_t));
-                }
+            // Slaves in recovery are not expected to answer; their axes are held
+            uint32_t epoch = g_offline_epoch.load(std::memory_order_acquire);
+            if (epoch != offline_epoch) {
+                offline_epoch = epoch;
+                offline_wkc = axes_sync_offline(&g_axes);
+            }
 
-                // Print status information every 100 cycles
-                if (dorun % 100 == 0) {
-                    printf("Status: pos=%d, target=%d, vel=%d, torque=%d\n",
-                           txpdo.actual_position, rxpdo.target_position,
-                           txpdo.actual_velocity, txpdo.actual_torque);
-                    
-                    // If we're in delay test, print additional information
-                    if (delay_test_active) {
-                        printf(">>> DELAY TEST ACTIVE: Cycle %d of %d (%.1f%% complete) <<<\n", 
-                               delay_test_counter, delay_test_duration, 
-                               (float)delay_test_counter / delay_test_duration * 100.0);
-                    } else if (delay_test_enabled && dorun < delay_test_start_cycle) {
-                        printf(">>> DELAY TEST PENDING: Will start in %d cycles <<<\n", 
-                               delay_test_start_cycle - dorun);
-                    }
+            bool frame_ok = wkc >= expectedWKC - offline_wkc;
+            if (frame_ok) {
+                if (bad_cycles > 0) {
+                    bad_cycles = 0;
+                    g_check_bad_cycles.store(0, std::memory_order_relaxed);
+                    check_event_post(CHECK_EVENT_WKC_OK);
                 }
 
-                if (step < 12000) {
-                    step++;
+                // Read inputs, run the per-axis state machines (and the planners if the budget
+                // allows) and write outputs
+                axes_read_inputs(&g_axes);
+                bool plan = cycle_budget_try(&g_budget, STAGE_PLANNING);
+                axes_update(&g_axes, plan);
+                if (plan) {
+                    cycle_budget_done(&g_budget, STAGE_PLANNING);
                 }
+                fault_compute_delay();
             } else {
-                printf("WARNING: Working counter error (wkc: %d, expected: %d)\n", 
-                       wkc, expectedWKC);
+                rt_log(RTLOG_WKC_ERROR, dorun, wkc, NULL, expectedWKC - offline_wkc, 0, 0);
+                // ecatcheck is woken on the first bad frame and retries on its own while it lasts
+                g_check_wkc.store(wkc, std::memory_order_relaxed);
+                g_check_bad_cycles.store(++bad_cycles, std::memory_order_relaxed);
+                if (bad_cycles == 1) {
+                    check_event_post(CHECK_EVENT_WKC_DROP);
+                }
+            }
+
+            // Mandatory tail: outputs, clock synchronization and send
+            int64 tail_start = monotonic_ns();
+            if (frame_ok) {
+                axes_write_outputs(&g_axes);
             }
 
             // Clock synchronization
-            if (ec_slave[0].hasdc) {
-                ec_sync(ec_DCtime, cycletime, &toff);
+            int64 reftime;
+            if (transport.dc_time(&reftime)) {
+                ec_sync(reftime + fault_dc_offset(), cycletime, &toff);
             }
 
             // Send process data
-            ec_send_processdata();
+            clock_gettime(CLOCK_MONOTONIC, &t_tx_start);
+            if (!fault_skip_send()) {
+                transport.send();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t_tx_done);
+            g_budget.tail_ns = budget_estimate(g_budget.tail_ns,
+                                               (int64)t_tx_done.tv_sec * NSEC_PER_SEC + t_tx_done.tv_nsec - tail_start);
+
+            // Optional work after the send, if it ends before the next wake-up
+            if (frame_ok && cycle_budget_try(&g_budget, STAGE_TELEMETRY)) {
+                // Publish the status snapshot for non-RT readers
+                fill_telemetry(&snapshot, &g_axes, dorun, wkc);
+                g_telemetry.store(snapshot);
+                cycle_budget_done(&g_budget, STAGE_TELEMETRY);
+            }
+
+            // Print status information every 100 cycles
+            if (frame_ok && dorun % 100 == 0 && cycle_budget_try(&g_budget, STAGE_STATUS_LOG)) {
+                // Active injected faults are printed by logthread along with the status line
+                uint32_t faults = fault_active();
+                for (int a = 0; a < g_axes.count; a++) {
+                    axes_txpdo(&g_axes, a, &status);
+                    rt_log(RTLOG_STATUS, dorun, wkc, &status, g_axes.target_position[a], (int32_t)faults,
+                           faults != 0 ? RTLOG_FLAG_FAULT_ACTIVE : 0, a);
+                }
+                cycle_budget_done(&g_budget, STAGE_STATUS_LOG);
+            }
+
+            g_latency[LAT_RECEIVE].record(timespec_diff_ns(&t_wake, &t_rx_done));
+            g_latency[LAT_COMPUTE].record(timespec_diff_ns(&t_rx_done, &t_tx_start));
+            g_latency[LAT_SEND].record(timespec_diff_ns(&t_tx_start, &t_tx_done));
+            fault_cycle_end(dorun, frame_ok && offline_wkc == 0 && dc_sync_settled(&g_dc_sync));
         }
 
         // Monitor cycle time
@@ -807,57 +4272,487 @@ OSAL_THREAD_FUNC_RT ecatthread(void *ptr) {
                        (cycle_end.tv_nsec - cycle_start.tv_nsec);
         
         if (cycle_time_ns > cycletime * 1.5) {
-            printf("WARNING: Cycle time exceeded: %ld ns (expected: %ld ns)\n", 
-                   cycle_time_ns, cycletime);
+            rt_log(RTLOG_CYCLE_OVERRUN, dorun, wkc, NULL, (int32_t)cycle_time_ns, (int32_t)cycletime, 0);
         }
 
     }
 }
 
-// Add a new function to start the delay test
-void start_delay_test(int start_after_cycles, int test_duration) {
-    delay_test_start_cycle = start_after_cycles;
-    delay_test_duration = test_duration;
-    delay_test_counter = 0;
-    delay_test_active = false;
-    delay_test_enabled = true;
-    
-    printf("\n\n");
-    printf("*******************************************************\n");
-    printf("*                                                     *\n");
-    printf("*            DELAY TEST SCHEDULED                     *\n");
-    printf("*            Will start after %d cycles               *\n", start_after_cycles);
-    printf("*            Will run for %d cycles                   *\n", test_duration);
-    printf("*                                                     *\n");
-    printf("*******************************************************\n\n");
+/* 
+ * RT EtherCAT thread function
+ * Runs ecat_loop on the SOEM transport with the cycle time (us) passed in ptr.
+ */
+OSAL_THREAD_FUNC_RT ecatthread(void *ptr) {
+    SoemTransport transport;
+    transport.strategy = g_config.wait_strategy;
+    transport.spin_ns = (int64)g_config.spin_us * 1000;
+    int cycle_us = *(int *)ptr;
+    int budget_us = g_config.send_budget_us > 0 ? g_config.send_budget_us : cycle_us / 2;
+    ecat_loop(transport, (int64)cycle_us * 1000, (int64)budget_us * 1000);
 }
 
-
-
 // Function to update motor status information
 void update_motor_status(int slave_id) {
+    // Read the latest consistent snapshot published by ecatthread
+    static TelemetrySnapshot snapshot;
+    snapshot = g_telemetry.load();
+    int axis = slave_id - 1;
+    if (axis < 0 || axis >= snapshot.axis_count) {
+        return;
+    }
+    txpdo_t status = snapshot.axes[axis].txpdo;
+
     // Update status information from TXPDO
-    motor_status.status_word = txpdo.statusword;
-    motor_status.actual_position = txpdo.actual_position;
-    motor_status.actual_velocity = txpdo.actual_velocity;
-    motor_status.actual_torque = txpdo.actual_torque;
+    motor_status.status_word = status.statusword;
+    motor_status.actual_position = status.actual_position;
+    motor_status.actual_velocity = status.actual_velocity;
+    motor_status.actual_torque = status.actual_torque;
     
     // Check status word to determine if motor is operational
     // Bits 0-3 should be 0111 for enabled and ready state
-    motor_status.is_operational = (txpdo.statusword & 0x0F) == 0x07;
+    motor_status.is_operational = (status.statusword & 0x0F) == 0x07;
+}
+
+//##################################################################################################
+// Quintic trajectory planner
+// Idle and finished planners hold a constant polynomial (a0 = position, a1..a5 = 0), so every axis
+// is evaluated the same way each cycle and the batch kernel below has no per-axis branches.
+
+// Make the coefficients a constant polynomial at the given position
+static void quintic_hold(MotionPlanner* planner, double position) {
+    planner->a0 = position;
+    planner->a1 = planner->a2 = planner->a3 = planner->a4 = planner->a5 = 0.0;
+    planner->current_time = 0.0;
+    planner->total_time = 0.0;
+    planner->revision++;
+}
+
+// Re-seed the planner at a position, at rest, with no move pending
+void planner_reset(MotionPlanner* planner, int32_t position) {
+    if (planner->seeded && !planner->is_moving && planner->current_position == position &&
+        planner->target_position == position && planner->smooth_target == position) {
+        return; // Already holding this position, keep the batch coefficients valid
+    }
+    planner->start_position = position;
+    planner->target_position = position;
+    planner->smooth_target = position;
+    planner->current_position = position;
+    planner->planned_position = position;
+    planner->current_velocity = 0.0;
+    planner->current_acceleration = 0.0;
+    planner->is_moving = false;
+    planner->seeded = true;
+    quintic_hold(planner, position);
+}
+
+// Re-seed the planner from a moving axis (switch into CSP): the motion is taken over at the given
+// velocity and brought to rest at the stopping point, unless a new target arrives first
+void planner_seed(MotionPlanner* planner, int32_t position, double velocity) {
+    planner_reset(planner, position);
+    if (fabs(velocity) < 1.0) {
+        return;
+    }
+    planner->current_velocity = velocity;
+    planner->target_position = position +
+        (int32_t)lround(velocity * fabs(velocity) / (2.0 * MotionPlanner::MAX_ACCELERATION));
+}
+
+// Quintic coefficients from the current state (p0, v0, acc0) to smooth_target, at rest, in time T
+static void quintic_coefficients(MotionPlanner* planner, double T) {
+    double p0 = planner->planned_position;
+    double v0 = planner->current_velocity;
+    double acc0 = planner->current_acceleration;
+    double d = planner->smooth_target - p0;
+    double T2 = T * T, T3 = T2 * T;
+
+    planner->a0 = p0;
+    planner->a1 = v0;
+    planner->a2 = acc0 / 2.0;
+    planner->a3 = (20.0 * d - 12.0 * v0 * T - 3.0 * acc0 * T2) / (2.0 * T3);
+    planner->a4 = (-30.0 * d + 16.0 * v0 * T + 3.0 * acc0 * T2) / (2.0 * T3 * T);
+    planner->a5 = (12.0 * d - 6.0 * v0 * T - acc0 * T2) / (2.0 * T3 * T2);
+    planner->total_time = T;
+}
+
+// Evaluate position, velocity and acceleration of a quintic at time t (Horner's method)
+static inline void quintic_eval(double a0, double a1, double a2, double a3, double a4, double a5,
+                                double t, double *pos, double *vel, double *acc) {
+    *pos = ((((a5 * t + a4) * t + a3) * t + a2) * t + a1) * t + a0;
+    *vel = (((5.0 * a5 * t + 4.0 * a4) * t + 3.0 * a3) * t + 2.0 * a2) * t + a1;
+    *acc = ((20.0 * a5 * t + 12.0 * a4) * t + 6.0 * a3) * t + 2.0 * a2;
+}
+
+/*
+ * Plan a new quintic segment from the current planned state to smooth_target.
+ * Called once per move (and on retargeting), never per cycle. The duration starts from the
+ * rest-to-rest optimum for the velocity and acceleration limits and is stretched until a sampled
+ * check of the segment respects both limits. The loop is bounded, so the cost is too.
+ */
+static void plan_quintic(MotionPlanner* planner) {
+    const int SAMPLES = 32;
+    const int MAX_ITERATIONS = 12;
+    double v0 = fabs(planner->current_velocity);
+    double acc0 = fabs(planner->current_acceleration);
+    double dist = fabs(planner->smooth_target - planner->planned_position);
+    // A segment that starts above a limit can only be held to its starting value
+    double vmax = fmax(MotionPlanner::MAX_VELOCITY, v0);
+    double amax = fmax(MotionPlanner::MAX_ACCELERATION, acc0);
+
+    // Rest-to-rest optimum: peak velocity 15d/8T, peak acceleration 10d/(sqrt(3)T^2)
+    double T = fmax(15.0 * dist / (8.0 * vmax), sqrt(10.0 * dist / (sqrt(3.0) * amax)));
+    T = fmax(T, 2.0 * v0 / amax);
+    T = fmax(T, 2.0 * MotionPlanner::CYCLE_TIME);
+
+    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
+        quintic_coefficients(planner, T);
+        double peak_v = 0.0, peak_a = 0.0;
+        for (int i = 0; i <= SAMPLES; i++) {
+            double p, v, a;
+            quintic_eval(planner->a0, planner->a1, planner->a2, planner->a3, planner->a4, planner->a5,
+                         T * i / SAMPLES, &p, &v, &a);
+            peak_v = fmax(peak_v, fabs(v));
+            peak_a = fmax(peak_a, fabs(a));
+        }
+        double ratio = fmax(peak_v / vmax, sqrt(peak_a / amax));
+        if (ratio <= 1.0) {
+            break;
+        }
+        T *= ratio * 1.01;
+    }
+    planner->revision++;
+}
+
+// Velocity from which a jerk-limited stop (starting at zero acceleration) covers exactly dist
+static double online_stop_velocity(double dist) {
+    const double A = MotionPlanner::MAX_ACCELERATION;
+    const double J = MotionPlanner::MAX_JERK;
+    if (dist <= 0.0) {
+        return 0.0;
+    }
+    if (dist < A * A * A / (J * J)) {
+        return cbrt(dist * dist * J);                 // Acceleration limit never reached
+    }
+    return (-A * A / J + sqrt(A * A * A * A / (J * J) + 8.0 * A * dist)) / 2.0;
+}
+
+/*
+ * One cycle of the online jerk-limited trajectory generator.
+ * Recomputes from the current state every cycle, so target changes take effect immediately and
+ * nothing is planned up front. Position feeds a velocity demand (the fastest velocity that can
+ * still stop at the target), velocity feeds an acceleration demand, and the jerk that moves the
+ * acceleration towards it is clamped to MAX_JERK. Constant work per call, no loops.
+ * The result is written as a Taylor polynomial at t = 0 so the batch evaluation stays uniform.
+ */
+static void online_step(MotionPlanner* planner) {
+    const double dt = MotionPlanner::CYCLE_TIME;
+    const double V = MotionPlanner::MAX_VELOCITY;
+    const double A = MotionPlanner::MAX_ACCELERATION;
+    const double J = MotionPlanner::MAX_JERK;
+    double p = planner->planned_position;
+    double v = planner->current_velocity;
+    double a = planner->current_acceleration;
+    double d = planner->target_position - p;
+
+    planner->smooth_target = planner->target_position;
+    if (fabs(d) < 0.25 && fabs(v) < 20.0 && fabs(a) < 2000.0) {
+        // Settled within a fraction of a count: the rounded command is already the target
+        p = planner->target_position;
+        v = 0.0;
+        a = 0.0;
+        planner->is_moving = false;
+    } else {
+        // Work in the direction of the target, so the distance is positive
+        double dir = d > 0.0 ? 1.0 : (d < 0.0 ? -1.0 : (v >= 0.0 ? 1.0 : -1.0));
+        double x = dir * d, u = dir * v, w = dir * a;
+
+        // Distance covered while the current acceleration is ramped to zero, plus one cycle of latency
+        double ta = fabs(w) / J;
+        double ramp = u * ta + w * ta * ta / 2.0 - (w > 0.0 ? 1.0 : -1.0) * J * ta * ta * ta / 6.0;
+        double u_des = fmin(V, online_stop_velocity(x - ramp - u * dt));
+
+        double e = u_des - u;
+        double w_des = (e > 0.0 ? 1.0 : -1.0) * fmin(A, sqrt(2.0 * J * fabs(e)));
+        double jerk = dir * fmax(-J, fmin(J, (w_des - w) / dt));
+
+        // Exact integration over one cycle with constant jerk
+        p += v * dt + a * dt * dt / 2.0 + jerk * dt * dt * dt / 6.0;
+        v += a * dt + jerk * dt * dt / 2.0;
+        a += jerk * dt;
+        planner->is_moving = true;
+    }
+
+    planner->a0 = p;
+    planner->a1 = v;
+    planner->a2 = a / 2.0;
+    planner->a3 = planner->a4 = planner->a5 = 0.0;
+    planner->current_time = 0.0;
+    planner->total_time = 0.0;
+    planner->revision++;
+}
+
+// Per-cycle bookkeeping for one axis: seeding, (re)planning, time advance and end of segment
+static void trajectory_advance(MotionPlanner* planner, int32_t actual_position) {
+    if (!planner->seeded) {
+        planner_reset(planner, actual_position);
+    }
+
+    if (planner->mode == PLANNER_ONLINE) {
+        if (planner->is_moving || planner->target_position != planner->smooth_target) {
+            online_step(planner);
+        }
+        return;
+    }
+
+    if (planner->target_position != planner->smooth_target) {
+        // New target, or retarget mid-move
+        planner->start_position = planner->current_position;
+        planner->smooth_target = planner->target_position;
+        plan_quintic(planner);
+        planner->current_time = 0.0;
+        planner->is_moving = true;
+    }
+
+    if (planner->is_moving) {
+        planner->current_time += MotionPlanner::CYCLE_TIME;
+        if (planner->current_time >= planner->total_time) {
+            // End of segment: velocity and acceleration are zero by construction
+            planner->is_moving = false;
+            quintic_hold(planner, planner->smooth_target);
+        }
+    }
+}
+
+// Store the evaluated state back into the planner
+static inline int32_t trajectory_writeback(MotionPlanner* planner, double pos, double vel, double acc) {
+    planner->planned_position = pos;
+    planner->current_velocity = vel;
+    planner->current_acceleration = acc;
+    planner->current_position = (int32_t)lround(pos);
+    return planner->current_position;
+}
+
+/*
+ * Advance the axis trajectory by one cycle and return the position to command.
+ * Coefficients are computed once per move; each cycle only evaluates the polynomial with Horner's
+ * method. A target change during a move replans from the current position, velocity and
+ * acceleration, so the commanded profile stays continuous up to the acceleration.
+ * actual_position is only used to seed a planner that was never reset.
+ */
+int32_t plan_trajectory(MotionPlanner* planner, int32_t actual_position) {
+    double pos, vel, acc;
+    trajectory_advance(planner, actual_position);
+    quintic_eval(planner->a0, planner->a1, planner->a2, planner->a3, planner->a4, planner->a5,
+                 planner->current_time, &pos, &vel, &acc);
+    return trajectory_writeback(planner, pos, vel, acc);
+}
+
+//##################################################################################################
+// Batched multi-axis trajectory evaluation.
+// The coefficients of all axes are mirrored into a structure-of-arrays layout and evaluated in one
+// pass: AVX2 (4 axes per instruction) or SSE2 (2 axes) when the compiler targets them, scalar
+// otherwise. Build with -mavx2 -mfma (or -march=native) to get the AVX2 kernel.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TRAJECTORY_KERNEL "AVX2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TRAJECTORY_KERNEL "SSE2"
+#else
+#define TRAJECTORY_KERNEL "scalar"
+#endif
+
+struct TrajectoryBatch {
+    alignas(32) double a0[MAX_AXES];
+    alignas(32) double a1[MAX_AXES];
+    alignas(32) double a2[MAX_AXES];
+    alignas(32) double a3[MAX_AXES];
+    alignas(32) double a4[MAX_AXES];
+    alignas(32) double a5[MAX_AXES];
+    alignas(32) double t[MAX_AXES];   // Time within the active segment
+    alignas(32) double pos[MAX_AXES]; // Evaluated position
+    alignas(32) double vel[MAX_AXES]; // Evaluated velocity
+    alignas(32) double acc[MAX_AXES]; // Evaluated acceleration
+    uint32_t revision[MAX_AXES];      // Planner revision the coefficients were copied from
+
+    TrajectoryBatch() {
+        memset(this, 0, sizeof(*this));
+        for (int a = 0; a < MAX_AXES; a++) {
+            revision[a] = UINT32_MAX; // Force a copy on first use
+        }
+    }
+};
+
+TrajectoryBatch g_trajectory_batch;
+
+// Scalar kernel for axes [begin, end)
+void trajectory_eval_scalar(TrajectoryBatch *b, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        quintic_eval(b->a0[i], b->a1[i], b->a2[i], b->a3[i], b->a4[i], b->a5[i], b->t[i],
+                     &b->pos[i], &b->vel[i], &b->acc[i]);
+    }
+}
+
+#if defined(__AVX2__)
+#if defined(__FMA__)
+#define TRAJ_MADD(a, b, c) _mm256_fmadd_pd(a, b, c)
+#else
+#define TRAJ_MADD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#endif
+#endif
+
+// Evaluate position, velocity and acceleration for the first count axes
+void trajectory_eval_batch(TrajectoryBatch *b, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256d c2 = _mm256_set1_pd(2.0), c3 = _mm256_set1_pd(3.0), c4 = _mm256_set1_pd(4.0);
+    const __m256d c5 = _mm256_set1_pd(5.0), c6 = _mm256_set1_pd(6.0);
+    const __m256d c12 = _mm256_set1_pd(12.0), c20 = _mm256_set1_pd(20.0);
+    for (; i + 4 <= count; i += 4) {
+        __m256d t = _mm256_load_pd(&b->t[i]);
+        __m256d a0 = _mm256_load_pd(&b->a0[i]), a1 = _mm256_load_pd(&b->a1[i]);
+        __m256d a2 = _mm256_load_pd(&b->a2[i]), a3 = _mm256_load_pd(&b->a3[i]);
+        __m256d a4 = _mm256_load_pd(&b->a4[i]), a5 = _mm256_load_pd(&b->a5[i]);
+
+        __m256d p = TRAJ_MADD(a5, t, a4);
+        p = TRAJ_MADD(p, t, a3);
+        p = TRAJ_MADD(p, t, a2);
+        p = TRAJ_MADD(p, t, a1);
+        p = TRAJ_MADD(p, t, a0);
+
+        __m256d v = TRAJ_MADD(_mm256_mul_pd(c5, a5), t, _mm256_mul_pd(c4, a4));
+        v = TRAJ_MADD(v, t, _mm256_mul_pd(c3, a3));
+        v = TRAJ_MADD(v, t, _mm256_mul_pd(c2, a2));
+        v = TRAJ_MADD(v, t, a1);
+
+        __m256d acc = TRAJ_MADD(_mm256_mul_pd(c20, a5), t, _mm256_mul_pd(c12, a4));
+        acc = TRAJ_MADD(acc, t, _mm256_mul_pd(c6, a3));
+        acc = TRAJ_MADD(acc, t, _mm256_mul_pd(c2, a2));
+
+        _mm256_store_pd(&b->pos[i], p);
+        _mm256_store_pd(&b->vel[i], v);
+        _mm256_store_pd(&b->acc[i], acc);
+    }
+#elif defined(__SSE2__)
+    const __m128d c2 = _mm_set1_pd(2.0), c3 = _mm_set1_pd(3.0), c4 = _mm_set1_pd(4.0);
+    const __m128d c5 = _mm_set1_pd(5.0), c6 = _mm_set1_pd(6.0);
+    const __m128d c12 = _mm_set1_pd(12.0), c20 = _mm_set1_pd(20.0);
+    for (; i + 2 <= count; i += 2) {
+        __m128d t = _mm_load_pd(&b->t[i]);
+        __m128d a0 = _mm_load_pd(&b->a0[i]), a1 = _mm_load_pd(&b->a1[i]);
+        __m128d a2 = _mm_load_pd(&b->a2[i]), a3 = _mm_load_pd(&b->a3[i]);
+        __m128d a4 = _mm_load_pd(&b->a4[i]), a5 = _mm_load_pd(&b->a5[i]);
+
+        __m128d p = _mm_add_pd(_mm_mul_pd(a5, t), a4);
+        p = _mm_add_pd(_mm_mul_pd(p, t), a3);
+        p = _mm_add_pd(_mm_mul_pd(p, t), a2);
+        p = _mm_add_pd(_mm_mul_pd(p, t), a1);
+        p = _mm_add_pd(_mm_mul_pd(p, t), a0);
+
+        __m128d v = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(c5, a5), t), _mm_mul_pd(c4, a4));
+        v = _mm_add_pd(_mm_mul_pd(v, t), _mm_mul_pd(c3, a3));
+        v = _mm_add_pd(_mm_mul_pd(v, t), _mm_mul_pd(c2, a2));
+        v = _mm_add_pd(_mm_mul_pd(v, t), a1);
+
+        __m128d acc = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(c20, a5), t), _mm_mul_pd(c12, a4));
+        acc = _mm_add_pd(_mm_mul_pd(acc, t), _mm_mul_pd(c6, a3));
+        acc = _mm_add_pd(_mm_mul_pd(acc, t), _mm_mul_pd(c2, a2));
+
+        _mm_store_pd(&b->pos[i], p);
+        _mm_store_pd(&b->vel[i], v);
+        _mm_store_pd(&b->acc[i], acc);
+    }
+#endif
+    trajectory_eval_scalar(b, i, count); // Remaining axes
+}
+
+// Advance all planners by `steps` cycles (more than one to catch up after cycles without planning)
+// and evaluate the last one in one batch. Coefficients are copied into the batch only when a
+// planner replans, finishes or is reset.
+void trajectory_step_all(MotionPlanner *planners, const int32_t *actual_position, int count,
+                         TrajectoryBatch *b, int steps) {
+    for (int a = 0; a < count; a++) {
+        MotionPlanner *planner = &planners[a];
+        for (int s = 1; s < steps; s++) {
+            plan_trajectory(planner, actual_position[a]); // Skipped cycles, evaluated one by one
+        }
+        trajectory_advance(planner, actual_position[a]);
+        if (b->revision[a] != planner->revision) {
+            b->a0[a] = planner->a0;
+            b->a1[a] = planner->a1;
+            b->a2[a] = planner->a2;
+            b->a3[a] = planner->a3;
+            b->a4[a] = planner->a4;
+            b->a5[a] = planner->a5;
+            b->revision[a] = planner->revision;
+        }
+        b->t[a] = planner->current_time;
+    }
+
+    trajectory_eval_batch(b, count);
+
+    for (int a = 0; a < count; a++) {
+        trajectory_writeback(&planners[a], b->pos[a], b->vel[a], b->acc[a]);
+    }
 }
 
+#ifndef EROB_NO_MAIN
 // Modify the main function to start the server thread
 int main(int argc, char **argv) {
     needlf = FALSE;
     inOP = FALSE;
     start_ecatthread_thread = FALSE;
     dorun = 0;
-    ctime_thread = 500; // 1毫秒周期时间
+    config_apply(&g_config); // Defaults until the configuration file is read
+
+    // "kill -USR1 <pid>" prints the cycle latency histograms
+    signal(SIGUSR1, request_latency_report);
+
+    // Print the PDO layout (field offsets for tools such as the Python ports)
+    if (argc > 1 && strcmp(argv[1], "--pdo-layout") == 0) {
+        print_pdo_layout(stdout);
+        return EXIT_SUCCESS;
+    }
+
+    // The benchmarks are a separate program built from erob_bench.cpp
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        printf("The benchmarks are not part of this program: ./erob_bench <name>\n");
+        return EXIT_FAILURE;
+    }
+
+    // Runtime configuration: "--config <file>", otherwise erob.conf if present.
+    // "--check-config [file]" only validates and prints it.
+    bool check_only = argc > 1 && strcmp(argv[1], "--check-config") == 0;
+    const char *config_path = EROB_CONFIG_FILE;
+    bool config_required = false;
+    if (argc > 2 && (strcmp(argv[1], "--config") == 0 || check_only)) {
+        config_path = argv[2];
+        config_required = true;
+    }
+    int loaded = config_load(&g_config, config_path);
+    if (loaded < 0 || (loaded > 0 && config_required)) {
+        printf("Cannot use configuration %s\n", config_path);
+        return EXIT_FAILURE;
+    }
+    if (config_validate(&g_config) != 0) {
+        printf("Invalid configuration %s\n", loaded == 0 ? config_path : "(defaults)");
+        return EXIT_FAILURE;
+    }
+    config_apply(&g_config);
+    topology_read(&g_topology);
+    topology_plan(&g_config, &g_topology);
+    printf("Configuration (%s):\n", loaded == 0 ? config_path : "defaults");
+    config_print(stdout, &g_config);
+    if (check_only) {
+        return EXIT_SUCCESS;
+    }
+    if (g_config.irq_steer) {
+        topology_steer_nic(g_config.ifname, g_config.cpu_ecat);
+    }
 
     // Set a higher real-time priority
     struct sched_param param;
-    param.sched_priority = 99; // Maximum real-time priority
+    param.sched_priority = g_config.rt_priority;
     if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
         perror("sched_setscheduler failed");
     }
@@ -867,23 +4762,36 @@ int main(int argc, char **argv) {
         perror("mlockall failed");
     }
 
-    // Set CPU affinity
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(3, &cpuset);
+    // Set CPU affinity. The EtherCAT threads inherit it and erob_start moves each of them to
+    // its own CPUs, so ecatthread never starts out on the main thread's core.
+    if (g_config.cpu_main != CPU_NONE) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        if (g_config.cpu_main >= 0) {
+            CPU_SET(g_config.cpu_main, &cpuset);
+        } else {
+            cpuset = g_topology.housekeeping;
+        }
 
-    if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset) == -1) {
-        perror("sched_setaffinity");
-        return EXIT_FAILURE;
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset) == -1) {
+            perror("sched_setaffinity");
+#ifndef EROB_SIM
+            return EXIT_FAILURE;
+#endif
+        }
     }
 
 
-    // 在启动 erob_test 前启用延迟测试
-    start_delay_test(15000, 1000);  // 等待15000个周期后开始(包含使能前的4000+6000+5000个周期)，持续1000个周期
+    // "--faults <file>" injects the scripted faults (builds with EROB_FAULT_INJECTION only)
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--faults") == 0 && !fault_load(argv[i + 1])) {
+            return EXIT_FAILURE;
+        }
+    }
 
-    printf("Running on CPU core 3\n");
     erob_test();
     printf("End program\n");
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif // EROB_NO_MAIN
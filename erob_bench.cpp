@@ -0,0 +1,1374 @@
+/*
+ * erob_bench: benchmarks of the eRob_CSP.cpp real-time building blocks.
+ *
+ * The channel, logger, wait strategies, DC controller, axis state machines, ecat_loop, trajectory
+ * planners, SDO configuration and setpoint server are the ones from eRob_CSP.cpp, compiled from
+ * the same source; the benchmarks and their simulated drives (erob_sim.h model) live here only,
+ * so neither the real-time binary nor the erob_rt extension carries them.
+ *
+ * Build: g++ -std=c++17 -O2 [-mavx2 -mfma] erob_bench.cpp -o erob_bench -lsoem -pthread
+ * Run:   ./erob_bench <name>
+ */
+
+#define EROB_NO_MAIN
+#include "eRob_CSP.cpp"
+#include "erob_sim.h" // Drive model of the loopback transport and of the SDO benchmark
+
+//##################################################################################################
+// Benchmarks
+// They exercise the RT building blocks without touching the EtherCAT network, so they can run on
+// any Linux machine (as root for SCHED_FIFO).
+
+// Min/avg/max accumulator for benchmark timings
+struct BenchStats {
+    int64 min_ns;
+    int64 max_ns;
+    double sum_ns;
+    long count;
+
+    BenchStats() : min_ns(INT64_MAX), max_ns(0), sum_ns(0.0), count(0) {}
+
+    void add(int64 ns) {
+        if (ns < min_ns) min_ns = ns;
+        if (ns > max_ns) max_ns = ns;
+        sum_ns += ns;
+        count++;
+    }
+
+    void print(const char *label) const {
+        printf("  %-28s min=%8.2f us  avg=%8.2f us  max=%8.2f us  (n=%ld)\n", label,
+               count ? min_ns / 1000.0 : 0.0, count ? sum_ns / count / 1000.0 : 0.0,
+               max_ns / 1000.0, count);
+    }
+};
+
+// Create a benchmark thread, with SCHED_FIFO if the process is allowed to use it
+bool create_bench_thread(pthread_t *thread, void *(*func)(void *), void *arg, int priority) {
+    pthread_attr_t attr;
+    struct sched_param param;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    param.sched_priority = priority;
+    pthread_attr_setschedpolicy(&attr, priority > 0 ? SCHED_FIFO : SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    int result = pthread_create(thread, &attr, func, arg);
+    if (result != 0 && priority > 0) {
+        // No RT privileges: fall back to the default scheduler
+        param.sched_priority = 0;
+        pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+        pthread_attr_setschedparam(&attr, &param);
+        result = pthread_create(thread, &attr, func, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return result == 0;
+}
+
+std::atomic<bool> bench_stop(false); // Tells benchmark helper threads to exit
+
+// Cycle thread for the channel benchmark: same wait/drain/publish pattern as ecatthread
+#define CHANNEL_BENCH_AXES 12
+struct ChannelBenchArgs {
+    int cycles;
+    int64 cycletime;
+    BenchStats wakeup; // Lateness of the wake-up against the absolute deadline
+    BenchStats work;   // Time spent draining setpoints and publishing the snapshot
+};
+
+void *channel_bench_cycle(void *ptr) {
+    ChannelBenchArgs *args = (ChannelBenchArgs *)ptr;
+    struct timespec ts, now, done;
+    SetpointCmd cmd;
+    static TelemetrySnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.axis_count = CHANNEL_BENCH_AXES;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < args->cycles; i++) {
+        add_timespec(&ts, args->cycletime);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        while (g_setpoint_ring.pop(cmd)) {
+            snapshot.axes[cmd.axis].target_position = cmd.value;
+        }
+        snapshot.cycle = i;
+        g_telemetry.store(snapshot);
+
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        args->wakeup.add(timespec_diff_ns(&ts, &now));
+        args->work.add(timespec_diff_ns(&now, &done));
+    }
+    return NULL;
+}
+
+void *channel_bench_producer(void *ptr) {
+    (void)ptr;
+    int32_t target = 0;
+    while (!bench_stop.load(std::memory_order_relaxed)) {
+        send_setpoint(target % CHANNEL_BENCH_AXES, target);
+        target++;
+    }
+    return NULL;
+}
+
+void *channel_bench_reader(void *ptr) {
+    (void)ptr;
+    long reads = 0;
+    while (!bench_stop.load(std::memory_order_relaxed)) {
+        reads += g_telemetry.load().cycle & 1;
+    }
+    return (void *)reads;
+}
+
+// Measure cycle jitter with and without producer/reader contention on the channel
+int bench_channel() {
+    const int cycles = 10000;
+    const char *labels[2] = {"idle", "contended"};
+
+    printf("Channel benchmark: %d cycles of %d us\n", cycles, ctime_thread);
+    for (int contended = 0; contended <= 1; contended++) {
+        ChannelBenchArgs args;
+        args.cycles = cycles;
+        args.cycletime = (int64)ctime_thread * 1000;
+
+        pthread_t cycle_thread, producer, reader;
+        bench_stop = false;
+        if (contended) {
+            create_bench_thread(&producer, channel_bench_producer, NULL, 0);
+            create_bench_thread(&reader, channel_bench_reader, NULL, 0);
+        }
+        if (!create_bench_thread(&cycle_thread, channel_bench_cycle, &args, 80)) {
+            printf("Error: Could not create benchmark thread\n");
+            return -1;
+        }
+        pthread_join(cycle_thread, NULL);
+        bench_stop = true;
+        if (contended) {
+            pthread_join(producer, NULL);
+            pthread_join(reader, NULL);
+        }
+
+        printf("%s:\n", labels[contended]);
+        args.wakeup.print("wake-up latency");
+        args.work.print("drain + publish");
+    }
+    return 0;
+}
+
+// The integer PI ec_sync used before DcSync, kept for the comparison in bench_dcsync
+static int64 legacy_ec_sync(int64 reftime, int64 cycletime, int64 *integral) {
+    int64 delta = reftime % cycletime;
+    if (delta > (cycletime / 2)) {
+        delta = delta - cycletime;
+    }
+    if (delta > 0) {
+        (*integral)++;
+    }
+    if (delta < 0) {
+        (*integral)--;
+    }
+    return -(delta / 100) - (*integral / 20);
+}
+
+// Reference clock drift against the local clock (ppm) at time t (s)
+struct DriftProfile {
+    const char *name;
+    double ppm;        // Constant part
+    double step_ppm;   // Added from step_time on
+    double step_time;
+    double wander_ppm; // Amplitude of a sinusoidal wander
+    double wander_period;
+
+    double at(double t) const {
+        double drift = ppm + (t >= step_time ? step_ppm : 0.0);
+        if (wander_ppm != 0.0) {
+            drift += wander_ppm * sin(2.0 * M_PI * t / wander_period);
+        }
+        return drift;
+    }
+};
+
+struct DcSimResult {
+    double converge_ms;  // Time after which the phase error stays within the band
+    double mean_ns;      // Mean phase error over the last quarter of the run
+    double rms_ns;
+    double max_ns;       // Largest |phase error| over the last quarter
+    double lock_ms;      // DcSync only: first time LOCKED was reached, -1 if never
+    double drift_ppm;    // DcSync only: drift estimate at the end of the run
+};
+
+/*
+ * Run one controller against a simulated reference clock. The wake-up schedule advances by the
+ * cycle time plus the controller's correction; each frame reaches the reference clock after a
+ * mean latency plus deterministic pseudo-random jitter (with rare 100 us late wake-ups). The phase
+ * error is evaluated at the mean latency, without the jitter, which is what the drives see.
+ */
+static DcSimResult dc_simulate(const DriftProfile &profile, bool legacy, int64 cycletime, double seconds,
+                               double band_ns) {
+    const int64 base = 1000000000000000000LL; // Typical DC time magnitude (ns since 2000)
+    const double latency = 30000.0;           // Wake-up to frame at the reference slave (ns)
+    int cycles = (int)(seconds * 1e9 / cycletime);
+    uint32_t rng = 12345;
+    double local = 0.0;                       // Scheduled wake-up on the local clock (ns)
+    double dc = 0.4 * cycletime;              // Reference clock minus base (ns), initial phase
+    int64 integral = 0;
+    static DcSync sync;
+    dc_sync_reset(&sync, &g_config.dc);
+
+    DcSimResult r = {-1.0, 0.0, 0.0, 0.0, -1.0, 0.0};
+    int last_out = -1;
+    double sum = 0.0, sum_sq = 0.0;
+    int tail_start = cycles - cycles / 4;
+    for (int k = 0; k < cycles; k++) {
+        rng = rng * 1664525u + 1013904223u;
+        double jitter = (double)((rng >> 8) % 2001) - 1000.0; // +-1 us around the mean latency
+        if ((rng >> 4) % 1000 == 0) {
+            jitter += 100000.0;
+        }
+        double drift = profile.at(local * 1e-9) * 1e-6;
+        int64 measured = base + (int64)llround(dc + (latency + jitter) * (1.0 + drift));
+        int64 ideal = base + (int64)llround(dc + latency * (1.0 + drift));
+        int64 error = ideal % cycletime;
+        if (error > cycletime / 2) {
+            error -= cycletime;
+        }
+        if (fabs((double)error) > band_ns) {
+            last_out = k;
+        }
+        if (k >= tail_start) {
+            sum += error;
+            sum_sq += (double)error * error;
+            r.max_ns = fmax(r.max_ns, fabs((double)error));
+        }
+
+        int64 offset = legacy ? legacy_ec_sync(measured, cycletime, &integral)
+                              : dc_sync_update(&sync, measured, cycletime);
+        if (!legacy && r.lock_ms < 0.0 && sync.status.state == DC_LOCKED) {
+            r.lock_ms = k * cycletime / 1e6;
+        }
+        double step = (double)(cycletime + offset);
+        local += step;
+        dc += step * (1.0 + drift);
+    }
+    int tail = cycles - tail_start;
+    r.converge_ms = last_out + 1 < cycles ? (last_out + 1) * cycletime / 1e6 : -1.0;
+    r.mean_ns = sum / tail;
+    r.rms_ns = sqrt(sum_sq / tail);
+    r.drift_ppm = sync.status.drift_ppm;
+    return r;
+}
+
+// Offline DC synchronisation harness: convergence time and steady-state phase error of the
+// former integer PI and of DcSync (gains from the configuration) against drift profiles
+int bench_dcsync() {
+    const DriftProfile profiles[] = {
+        {"no drift", 0.0, 0.0, 1e9, 0.0, 1.0},
+        {"+50 ppm", 50.0, 0.0, 1e9, 0.0, 1.0},
+        {"-200 ppm", -200.0, 0.0, 1e9, 0.0, 1.0},
+        {"step 0 -> +100 ppm at 10 s", 0.0, 100.0, 10.0, 0.0, 1.0},
+        {"wander +-80 ppm, 20 s", 0.0, 0.0, 1e9, 80.0, 20.0},
+    };
+    const double seconds = 20.0;
+    const double band_ns = 500.0;
+    const int64 cycletime = (int64)ctime_thread * 1000;
+    bool pass = true;
+
+    printf("DC sync simulation: %.0f s at %d us, initial phase 40 %% of the cycle, +-1 us jitter\n",
+           seconds, ctime_thread);
+    printf("converged = phase error within %.0f ns for the rest of the run; mean/rms/max over the last 5 s\n",
+           band_ns);
+    for (const auto &profile : profiles) {
+        printf("%s:\n", profile.name);
+        for (int legacy = 1; legacy >= 0; legacy--) {
+            DcSimResult r = dc_simulate(profile, legacy, cycletime, seconds, band_ns);
+            char converge[32];
+            if (r.converge_ms < 0.0) {
+                snprintf(converge, sizeof(converge), "never");
+            } else {
+                snprintf(converge, sizeof(converge), "%.1f ms", r.converge_ms);
+            }
+            printf("  %-8s converged %10s  mean %8.1f ns  rms %8.1f ns  max %8.1f ns", legacy ? "integer" : "DcSync",
+                   converge, r.mean_ns, r.rms_ns, r.max_ns);
+            if (!legacy) {
+                printf("  locked at %.1f ms, drift %.1f ppm", r.lock_ms, r.drift_ppm);
+                if (r.converge_ms < 0.0 || r.max_ns > band_ns) {
+                    pass = false;
+                }
+            }
+            printf("\n");
+        }
+    }
+    printf("result: %s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
+
+// Cycle thread for the wait benchmark: only waits, so the histogram is the wake-up error of the
+// strategy alone
+struct WaitBenchArgs {
+    int cycles;
+    int64 cycletime;
+    int strategy;          // WaitStrategy
+    int64 spin_ns;
+    LatencyHistogram wakeup; // Deadline to first instruction after the wait
+    int64 cpu_ns;          // Thread CPU time over the run
+};
+
+void *wait_bench_cycle(void *ptr) {
+    WaitBenchArgs *args = (WaitBenchArgs *)ptr;
+    struct timespec ts, now, cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < args->cycles; i++) {
+        add_timespec(&ts, args->cycletime);
+        cycle_wait(&ts, args->strategy, args->spin_ns);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        args->wakeup.record(timespec_diff_ns(&ts, &now));
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    args->cpu_ns = timespec_diff_ns(&cpu_start, &cpu_end);
+    return NULL;
+}
+
+// Wake-up error and CPU cost of each wait strategy at the short cycle times, to pick the
+// trade-off of a cell (wait/spin_us in the configuration)
+int bench_wait() {
+    const int cycle_us[] = {250, 125};
+    const struct { int strategy; int spin_us; } runs[] = {
+        {WAIT_SLEEP, 0}, {WAIT_HYBRID, 20}, {WAIT_HYBRID, 50}, {WAIT_SPIN, 0}
+    };
+    static WaitBenchArgs args; // LatencyHistogram is large
+
+    printf("Wait benchmark: wake-up error against the cycle deadline\n");
+    printf("(polling only pays off on an isolated CPU; on a shared one it is preempted)\n");
+    for (int c : cycle_us) {
+        for (const auto &run : runs) {
+            args.cycles = 1000000 / c; // One second per run
+            args.cycletime = (int64)c * 1000;
+            args.strategy = run.strategy;
+            args.spin_ns = (int64)run.spin_us * 1000;
+            args.wakeup.reset();
+            pthread_t thread;
+            if (!create_bench_thread(&thread, wait_bench_cycle, &args, 80)) {
+                printf("Error: Could not create benchmark thread\n");
+                return -1;
+            }
+            pthread_join(thread, NULL);
+
+            char label[48];
+            snprintf(label, sizeof(label), "%d us %s", c, wait_strategy_names[run.strategy]);
+            if (run.strategy == WAIT_HYBRID) {
+                snprintf(label + strlen(label), sizeof(label) - strlen(label), " %d", run.spin_us);
+            }
+            args.wakeup.print(stdout, label);
+            printf("  %-16s CPU %5.1f %%\n", "", 100.0 * args.cpu_ns / (args.cycles * args.cycletime));
+        }
+    }
+    return 0;
+}
+
+// Cycle thread for the logging benchmark: one status line every 10 cycles, either printed
+// directly (the old ecatthread behaviour) or queued for a drain thread
+struct LogBenchArgs {
+    int cycles;
+    int64 cycletime;
+    bool deferred;     // true: rt_log + drain thread, false: fprintf from the cycle thread
+    FILE *sink;        // Line-buffered output, so every line is a write() like on a terminal
+    BenchStats latency; // Deadline to end of cycle work
+};
+
+void *log_bench_cycle(void *ptr) {
+    LogBenchArgs *args = (LogBenchArgs *)ptr;
+    struct timespec ts, done;
+    txpdo_t status;
+    memset(&status, 0, sizeof(status));
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < args->cycles; i++) {
+        add_timespec(&ts, args->cycletime);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        status.actual_position = i;
+        if (i % 10 == 0) {
+            if (args->deferred) {
+                rt_log(RTLOG_STATUS, i, 3, &status, i + 20, 0, 0);
+            } else {
+                fprintf(args->sink, "Status: pos=%d, target=%d, vel=%d, torque=%d\n",
+                        status.actual_position, i + 20, status.actual_velocity, status.actual_torque);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        args->latency.add(timespec_diff_ns(&ts, &done));
+    }
+    return NULL;
+}
+
+void *log_bench_drain(void *ptr) {
+    FILE *sink = (FILE *)ptr;
+    while (!bench_stop.load(std::memory_order_relaxed)) {
+        drain_rt_log(sink);
+        usleep(2000);
+    }
+    drain_rt_log(sink);
+    return NULL;
+}
+
+// Compare worst-case cycle latency with printf in the cycle against the deferred logger
+int bench_rtlog() {
+    const int cycles = 20000;
+    const char *labels[2] = {"printf in cycle", "deferred rt_log"};
+
+    FILE *sink = fopen("/dev/null", "w");
+    if (!sink) {
+        perror("fopen /dev/null");
+        return -1;
+    }
+    setvbuf(sink, NULL, _IOLBF, 0);
+
+    printf("RT log benchmark: %d cycles of %d us, one record every 10 cycles\n", cycles, ctime_thread);
+    for (int deferred = 0; deferred <= 1; deferred++) {
+        LogBenchArgs args;
+        args.cycles = cycles;
+        args.cycletime = (int64)ctime_thread * 1000;
+        args.deferred = deferred;
+        args.sink = sink;
+
+        pthread_t cycle_thread, drain;
+        bench_stop = false;
+        if (deferred) {
+            create_bench_thread(&drain, log_bench_drain, sink, 0);
+        }
+        if (!create_bench_thread(&cycle_thread, log_bench_cycle, &args, 80)) {
+            printf("Error: Could not create benchmark thread\n");
+            fclose(sink);
+            return -1;
+        }
+        pthread_join(cycle_thread, NULL);
+        bench_stop = true;
+        if (deferred) {
+            pthread_join(drain, NULL);
+        }
+
+        printf("%s:\n", labels[deferred]);
+        args.latency.print("deadline to cycle end");
+    }
+    fclose(sink);
+    return 0;
+}
+
+// Command the loopback transport pushes into the setpoint ring when it receives frame `cycle`
+struct LoopbackCommand {
+    uint32_t cycle;
+    SetpointCmd cmd;
+};
+
+// 64-bit FNV-1a
+uint64 fnv1a_64(uint64 hash, const void *data, size_t size) {
+    const uint8 *bytes = (const uint8 *)data;
+    for (size_t k = 0; k < size; k++) {
+        hash ^= bytes[k];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// A simulated drive (erob_sim.h) holding this program's PDO mapping, in OP as after erob_test.
+// Returns false if its object dictionary cannot map rxpdo_t/txpdo_t.
+bool loopback_drive_init(SimSlave *drive, int slave) {
+    sim_slave_reset(drive, slave);
+    sim_set(drive, 0x1600, 0x00, pdo_entry_count(rxpdo_mapping));
+    for (int k = 0; k < pdo_entry_count(rxpdo_mapping); k++) {
+        sim_set(drive, 0x1600, (uint8)(k + 1), rxpdo_mapping[k]);
+    }
+    sim_set(drive, 0x1A00, 0x00, pdo_entry_count(txpdo_mapping));
+    for (int k = 0; k < pdo_entry_count(txpdo_mapping); k++) {
+        sim_set(drive, 0x1A00, (uint8)(k + 1), txpdo_mapping[k]);
+    }
+    drive->obytes = sim_resolve_pdo(drive, 0x1C12, drive->rx, &drive->rx_count);
+    drive->ibytes = sim_resolve_pdo(drive, 0x1C13, drive->tx, &drive->tx_count);
+    drive->mapped = drive->obytes == (int)sizeof(rxpdo_t) && drive->ibytes == (int)sizeof(txpdo_t);
+    drive->al_state = EC_STATE_OPERATIONAL;
+    return drive->mapped;
+}
+
+// In-memory transport for ecat_loop: every axis is a simulated drive (erob_sim.h model) stepped by
+// one cycle time per frame, so a run depends only on the command script. With free_run the cycles
+// run back to back without sleeping, which measures the pure CPU cost of a cycle.
+struct LoopbackTransport {
+    SimSlave drive[MAX_AXES];     // Drive side of the wire; only this thread touches them
+    rxpdo_t wire[MAX_AXES];       // Outputs of the frame in flight
+    rxpdo_t out[MAX_AXES];        // Master side process image (what IOmap holds with SOEM)
+    txpdo_t in[MAX_AXES];
+    int count;
+    uint32_t cycles;              // Frames to exchange before running() ends the loop
+    uint32_t cycle;               // Frames exchanged so far
+    bool free_run;
+    bool pending;                 // A frame was sent and not received yet
+    const LoopbackCommand *script;
+    int script_length;
+    int next;                     // Next script entry
+    uint64 trace;                 // FNV-1a over every output image the master sent
+
+    // Point the axes at the loopback process image (instead of axes_init on IOmap)
+    void attach(AxisArray *axes, int n, uint32_t frames, const LoopbackCommand *commands, int length) {
+        memset(this, 0, sizeof(*this));
+        count = n;
+        cycles = frames;
+        free_run = true;
+        script = commands;
+        script_length = length;
+        trace = 0xCBF29CE484222325ULL;
+        memset(axes, 0, sizeof(*axes));
+        axes->count = n;
+        for (int a = 0; a < n; a++) {
+            if (!loopback_drive_init(&drive[a], a + 1)) {
+                printf("Loopback: drive %d cannot map the process image\n", a + 1);
+            }
+            axes->slave[a] = a + 1;
+            axes->in[a] = &in[a];
+            axes->out[a] = &out[a];
+            axes->controlword[a] = 0x0080;
+            planner_reset(&g_motion_planner[a], 0);
+        }
+    }
+
+    bool running() const { return cycle < cycles; }
+
+    int wait(struct timespec *ts) {
+        if (free_run) {
+            clock_gettime(CLOCK_MONOTONIC, ts); // The deadline is always now
+            return 0;
+        }
+        return cycle_wait(ts, WAIT_SLEEP, 0);
+    }
+
+    // The drives apply the outputs of the frame, run for one cycle and return their inputs
+    int receive() {
+        if (!pending) {
+            return -1;
+        }
+        pending = false;
+        for (int a = 0; a < count; a++) {
+            SimSlave *s = &drive[a];
+            sim_unpack(s->rx, s->rx_count, (const uint8 *)&wire[a]);
+            sim_drive_step(s, MotionPlanner::CYCLE_TIME);
+            sim_pack(s->tx, s->tx_count, (uint8 *)&in[a]);
+        }
+        cycle++;
+        // A full ring keeps the command for the next frame, so runs stay reproducible
+        while (next < script_length && script[next].cycle <= cycle && g_setpoint_ring.push(script[next].cmd)) {
+            next++;
+        }
+        return 3 * count; // Outputs written (2) and inputs read (1) by every slave
+    }
+
+    void send() {
+        memcpy(wire, out, count * sizeof(rxpdo_t));
+        trace = fnv1a_64(trace, out, count * sizeof(rxpdo_t));
+        pending = true;
+    }
+
+    bool dc_time(int64 *reftime) {
+        *reftime = 0;
+        return false;
+    }
+};
+
+// Per-cycle compute time (read inputs, state machines, write outputs) against axis count
+int bench_axes() {
+    const int warmup_cycles = 2000;
+    const int cycles = 50000;
+    static LoopbackTransport transport;
+    static AxisArray axes;
+    struct timespec t0, t1;
+
+    printf("Axis benchmark: %d cycles per axis count, simulated drives on the loopback transport\n", cycles);
+    for (int n = 1; n <= MAX_AXES; n *= 2) {
+        transport.attach(&axes, n, 0, NULL, 0);
+
+        BenchStats stats;
+        for (int i = 0; i < warmup_cycles + cycles; i++) {
+            transport.send();
+            transport.receive();
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            axes_read_inputs(&axes);
+            axes_update(&axes, true);
+            axes_write_outputs(&axes);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (i >= warmup_cycles) {
+                stats.add(timespec_diff_ns(&t0, &t1));
+            }
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "%2d axes", n);
+        stats.print(label);
+        printf("  %-28s %8.1f ns per axis (avg)\n", "", stats.sum_ns / stats.count / n);
+    }
+    return 0;
+}
+
+// Per-cycle CPU cost of the full ecatthread loop (ecat_loop) on the loopback transport, free
+// running, and a replay check: the same script must produce the same output stream twice
+int bench_cycle() {
+    const uint32_t cycles = 40000;
+    static LoopbackTransport transport;
+    static LoopbackCommand script[4 * MAX_AXES];
+    static const struct { uint32_t cycle; uint8_t mode; int32_t value; } steps[] = {
+        {2000, MODE_CSP, 100000}, {12000, MODE_CSV, -20000}, {20000, MODE_CST, 50}, {28000, MODE_CSP, 0}
+    };
+    struct timespec t0, t1;
+
+    printf("Cycle benchmark: %u free-running cycles of ecat_loop on the loopback transport\n", cycles);
+    start_ecatthread_thread = TRUE;
+    for (int n = 1; n <= MAX_AXES; n *= 4) {
+        int length = 0;
+        for (const auto &step : steps) {
+            for (int a = 0; a < n; a++) {
+                script[length].cycle = step.cycle;
+                script[length].cmd.axis = (uint16_t)a;
+                script[length].cmd.kind = CMD_SETPOINT;
+                script[length].cmd.mode = step.mode;
+                script[length].cmd.value = step.value;
+                length++;
+            }
+        }
+
+        uint64 traces[2];
+        double ns_per_cycle = 0.0;
+        for (int run = 0; run < 2; run++) {
+            transport.attach(&g_axes, n, cycles, script, length);
+            expectedWKC = 3 * n;
+            for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+                g_latency[i].reset();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            ecat_loop(transport, (int64)ctime_thread * 1000, INT64_MAX / 4); // Never shed: replay must match
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            traces[run] = transport.trace;
+            ns_per_cycle = (double)timespec_diff_ns(&t0, &t1) / cycles;
+        }
+
+        printf("%2d axes: %8.2f us per cycle (%.0f cycles/s), trace %016llx, replay %s\n", n,
+               ns_per_cycle / 1000.0, 1e9 / ns_per_cycle, (unsigned long long)traces[1],
+               traces[0] == traces[1] ? "identical" : "DIFFERENT");
+        for (int i = LAT_RECEIVE; i < LAT_STAGE_COUNT; i++) {
+            g_latency[i].print(stdout, latency_stage_names[i]);
+        }
+        if (traces[0] != traces[1]) {
+            start_ecatthread_thread = FALSE;
+            return -1;
+        }
+    }
+    start_ecatthread_thread = FALSE;
+    return 0;
+}
+
+// Trajectory benchmark: evaluation cost per axis per cycle, plus an offline continuity check of
+// position, velocity and acceleration across moves and mid-move retargets
+int bench_trajectory() {
+    const int cycles = 20000;
+    const double dt = MotionPlanner::CYCLE_TIME;
+    const double vmax = MotionPlanner::MAX_VELOCITY;
+    const double amax = MotionPlanner::MAX_ACCELERATION;
+    static MotionPlanner planners[MAX_AXES];
+    struct timespec t0, t1;
+    uint32_t seed = 12345;
+
+    // Cost: every axis gets a new random target every 1500 cycles, staggered so that some
+    // cycles include a replan and most only evaluate
+    for (int a = 0; a < MAX_AXES; a++) {
+        planner_reset(&planners[a], 0);
+    }
+    BenchStats per_cycle;
+    for (int i = 0; i < cycles; i++) {
+        for (int a = 0; a < MAX_AXES; a++) {
+            if ((i + a * 23) % 1500 == 0) {
+                seed = seed * 1664525u + 1013904223u;
+                planners[a].target_position = (int32_t)(seed % 200000) - 100000;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int a = 0; a < MAX_AXES; a++) {
+            plan_trajectory(&planners[a], 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        per_cycle.add(timespec_diff_ns(&t0, &t1));
+    }
+    printf("Trajectory benchmark: %d axes, %d cycles\n", MAX_AXES, cycles);
+    per_cycle.print("all axes per cycle");
+    printf("  %-28s %8.1f ns avg, %8.1f ns worst cycle\n", "per axis",
+           per_cycle.sum_ns / per_cycle.count / MAX_AXES, (double)per_cycle.max_ns / MAX_AXES);
+
+    // Continuity: one move with two retargets, one of them reversing direction mid-move
+    MotionPlanner planner;
+    planner_reset(&planner, 0);
+    planner.target_position = 100000;
+    double prev_p = 0.0, prev_v = 0.0, prev_a = 0.0;
+    double max_v = 0.0, max_a = 0.0, max_dp = 0.0, max_dv = 0.0, max_da = 0.0;
+    int i;
+    for (i = 1; i < 200000 && (planner.is_moving || i < 10); i++) {
+        if (i == 1500) planner.target_position = -50000; // Reverse while still accelerating
+        if (i == 4000) planner.target_position = 30000;  // Retarget while moving
+        plan_trajectory(&planner, 0);
+        double p = planner.planned_position, v = planner.current_velocity, a = planner.current_acceleration;
+        max_v = fmax(max_v, fabs(v));
+        max_a = fmax(max_a, fabs(a));
+        max_dp = fmax(max_dp, fabs(p - prev_p));
+        max_dv = fmax(max_dv, fabs(v - prev_v));
+        max_da = fmax(max_da, fabs(a - prev_a));
+        prev_p = p; prev_v = v; prev_a = a;
+    }
+
+    // Position steps are bounded by the velocity, velocity steps by the acceleration, and an
+    // acceleration step larger than a small fraction of the limit means a discontinuity
+    bool ok = true;
+    ok &= max_v <= vmax * 1.02;
+    ok &= max_a <= amax * 1.02;
+    ok &= max_dp <= vmax * 1.02 * dt;
+    ok &= max_dv <= amax * 1.02 * dt;
+    ok &= max_da <= amax * 0.05;
+    ok &= planner.current_position == 30000 && !planner.is_moving;
+    printf("Continuity check (%d cycles, final position %d):\n", i, planner.current_position);
+    printf("  peak velocity      %10.1f counts/s   (limit %.1f)\n", max_v, vmax);
+    printf("  peak acceleration  %10.1f counts/s^2 (limit %.1f)\n", max_a, amax);
+    printf("  max position step  %10.3f counts     (bound %.3f)\n", max_dp, vmax * 1.02 * dt);
+    printf("  max velocity step  %10.3f counts/s   (bound %.3f)\n", max_dv, amax * 1.02 * dt);
+    printf("  max accel step     %10.3f counts/s^2 (bound %.3f)\n", max_da, amax * 0.05);
+    printf("  result: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : -1;
+}
+
+// Scalar vs SIMD throughput of the batched trajectory kernel
+int bench_simd() {
+    const int repeats = 200000;
+    static TrajectoryBatch batch;
+    static double ref_pos[MAX_AXES], ref_vel[MAX_AXES], ref_acc[MAX_AXES];
+    struct timespec t0, t1;
+    uint32_t seed = 4242;
+
+    for (int a = 0; a < MAX_AXES; a++) {
+        double *coef[7] = {batch.a0, batch.a1, batch.a2, batch.a3, batch.a4, batch.a5, batch.t};
+        for (int k = 0; k < 7; k++) {
+            seed = seed * 1664525u + 1013904223u;
+            coef[k][a] = (double)(seed % 20001) / 10000.0 - 1.0;
+        }
+    }
+
+    printf("Trajectory kernel benchmark (%s build), %d evaluations per axis count\n", TRAJECTORY_KERNEL, repeats);
+    for (int n = 8; n <= MAX_AXES; n *= 2) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int r = 0; r < repeats; r++) {
+            trajectory_eval_scalar(&batch, 0, n);
+            __asm__ __volatile__("" : : "r"(batch.pos) : "memory"); // Keep the loop from being folded
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double scalar_ns = (double)timespec_diff_ns(&t0, &t1) / repeats;
+        memcpy(ref_pos, batch.pos, sizeof(ref_pos));
+        memcpy(ref_vel, batch.vel, sizeof(ref_vel));
+        memcpy(ref_acc, batch.acc, sizeof(ref_acc));
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int r = 0; r < repeats; r++) {
+            trajectory_eval_batch(&batch, n);
+            __asm__ __volatile__("" : : "r"(batch.pos) : "memory");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double batch_ns = (double)timespec_diff_ns(&t0, &t1) / repeats;
+
+        double max_diff = 0.0;
+        for (int a = 0; a < n; a++) {
+            max_diff = fmax(max_diff, fabs(batch.pos[a] - ref_pos[a]));
+            max_diff = fmax(max_diff, fabs(batch.vel[a] - ref_vel[a]));
+            max_diff = fmax(max_diff, fabs(batch.acc[a] - ref_acc[a]));
+        }
+        printf("  %2d axes: scalar %8.1f ns (%5.2f ns/axis)  %s %8.1f ns (%5.2f ns/axis)  speedup %.2fx  max diff %.2e\n",
+               n, scalar_ns, scalar_ns / n, TRAJECTORY_KERNEL, batch_ns, batch_ns / n,
+               scalar_ns / batch_ns, max_diff);
+    }
+
+    // Full per-cycle cost (bookkeeping + batch evaluation) with every axis moving
+    static MotionPlanner planners[MAX_AXES];
+    static int32_t actual[MAX_AXES];
+    static TrajectoryBatch step_batch;
+    BenchStats per_cycle;
+    for (int a = 0; a < MAX_AXES; a++) {
+        planner_reset(&planners[a], 0);
+        planners[a].target_position = 100000 + 1000 * a;
+    }
+    for (int i = 0; i < 20000; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        trajectory_step_all(planners, actual, MAX_AXES, &step_batch, 1);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        per_cycle.add(timespec_diff_ns(&t0, &t1));
+    }
+    printf("Per-cycle trajectory step, %d moving axes:\n", MAX_AXES);
+    per_cycle.print("trajectory_step_all");
+    return 0;
+}
+
+// Online jerk-limited generator: bounded per-axis compute time and limit compliance
+int bench_otg() {
+    const int cycles = 20000;
+    const double dt = MotionPlanner::CYCLE_TIME;
+    const double vmax = MotionPlanner::MAX_VELOCITY;
+    const double amax = MotionPlanner::MAX_ACCELERATION;
+    const double jmax = MotionPlanner::MAX_JERK;
+    static MotionPlanner planners[MAX_AXES];
+    struct timespec t0, t1;
+    uint32_t seed = 777;
+
+    // Cost: asynchronous random setpoints, each call timed on its own for the worst case
+    for (int a = 0; a < MAX_AXES; a++) {
+        planners[a].mode = PLANNER_ONLINE;
+        planner_reset(&planners[a], 0);
+    }
+    BenchStats per_call;
+    for (int i = 0; i < cycles; i++) {
+        for (int a = 0; a < MAX_AXES; a++) {
+            seed = seed * 1664525u + 1013904223u;
+            if (seed % 400 == 0) {
+                planners[a].target_position = (int32_t)(seed % 200000) - 100000;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            plan_trajectory(&planners[a], 0);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            per_call.add(timespec_diff_ns(&t0, &t1));
+        }
+    }
+    printf("Online trajectory benchmark: %d axes, %d cycles, random asynchronous setpoints\n", MAX_AXES, cycles);
+    per_call.print("per axis per cycle");
+
+    // Limits: same move as the quintic continuity check, setpoints changed mid-move
+    MotionPlanner planner;
+    planner.mode = PLANNER_ONLINE;
+    planner_reset(&planner, 0);
+    planner.target_position = 100000;
+    double prev_a = 0.0, max_v = 0.0, max_a = 0.0, max_j = 0.0;
+    int i;
+    for (i = 1; i < 200000 && (planner.is_moving || i < 4001); i++) {
+        if (i == 1500) planner.target_position = -50000;
+        if (i == 4000) planner.target_position = 30000;
+        plan_trajectory(&planner, 0);
+        max_v = fmax(max_v, fabs(planner.current_velocity));
+        max_a = fmax(max_a, fabs(planner.current_acceleration));
+        if (planner.is_moving) {
+            max_j = fmax(max_j, fabs(planner.current_acceleration - prev_a) / dt);
+        }
+        prev_a = planner.current_acceleration;
+    }
+
+    // Settling time of short moves, compared with the ideal jerk-limited time (2*(4d/J)^(1/3))
+    printf("Short moves:\n");
+    for (int d = 1; d <= 1000; d *= 10) {
+        MotionPlanner small;
+        small.mode = PLANNER_ONLINE;
+        planner_reset(&small, 0);
+        small.target_position = d;
+        int n = 0;
+        do {
+            plan_trajectory(&small, 0);
+            n++;
+        } while (small.is_moving && n < 100000);
+        printf("  %5d counts: settled in %5d cycles (ideal %5.0f)\n", d, n, 2.0 * cbrt(4.0 * d / jmax) / dt);
+    }
+
+    bool ok = max_v <= vmax * 1.001 && max_a <= amax * 1.0001 && max_j <= jmax * 1.0001 &&
+              planner.current_position == 30000 && !planner.is_moving;
+    printf("Limit check (%d cycles, final position %d):\n", i, planner.current_position);
+    printf("  peak velocity      %10.1f counts/s   (limit %.1f)\n", max_v, vmax);
+    printf("  peak acceleration  %10.1f counts/s^2 (limit %.1f)\n", max_a, amax);
+    printf("  peak jerk          %10.1f counts/s^3 (limit %.1f)\n", max_j, jmax);
+    printf("  result: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : -1;
+}
+
+// Simulated slave mailbox for the SDO benchmark. Each transfer occupies the shared wire for the
+// request and response frames, then waits for the slave firmware to service the mailbox. The
+// transfer itself goes to the object dictionary of a simulated drive (erob_sim.h), so the resulting
+// configuration can be checked. Every drive is only accessed by the worker of its slave.
+#define SIM_SDO_WIRE_US 40        // Request + response frames on the shared link
+#define SIM_SDO_SERVICE_US 1000   // Slave mailbox processing and master polling delay
+
+pthread_mutex_t sim_sdo_wire = PTHREAD_MUTEX_INITIALIZER;
+std::atomic<int> sim_sdo_writes(0);
+bool sim_sdo_accept_ca = true;         // Simulated slaves support CA
+SimSlave sim_sdo_slaves[EC_MAXSLAVE];
+
+// Power on the first `count` drives: default object dictionary, in PRE-OP where the mapping is writable
+void sim_sdo_power_on(int count) {
+    for (int slave = 1; slave <= count; slave++) {
+        sim_slave_reset(&sim_sdo_slaves[slave], slave);
+        sim_sdo_slaves[slave].al_state = EC_STATE_PRE_OP;
+    }
+}
+
+static void sim_sdo_transfer() {
+    pthread_mutex_lock(&sim_sdo_wire);
+    osal_usleep(SIM_SDO_WIRE_US);
+    pthread_mutex_unlock(&sim_sdo_wire);
+    osal_usleep(SIM_SDO_SERVICE_US);
+}
+
+int sim_sdo_write(uint16 slave, uint16 index, uint8 subindex, boolean ca, int size,
+                  const void *data, int timeout) {
+    (void)timeout;
+    sim_sdo_transfer();
+    sim_sdo_writes.fetch_add(1, std::memory_order_relaxed);
+    if (slave < 1 || slave >= EC_MAXSLAVE || (ca && !sim_sdo_accept_ca)) {
+        return 0; // SDO abort
+    }
+    return sim_sdo_download(&sim_sdo_slaves[slave], index, subindex, ca, size, data);
+}
+
+// Simulated per-subindex reads of the PDO mapping/assignment objects
+int sim_sdo_read(uint16 slave, uint16 index, uint8 subindex, boolean ca, int *size, void *data,
+                 int timeout) {
+    (void)timeout;
+    sim_sdo_transfer();
+    if (ca || slave < 1 || slave >= EC_MAXSLAVE) {
+        return 0;
+    }
+    return sim_sdo_upload(&sim_sdo_slaves[slave], index, subindex, size, data);
+}
+
+// True if the object holds exactly `count` entries equal to `entries`
+static bool sim_sdo_object_is(SimSlave *drive, uint16 index, const uint32 *entries, int count) {
+    if (sim_get(drive, index, 0x00) != (uint32)count) {
+        return false;
+    }
+    for (int e = 0; e < count; e++) {
+        if (sim_get(drive, index, (uint8)(e + 1)) != entries[e]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True if every simulated slave holds the mapping of build_pdo_mapping_plan()
+bool sim_sdo_check(int count) {
+    static const uint32 rxpdo_assign[] = {0x1600};
+    static const uint32 txpdo_assign[] = {0x1A00};
+    for (int slave = 1; slave <= count; slave++) {
+        SimSlave *drive = &sim_sdo_slaves[slave];
+        if (!sim_sdo_object_is(drive, 0x1600, rxpdo_mapping, pdo_entry_count(rxpdo_mapping)) ||
+            !sim_sdo_object_is(drive, 0x1C12, rxpdo_assign, 1) ||
+            !sim_sdo_object_is(drive, 0x1A00, txpdo_mapping, pdo_entry_count(txpdo_mapping)) ||
+            !sim_sdo_object_is(drive, 0x1C13, txpdo_assign, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// PDO mapping bring-up against simulated slaves: sequential vs parallel, per-subindex writes vs
+// Complete Access, and CA rejected by the slave (fallback)
+int bench_sdo() {
+    static SdoPlan plan;
+    static SdoJob jobs[EC_MAXSLAVE];
+    const int slave_counts[] = {1, 2, 6, 12, 24};
+    // Columns: parallel, use CA, slave accepts CA
+    const bool variants[4][3] = {
+        {false, false, true}, {true, false, true}, {true, true, true}, {true, true, false}};
+    build_pdo_mapping_plan(&plan);
+
+    printf("SDO configuration benchmark: %d us wire + %d us service per SDO transfer\n",
+           SIM_SDO_WIRE_US, SIM_SDO_SERVICE_US);
+    printf("  %6s  %12s  %12s  %12s  %12s\n", "slaves", "seq sub ms", "par sub ms", "par CA ms",
+           "CA reject ms");
+
+    bool ok = true;
+    int transfers[4] = {0, 0, 0, 0};
+    for (size_t n = 0; n < sizeof(slave_counts) / sizeof(slave_counts[0]); n++) {
+        int count = slave_counts[n];
+        double elapsed_ms[4];
+        for (int v = 0; v < 4; v++) {
+            for (int k = 0; k < count; k++) {
+                jobs[k].slave = k + 1;
+                jobs[k].plan = &plan;
+                jobs[k].write = sim_sdo_write;
+                jobs[k].read = sim_sdo_read;
+                jobs[k].verify = false;
+                jobs[k].complete_access = variants[v][1];
+            }
+            sim_sdo_accept_ca = variants[v][2];
+            sim_sdo_power_on(count);
+            sim_sdo_writes.store(0);
+            struct timespec t_start, t_end;
+            clock_gettime(CLOCK_MONOTONIC, &t_start);
+            int failed = sdo_config_run(jobs, count, variants[v][0]);
+            clock_gettime(CLOCK_MONOTONIC, &t_end);
+            elapsed_ms[v] = timespec_diff_ns(&t_start, &t_end) / 1e6;
+            transfers[v] = jobs[0].transfers;
+            if (failed != 0 || !sim_sdo_check(count)) {
+                ok = false;
+            }
+        }
+        printf("  %6d  %12.1f  %12.1f  %12.1f  %12.1f\n", count, elapsed_ms[0], elapsed_ms[1],
+               elapsed_ms[2], elapsed_ms[3]);
+    }
+    printf("  transfers per slave: per subindex %d, complete access %d, CA rejected %d\n",
+           transfers[1], transfers[2], transfers[3]);
+
+    // Readback on slaves without CA: cold start, warm restart, restart after another tool remapped
+    // two entries of the same size (must be written again), and restart after a drive power cycle
+    const int verify_slaves = 12;
+    const char *phases[4] = {"cold start", "warm restart", "remapped, same size", "after power cycle"};
+    int swap_a = -1, swap_b = -1; // Two RXPDO entries of the same bit length
+    for (int i = 0; i < pdo_entry_count(rxpdo_mapping) && swap_a < 0; i++) {
+        for (int j = i + 1; j < pdo_entry_count(rxpdo_mapping); j++) {
+            if ((rxpdo_mapping[i] & 0xFF) == (rxpdo_mapping[j] & 0xFF)) {
+                swap_a = i;
+                swap_b = j;
+                break;
+            }
+        }
+    }
+    sim_sdo_power_on(verify_slaves);
+    sim_sdo_accept_ca = false;
+    printf("Readback, %d slaves without CA (RXPDO entries %d and %d swapped by another tool), "
+           "%d transfers to write:\n", verify_slaves, swap_a + 1, swap_b + 1, transfers[1]);
+    for (int phase = 0; phase < 4; phase++) {
+        if (phase == 2) {
+            for (int slave = 1; slave <= verify_slaves && swap_a >= 0; slave++) {
+                SimSlave *drive = &sim_sdo_slaves[slave];
+                uint32 entry = sim_get(drive, 0x1600, (uint8)(swap_a + 1));
+                sim_set(drive, 0x1600, (uint8)(swap_a + 1), sim_get(drive, 0x1600, (uint8)(swap_b + 1)));
+                sim_set(drive, 0x1600, (uint8)(swap_b + 1), entry);
+            }
+        }
+        if (phase == 3) {
+            sim_sdo_power_on(verify_slaves); // Power cycle
+        }
+        for (int k = 0; k < verify_slaves; k++) {
+            jobs[k].slave = k + 1;
+            jobs[k].plan = &plan;
+            jobs[k].write = sim_sdo_write;
+            jobs[k].read = sim_sdo_read;
+            jobs[k].verify = true;
+            jobs[k].complete_access = false;
+        }
+        struct timespec t_start, t_end;
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+        int failed = sdo_config_run(jobs, verify_slaves, true);
+        clock_gettime(CLOCK_MONOTONIC, &t_end);
+        int unchanged = 0;
+        for (int k = 0; k < verify_slaves; k++) {
+            unchanged += jobs[k].unchanged ? 1 : 0;
+        }
+        printf("  %-20s %2d/%d unchanged, %2d transfers per slave, %6.1f ms\n", phases[phase], unchanged,
+               verify_slaves, jobs[0].transfers, timespec_diff_ns(&t_start, &t_end) / 1e6);
+        bool expect_unchanged = phase == 1;
+        if (failed != 0 || !sim_sdo_check(verify_slaves) ||
+            unchanged != (expect_unchanged ? verify_slaves : 0) ||
+            (expect_unchanged && jobs[0].transfers >= transfers[1])) {
+            ok = false;
+        }
+    }
+    printf("  result: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : -1;
+}
+
+// CSP/CSV/CST switching on the simulated drive of the loopback transport, which runs a new 0x6060
+// from the frame after the command cycle: the drive must stay enabled, the new mode must be
+// written in the cycle the command arrives, and the velocity must be continuous across every switch.
+// Velocity is averaged over MODE_BENCH_WINDOW cycles before and after the switch, which keeps the
+// integer position quantization out of the result.
+#define MODE_BENCH_WINDOW 8
+#define MODE_BENCH_MAX_STEP 1500.0 // Allowed velocity step across a switch (counts/s)
+
+int bench_modes() {
+    struct ModeStep {
+        int cycle;
+        uint8_t mode;
+        int32_t value;
+        const char *label;
+    };
+    const ModeStep steps[] = {
+        {100, MODE_CSP, 20000, "CSP move to 20000"},
+        {800, MODE_CSV, 30000, "CSP -> CSV mid-move, 30000 counts/s"},
+        {2000, MODE_CST, 20, "CSV -> CST, torque 20"},
+        {2800, MODE_CSP, 0, "CST -> CSP while moving, to 0"},
+        {4500, MODE_CST, -15, "CSP -> CST mid-move, torque -15"},
+        {5200, MODE_CSV, 0, "CST -> CSV, stop"},
+        {6500, MODE_CSP, 5000, "CSV -> CSP, to 5000"},
+    };
+    const int step_count = sizeof(steps) / sizeof(steps[0]);
+    const int cycles = 12000;
+    const int w = MODE_BENCH_WINDOW;
+    static double position[12000];
+    static LoopbackTransport transport;
+    static AxisArray axes;
+    const double dt = MotionPlanner::CYCLE_TIME;
+
+    transport.attach(&axes, 1, 0, NULL, 0);
+    axes.mode[0] = MODE_CSP;
+    axes.requested_mode[0] = MODE_CSP;
+
+    printf("Mode switching benchmark: %d cycles, simulated drive on the loopback transport\n", cycles);
+    bool ok = true;
+    bool was_enabled = false;
+    int next_step = 0;
+    for (int i = 0; i < cycles; i++) {
+        transport.send();
+        transport.receive();
+        position[i] = transport.drive[0].position;
+
+        axes_read_inputs(&axes);
+        bool switched = next_step < step_count && i == steps[next_step].cycle;
+        if (switched) {
+            // Same as ecatthread draining the setpoint ring
+            SetpointCmd cmd;
+            cmd.axis = 0;
+            cmd.kind = CMD_SETPOINT;
+            cmd.mode = steps[next_step].mode;
+            cmd.value = steps[next_step].value;
+            axes_apply_command(&axes, cmd);
+        }
+        axes_update(&axes, true);
+        axes_write_outputs(&axes);
+
+        if (switched) {
+            if (transport.out[0].mode_of_operation != steps[next_step].mode) {
+                printf("  cycle %d: mode not written in the command cycle\n", i);
+                ok = false;
+            }
+            next_step++;
+        }
+        bool enabled = axes.state[0] == CIA402_OPERATION_ENABLED;
+        if (was_enabled && !enabled) {
+            printf("  cycle %d: drive left operation enabled\n", i);
+            ok = false;
+        }
+        was_enabled = was_enabled || enabled;
+    }
+
+    printf("  %-40s %12s %12s %10s\n", "switch", "v before", "v after", "step");
+    for (int k = 1; k < step_count; k++) {
+        int c = steps[k].cycle + 1; // First cycle the drive can run the new mode
+        double v_before = (position[c] - position[c - w]) / (w * dt);
+        double v_after = (position[c + w] - position[c]) / (w * dt);
+        double step = fabs(v_after - v_before);
+        bool step_ok = step <= MODE_BENCH_MAX_STEP;
+        ok = ok && step_ok;
+        printf("  %-40s %12.0f %12.0f %10.0f  %s\n", steps[k].label, v_before, v_after, step,
+               step_ok ? "ok" : "BUMP");
+    }
+    printf("  final position %d (target 5000)\n", axes.actual_position[0]);
+    ok = ok && abs(axes.actual_position[0] - 5000) <= 1 && was_enabled;
+    printf("  result: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : -1;
+}
+
+// Loopback transport for bench_server: real cycle timing, runs until bench_stop
+struct ServerBenchTransport : LoopbackTransport {
+    bool running() const { return !bench_stop.load(std::memory_order_relaxed); }
+};
+
+static ServerBenchTransport server_bench_transport;
+
+void *server_bench_cycle(void *ptr) {
+    (void)ptr;
+    ecat_loop(server_bench_transport, (int64)ctime_thread * 1000, INT64_MAX / 4);
+    return NULL;
+}
+
+// Send one setpoint frame of count CSP commands, spread over the axes
+static bool server_bench_send(int sock, uint32_t seq, int count, int axes) {
+    uint8_t frame[SERVER_MAX_FRAME];
+    ServerFrameHeader header = {SERVER_MAGIC_SETPOINT, SERVER_VERSION, (uint8_t)count, seq};
+    memcpy(frame, &header, sizeof(header));
+    for (int i = 0; i < count; i++) {
+        SetpointCmd cmd;
+        cmd.axis = (uint16_t)((seq + i) % axes);
+        cmd.kind = CMD_SETPOINT;
+        cmd.mode = MODE_CSP;
+        cmd.value = (int32_t)(seq % 1000) * 10;
+        memcpy(frame + sizeof(header) + i * sizeof(cmd), &cmd, sizeof(cmd));
+    }
+    return send(sock, frame, sizeof(header) + count * sizeof(SetpointCmd), 0) >= 0;
+}
+
+// Receive telemetry datagrams; with wait_seq != 0 until one acknowledges it (false on timeout),
+// otherwise only what is queued. Counts datagrams with samples, samples and acknowledgements.
+static bool server_bench_receive(int sock, uint32_t wait_seq, long *datagrams, long *samples, long *acks) {
+    static uint8_t buffer[SERVER_MAX_DATAGRAM];
+    for (;;) {
+        ssize_t length = recv(sock, buffer, sizeof(buffer), wait_seq != 0 ? 0 : MSG_DONTWAIT);
+        if (length < (ssize_t)sizeof(ServerTelemetryHeader)) {
+            return wait_seq == 0;
+        }
+        ServerTelemetryHeader header;
+        memcpy(&header, buffer, sizeof(header));
+        if (header.magic != SERVER_MAGIC_TELEMETRY) {
+            continue;
+        }
+        if (header.samples > 0) {
+            (*datagrams)++;
+            *samples += header.samples;
+        } else {
+            (*acks)++;
+        }
+        if (wait_seq != 0 && (int32_t)(header.applied_seq - wait_seq) >= 0) {
+            return true;
+        }
+    }
+}
+
+// Setpoint/telemetry server over UDP loopback against ecat_loop on the loopback transport:
+// setpoint-to-acknowledgement latency one frame at a time, then message throughput when the host
+// sends as fast as it can
+int bench_server() {
+    const int axes = 4;
+    const int latency_frames = 2000;
+    const int commands_per_frame = 16;
+    const int64 throughput_ns = NSEC_PER_SEC;
+    static LatencyHistogram latency;
+    bool ok = true;
+
+    printf("Server benchmark: UDP loopback, %d axes, %d us cycle, %d telemetry samples per datagram\n",
+           axes, ctime_thread, g_config.server_batch);
+    start_ecatthread_thread = TRUE;
+    bench_stop = false;
+    ecat_stop.store(false);
+    server_bench_transport.attach(&g_axes, axes, 0, NULL, 0);
+    server_bench_transport.free_run = false;
+    expectedWKC = 3 * axes;
+    int port = 0; // Ephemeral
+    pthread_t cycle_thread, server;
+    if (!create_bench_thread(&cycle_thread, server_bench_cycle, NULL, 80) ||
+        !create_bench_thread(&server, start_server, &port, 0)) {
+        printf("Error: Could not create benchmark threads\n");
+        return -1;
+    }
+    for (int i = 0; i < 1000 && g_server_port.load() == 0; i++) {
+        usleep(1000);
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)g_server_port.load());
+    struct timeval timeout = {0, 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (g_server_port.load() == 0 || connect(sock, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        printf("Error: server not reachable\n");
+        ok = false;
+    }
+
+    // Latency: one command per frame, the next one after the acknowledgement
+    long datagrams = 0, samples = 0, acks = 0;
+    int timeouts = 0;
+    latency.reset();
+    for (uint32_t seq = 1; ok && seq <= (uint32_t)latency_frames; seq++) {
+        int64 start = monotonic_ns();
+        if (!server_bench_send(sock, seq, 1, axes) || !server_bench_receive(sock, seq, &datagrams, &samples, &acks)) {
+            timeouts++;
+            continue;
+        }
+        latency.record(monotonic_ns() - start);
+    }
+    printf("latency (%d frames, %d timeouts):\n", latency_frames, timeouts);
+    latency.print(stdout, "setpoint -> ack");
+    ok = ok && timeouts == 0;
+
+    // Throughput: frames of commands_per_frame commands back to back for one second
+    uint32_t frames0 = g_server_stats.frames.load(), commands0 = g_server_stats.commands.load();
+    uint32_t rejected0 = g_server_stats.rejected.load();
+    uint32_t seq = latency_frames;
+    long sent = 0;
+    datagrams = 0;
+    samples = 0;
+    acks = 0;
+    int64 start = monotonic_ns();
+    while (ok && monotonic_ns() - start < throughput_ns) {
+        if (server_bench_send(sock, seq + 1, commands_per_frame, axes)) {
+            seq++;
+            sent++;
+        }
+        server_bench_receive(sock, 0, &datagrams, &samples, &acks);
+    }
+    double seconds = (monotonic_ns() - start) / 1e9;
+    usleep(10 * ctime_thread); // Let the server and the RT loop drain
+    server_bench_receive(sock, 0, &datagrams, &samples, &acks);
+    uint32_t frames = g_server_stats.frames.load() - frames0;
+    uint32_t commands = g_server_stats.commands.load() - commands0;
+    printf("throughput (%d commands per frame):\n", commands_per_frame);
+    printf("  frames sent %10.0f/s, received by the server %10.0f/s (%ld lost in the socket)\n",
+           sent / seconds, frames / seconds, sent - (long)frames);
+    printf("  commands queued %8.0f/s, rejected %u (ring full)\n", commands / seconds,
+           g_server_stats.rejected.load() - rejected0);
+    double per_datagram = datagrams > 0 ? (double)samples / datagrams : 0.0;
+    printf("  telemetry %10.0f datagrams/s, %10.0f samples/s (%.1f per datagram), %6.0f acks/s\n",
+           datagrams / seconds, samples / seconds, per_datagram, acks / seconds);
+    ok = ok && per_datagram >= 0.9 * g_config.server_batch; // A streaming host must not break up the batch
+    printf("  last applied seq %u of %u\n", g_server_applied.load(), seq);
+
+    close(sock);
+    bench_stop = true;
+    ecat_stop.store(true);
+    pthread_join(cycle_thread, NULL);
+    pthread_join(server, NULL);
+    ecat_stop.store(false);
+    start_ecatthread_thread = FALSE;
+    printf("  result: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : -1;
+}
+
+int run_benchmark(const char *name) {
+    if (strcmp(name, "channel") == 0) {
+        return bench_channel();
+    }
+    if (strcmp(name, "rtlog") == 0) {
+        return bench_rtlog();
+    }
+    if (strcmp(name, "axes") == 0) {
+        return bench_axes();
+    }
+    if (strcmp(name, "cycle") == 0) {
+        return bench_cycle();
+    }
+    if (strcmp(name, "wait") == 0) {
+        return bench_wait();
+    }
+    if (strcmp(name, "dcsync") == 0) {
+        return bench_dcsync();
+    }
+    if (strcmp(name, "trajectory") == 0) {
+        return bench_trajectory();
+    }
+    if (strcmp(name, "simd") == 0) {
+        return bench_simd();
+    }
+    if (strcmp(name, "otg") == 0) {
+        return bench_otg();
+    }
+    if (strcmp(name, "sdo") == 0) {
+        return bench_sdo();
+    }
+    if (strcmp(name, "modes") == 0) {
+        return bench_modes();
+    }
+    if (strcmp(name, "server") == 0) {
+        return bench_server();
+    }
+    printf("Unknown benchmark '%s'. Available: channel, rtlog, wait, dcsync, axes, cycle, trajectory, simd, otg, sdo, modes, server\n", name);
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    needlf = FALSE;
+    inOP = FALSE;
+    start_ecatthread_thread = FALSE;
+    dorun = 0;
+    config_apply(&g_config);
+
+    if (argc != 2) {
+        printf("Usage: %s <benchmark>\n", argv[0]);
+        run_benchmark("");
+        return EXIT_FAILURE;
+    }
+    return run_benchmark(argv[1]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+pysoem-style adapter for the erob_rt extension (erob_rt_module.cpp)
+
+The cyclic EtherCAT exchange runs in C++ on its own SCHED_FIFO thread (ecatthread of eRob_CSP.cpp).
+NativeMaster/NativeSlave expose the attributes cyclic_operation_csp() and check_slave_states() use
+(slaves, input, output, state, name, sdo_read, read_state, expected_wkc, ...), and exchange_worker()
+replaces data_exchange_worker(): instead of sending frames it forwards the _thread_* variables to
+the real-time loop through the lock-free setpoint ring and refreshes the input/output copies from
+the telemetry snapshot. A late or paused Python thread only delays the next setpoint; the frames
+keep going out every cycle.
+
+Build the extension first:  python3 setup.py build_ext --inplace
+"""
+
+import time
+
+import erob_rt
+
+INIT_STATE = 0x01
+SAFEOP_STATE = 0x04
+OP_STATE = 0x08
+
+
+def _layout_fields(entries):
+    """[(name, offset, size, signed)] -> {name: (offset, size, signed)}"""
+    return {name: (offset, size, signed) for name, offset, size, signed in entries}
+
+
+class NativeSlave:
+    """One slave as seen by the pysoem examples (position is the 0-based axis index)"""
+
+    def __init__(self, master, position):
+        self._master = master
+        self.position = position
+        self.name = ""
+        self.state = INIT_STATE
+        self.al_status = 0
+        self.input = b""   # Raw TXPDO image from the last telemetry snapshot
+        self.output = b""  # RXPDO image rebuilt from the values the RT loop sent
+
+    def sdo_read(self, index, subindex, size=4):
+        return erob_rt.sdo_read(self.position + 1, index, subindex, size)
+
+    def sdo_write(self, index, subindex, data):
+        erob_rt.sdo_write(self.position + 1, index, subindex, bytes(data))
+
+
+class NativeMaster:
+    """Subset of pysoem.Master backed by erob_rt"""
+
+    native = True
+
+    def __init__(self):
+        self.slaves = []
+        self.state = INIT_STATE
+        self.cycle = 0
+        self.wkc = 0
+        layout = erob_rt.pdo_layout()
+        self._rx = _layout_fields(layout["rx"])
+        self._rx_size = max(offset + size for offset, size, _ in self._rx.values())
+
+    def open(self, ifname, cycle_time_ms=1.0, config=None):
+        """Bring the network to OP (eRob_CSP.cpp STEP 1-9) and start the real-time threads
+
+        config is an optional erob.conf style file for priority, CPUs, SYNC0 shift and axes;
+        ifname and cycle_time_ms take precedence over its values.
+        """
+        in_op = erob_rt.start(ifname, cycle_us=int(cycle_time_ms * 1000), config=config)
+        self.slaves = [NativeSlave(self, i) for i in range(erob_rt.slave_count())]
+        self.read_state()
+        self.refresh()
+        return in_op
+
+    def close(self):
+        erob_rt.stop()
+        self.state = INIT_STATE
+
+    @property
+    def expected_wkc(self):
+        return erob_rt.expected_wkc()
+
+    def read_state(self):
+        group_state, slaves = erob_rt.states()
+        self.state = group_state
+        for slave, (name, state, al_status) in zip(self.slaves, slaves):
+            slave.name = name
+            slave.state = state
+            slave.al_status = al_status
+        return group_state
+
+    def state_check(self, expected_state, timeout=50000):
+        """Poll until all slaves reach expected_state or timeout (us) expires"""
+        deadline = time.time() + timeout / 1e6
+        while self.read_state() != expected_state and time.time() < deadline:
+            time.sleep(0.01)
+        return self.state
+
+    def _pack_output(self, controlword, target_position, mode):
+        data = bytearray(self._rx_size)
+        for name, value in (("controlword", controlword), ("target_position", target_position),
+                            ("mode_of_operation", mode)):
+            if name in self._rx:
+                offset, size, signed = self._rx[name]
+                data[offset:offset + size] = value.to_bytes(size, 'little', signed=signed)
+        return bytes(data)
+
+    def refresh(self):
+        """Copy the latest telemetry snapshot into the slaves' input/output attributes"""
+        self.cycle, self.wkc, axes = erob_rt.telemetry()
+        for slave, (data, controlword, target_position, _, mode) in zip(self.slaves, axes):
+            slave.input = data
+            slave.output = self._pack_output(controlword, target_position, mode)
+
+
+def exchange_worker(master, app):
+    """Replacement for data_exchange_worker() when master is a NativeMaster
+
+    app is the module holding the _thread_* / _data_exchange_* globals (pysoem_csp).
+    Commands are only pushed when a value changes; if the ring is full the value is retried in the
+    next iteration.
+    """
+    sent_controlword = None
+    sent_target = None
+    sent_mode = None
+    cycle_time = app.ETHERCAT_CYCLE_TIME_MS / 1000.0
+
+    while app._data_exchange_running:
+        controlword = app._thread_controlword
+        target = app._thread_target_position
+        mode = app._thread_mode_of_operation
+
+        if controlword != sent_controlword:
+            if all(erob_rt.controlword(i, controlword) for i in range(len(master.slaves))):
+                sent_controlword = controlword
+        if target != sent_target or mode != sent_mode:
+            if all(erob_rt.command(i, mode, target) for i in range(len(master.slaves))):
+                sent_target = target
+                sent_mode = mode
+
+        with app._data_exchange_lock:
+            master.refresh()
+        app._data_exchange_cycle_count += 1
+
+        time.sleep(cycle_time)
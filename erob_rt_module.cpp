@@ -0,0 +1,392 @@
+/*
+ * erob_rt: Python extension running the eRob_CSP.cpp real-time loop.
+ *
+ * The EtherCAT bring-up (STEP 1-9), ecatthread, ecatcheck and the log drain thread are the ones
+ * from eRob_CSP.cpp; ecatthread runs on its own SCHED_FIFO thread and never touches Python.
+ * Python only talks to it through the lock-free channel:
+ *   - command/setpoint/controlword/release push into the setpoint ring (never block)
+ *   - telemetry() copies the latest seqlock snapshot
+ * so a slow or paused interpreter (GIL, garbage collection) cannot make the slaves drop out of OP.
+ * See erob_native.py for the adapter used by pysoem_csp.py.
+ *
+ * Build: python3 setup.py build_ext --inplace   (needs SOEM headers and libsoem)
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h> // Must come before any system header
+
+#define EROB_NO_MAIN
+#include "eRob_CSP.cpp"
+
+static bool erob_running = false; // erob_start succeeded and erob_stop was not called yet
+
+// Convert the ring/queue result into a Python bool
+static PyObject *push_result(bool ok) {
+    if (ok) {
+        Py_RETURN_TRUE;
+    }
+    Py_RETURN_FALSE;
+}
+
+static bool check_axis(int axis) {
+    if (axis < 0 || axis >= MAX_AXES) {
+        PyErr_Format(PyExc_IndexError, "axis %d out of range", axis);
+        return false;
+    }
+    return true;
+}
+
+// start(ifname=None, cycle_us=0, config=None, faults=None) -> bool: True once all slaves are in OP.
+// config is a configuration file (see RuntimeConfig in eRob_CSP.cpp); ifname and a non-zero
+// cycle_us override its values. The merged configuration is validated before the bring-up.
+// faults is a fault script for resilience tests (builds with EROB_FAULT_INJECTION only).
+static PyObject *erob_rt_start(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"ifname", "cycle_us", "config", "faults", NULL};
+    const char *ifname = NULL;
+    const char *config_path = NULL;
+    const char *faults_path = NULL;
+    int cycle_us = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zizz", (char **)keywords, &ifname, &cycle_us,
+                                     &config_path, &faults_path)) {
+        return NULL;
+    }
+    if (erob_running) {
+        PyErr_SetString(PyExc_RuntimeError, "erob_rt is already running");
+        return NULL;
+    }
+
+    RuntimeConfig config = g_config;
+    if (config_path != NULL && config_load(&config, config_path) != 0) {
+        PyErr_Format(PyExc_ValueError, "cannot use configuration %s", config_path);
+        return NULL;
+    }
+    if (ifname != NULL) {
+        if (strlen(ifname) >= sizeof(config.ifname)) {
+            PyErr_SetString(PyExc_ValueError, "ifname is too long");
+            return NULL;
+        }
+        strcpy(config.ifname, ifname);
+    }
+    if (cycle_us != 0) {
+        config.cycle_us = cycle_us;
+        config.sync0_us = 0; // Follow the new cycle time
+    }
+    if (config_validate(&config) != 0) {
+        PyErr_SetString(PyExc_ValueError, "invalid configuration (details on stdout)");
+        return NULL;
+    }
+    if (faults_path != NULL && !fault_load(faults_path)) {
+        PyErr_Format(PyExc_ValueError, "cannot use fault script %s", faults_path);
+        return NULL;
+    }
+    g_config = config;
+    topology_read(&g_topology);
+    topology_plan(&g_config, &g_topology);
+    if (g_config.irq_steer) {
+        topology_steer_nic(g_config.ifname, g_config.cpu_ecat);
+    }
+
+    int result;
+    Py_BEGIN_ALLOW_THREADS
+    // Lock memory to prevent paging (same as main in eRob_CSP.cpp)
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        perror("mlockall failed");
+    }
+    config_apply(&g_config);
+    result = erob_start(g_config.ifname);
+    Py_END_ALLOW_THREADS
+
+    if (result < 0) {
+        PyErr_Format(PyExc_ConnectionError, "EtherCAT bring-up on '%s' failed", g_config.ifname);
+        return NULL;
+    }
+    erob_running = true;
+    return push_result(result == 0);
+}
+
+// stop(): leave OP, join the threads and close the socket
+static PyObject *erob_rt_stop(PyObject *, PyObject *) {
+    if (erob_running) {
+        erob_running = false;
+        Py_BEGIN_ALLOW_THREADS
+        erob_stop();
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+// command(axis, mode, value) -> bool: False if the ring is full or the mode is not 8/9/10
+static PyObject *erob_rt_command(PyObject *, PyObject *args) {
+    int axis, mode;
+    long value;
+    if (!PyArg_ParseTuple(args, "iil", &axis, &mode, &value) || !check_axis(axis)) {
+        return NULL;
+    }
+    return push_result(send_command(axis, (uint8_t)mode, (int32_t)value));
+}
+
+// setpoint(axis, position) -> bool: CSP target position
+static PyObject *erob_rt_setpoint(PyObject *, PyObject *args) {
+    int axis;
+    long position;
+    if (!PyArg_ParseTuple(args, "il", &axis, &position) || !check_axis(axis)) {
+        return NULL;
+    }
+    return push_result(send_setpoint(axis, (int32_t)position));
+}
+
+// controlword(axis, cw) -> bool: drive the CiA402 state machine from Python
+static PyObject *erob_rt_controlword(PyObject *, PyObject *args) {
+    int axis;
+    unsigned int controlword;
+    if (!PyArg_ParseTuple(args, "iI", &axis, &controlword) || !check_axis(axis)) {
+        return NULL;
+    }
+    return push_result(send_controlword(axis, (uint16_t)controlword));
+}
+
+// release(axis) -> bool: hand the controlword back to the built-in state machine
+static PyObject *erob_rt_release(PyObject *, PyObject *args) {
+    int axis;
+    if (!PyArg_ParseTuple(args, "i", &axis) || !check_axis(axis)) {
+        return NULL;
+    }
+    return push_result(release_controlword(axis));
+}
+
+/*
+ * telemetry() -> (cycle, wkc, axes)
+ * axes is a list with one tuple per axis:
+ *   (input, controlword, target_position, cia402_state, mode)
+ * where input is the raw TXPDO image (see pdo_layout()).
+ */
+static PyObject *erob_rt_telemetry(PyObject *, PyObject *) {
+    static TelemetrySnapshot snapshot;
+    snapshot = g_telemetry.load();
+
+    PyObject *axes = PyList_New(snapshot.axis_count);
+    if (axes == NULL) {
+        return NULL;
+    }
+    for (int a = 0; a < snapshot.axis_count; a++) {
+        const AxisTelemetry &t = snapshot.axes[a];
+        PyObject *axis = Py_BuildValue("(y#HiBB)", (const char *)&t.txpdo, (Py_ssize_t)sizeof(txpdo_t),
+                                       t.controlword, t.target_position, t.state, t.mode);
+        if (axis == NULL) {
+            Py_DECREF(axes);
+            return NULL;
+        }
+        PyList_SET_ITEM(axes, a, axis);
+    }
+    return Py_BuildValue("(IiN)", snapshot.cycle, snapshot.wkc, axes);
+}
+
+/*
+ * dc_status() -> dict with the DC synchronisation lock state and offset metrics of the last
+ * telemetry snapshot (see DcSyncStatus)
+ */
+static PyObject *erob_rt_dc_status(PyObject *, PyObject *) {
+    static TelemetrySnapshot snapshot;
+    snapshot = g_telemetry.load();
+    const DcSyncStatus &dc = snapshot.dc;
+    return Py_BuildValue("{s:s,s:i,s:i,s:i,s:d,s:I,s:I,s:I,s:i}",
+                         "state", dc_sync_state_names[dc.state], "delta_ns", dc.delta_ns,
+                         "offset_ns", dc.offset_ns, "correction_ns", dc.correction_ns,
+                         "drift_ppm", (double)dc.drift_ppm, "locked_cycles", dc.locked_cycles,
+                         "time_to_lock", dc.time_to_lock, "locks", dc.locks,
+                         "max_locked_ns", dc.max_locked_ns);
+}
+
+// recovery() -> [dict per slave]: recovery state, count and latencies (ms) of ecatcheck's per-slave recovery
+static PyObject *erob_rt_recovery(PyObject *, PyObject *) {
+    PyObject *slaves = PyList_New(ec_slavecount);
+    if (slaves == NULL) {
+        return NULL;
+    }
+    for (int i = 1; i <= ec_slavecount; i++) {
+        const SlaveRecovery &rec = g_recovery[i];
+        PyObject *slave = Py_BuildValue("{s:s,s:O,s:I,s:I,s:d,s:d}", "state", slave_recovery_names[rec.state],
+                                        "offline", g_slave_offline[i].load() ? Py_True : Py_False,
+                                        "recoveries", rec.recoveries, "retries", rec.retries,
+                                        "last_ms", rec.last_ns / 1e6, "max_ms", rec.max_ns / 1e6);
+        if (slave == NULL) {
+            Py_DECREF(slaves);
+            return NULL;
+        }
+        PyList_SET_ITEM(slaves, i - 1, slave);
+    }
+    return slaves;
+}
+
+// budget() -> dict: send budget (us), late and dropped cycles, and how often each optional stage was shed
+static PyObject *erob_rt_budget(PyObject *, PyObject *) {
+    PyObject *shed = PyDict_New();
+    if (shed == NULL) {
+        return NULL;
+    }
+    for (int s = 0; s < CYCLE_STAGE_COUNT; s++) {
+        PyObject *count = PyLong_FromUnsignedLong(g_budget.shed[s].load());
+        if (count == NULL || PyDict_SetItemString(shed, cycle_stage_names[s], count) != 0) {
+            Py_XDECREF(count);
+            Py_DECREF(shed);
+            return NULL;
+        }
+        Py_DECREF(count);
+    }
+    return Py_BuildValue("{s:d,s:I,s:I,s:N}", "send_us", g_budget.send_ns / 1000.0, "late", g_budget.late.load(),
+                         "dropped", g_budget.dropped.load(), "shed", shed);
+}
+
+// slave_count() -> int
+static PyObject *erob_rt_slave_count(PyObject *, PyObject *) {
+    return PyLong_FromLong(ec_slavecount);
+}
+
+// expected_wkc() -> int
+static PyObject *erob_rt_expected_wkc(PyObject *, PyObject *) {
+    return PyLong_FromLong(expectedWKC);
+}
+
+/*
+ * states(refresh=True) -> (group_state, [(name, state, al_status), ...])
+ * While the slaves are in OP the states are ecatcheck's last snapshot and refresh is ignored: only
+ * ecatcheck addresses the bus then. Otherwise refresh reads the AL state of all slaves from the
+ * network first (ec_readstate).
+ */
+static PyObject *erob_rt_states(PyObject *, PyObject *args) {
+    int refresh = 1;
+    if (!PyArg_ParseTuple(args, "|p", &refresh)) {
+        return NULL;
+    }
+    SlaveStates states;
+    Py_BEGIN_ALLOW_THREADS
+    if (inOP) {
+        states = g_slave_states.load();
+    } else {
+        if (refresh) {
+            ec_readstate();
+        }
+        slave_states_capture(&states);
+    }
+    Py_END_ALLOW_THREADS
+    PyObject *slaves = PyList_New(states.count);
+    if (slaves == NULL) {
+        return NULL;
+    }
+    for (int i = 1; i <= states.count; i++) {
+        PyObject *slave = Py_BuildValue("(sHH)", ec_slave[i].name, states.state[i], states.al_status[i]);
+        if (slave == NULL) {
+            Py_DECREF(slaves);
+            return NULL;
+        }
+        PyList_SET_ITEM(slaves, i - 1, slave);
+    }
+    return Py_BuildValue("(HN)", states.group_state, slaves);
+}
+
+// sdo_read(slave, index, subindex, size) -> bytes (slave is 1-based, as in SOEM)
+static PyObject *erob_rt_sdo_read(PyObject *, PyObject *args) {
+    int slave, index, subindex, size;
+    if (!PyArg_ParseTuple(args, "iiii", &slave, &index, &subindex, &size)) {
+        return NULL;
+    }
+    if (slave < 1 || slave > ec_slavecount || size <= 0 || size > 512) {
+        PyErr_SetString(PyExc_ValueError, "invalid slave or size");
+        return NULL;
+    }
+    uint8 buffer[512];
+    int wkc;
+    Py_BEGIN_ALLOW_THREADS
+    wkc = ec_SDOread((uint16)slave, (uint16)index, (uint8)subindex, FALSE, &size, buffer, EC_TIMEOUTRXM);
+    Py_END_ALLOW_THREADS
+    if (wkc <= 0) {
+        PyErr_Format(PyExc_IOError, "SDO read 0x%04X:%02X from slave %d failed", index, subindex, slave);
+        return NULL;
+    }
+    return PyBytes_FromStringAndSize((const char *)buffer, size);
+}
+
+// sdo_write(slave, index, subindex, data) -> None
+static PyObject *erob_rt_sdo_write(PyObject *, PyObject *args) {
+    int slave, index, subindex;
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "iiiy*", &slave, &index, &subindex, &data)) {
+        return NULL;
+    }
+    if (slave < 1 || slave > ec_slavecount) {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "invalid slave");
+        return NULL;
+    }
+    int wkc;
+    Py_BEGIN_ALLOW_THREADS
+    wkc = ec_SDOwrite((uint16)slave, (uint16)index, (uint8)subindex, FALSE, (int)data.len, data.buf, EC_TIMEOUTSAFE);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
+    if (wkc <= 0) {
+        PyErr_Format(PyExc_IOError, "SDO write 0x%04X:%02X to slave %d failed", index, subindex, slave);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// One PDO as a list of (name, byte offset, byte size, signed)
+template <size_t N>
+static PyObject *pdo_entries(const uint32 (&mapping)[N], const char *const (&names)[N], const bool (&is_signed)[N]) {
+    PyObject *entries = PyList_New(N);
+    if (entries == NULL) {
+        return NULL;
+    }
+    for (size_t k = 0; k < N; k++) {
+        PyObject *entry = Py_BuildValue("(sIIO)", names[k], pdo_entry_offset(mapping, k),
+                                        (mapping[k] & 0xFF) / 8, is_signed[k] ? Py_True : Py_False);
+        if (entry == NULL) {
+            Py_DECREF(entries);
+            return NULL;
+        }
+        PyList_SET_ITEM(entries, k, entry);
+    }
+    return entries;
+}
+
+// pdo_layout() -> {"rx": [...], "tx": [...]}
+static PyObject *erob_rt_pdo_layout(PyObject *, PyObject *) {
+    return Py_BuildValue("{sNsN}", "rx", pdo_entries(rxpdo_mapping, rxpdo_names, rxpdo_signed),
+                         "tx", pdo_entries(txpdo_mapping, txpdo_names, txpdo_signed));
+}
+
+static PyMethodDef erob_rt_methods[] = {
+    {"start", (PyCFunction)(void (*)(void))erob_rt_start, METH_VARARGS | METH_KEYWORDS,
+     "start(ifname=None, cycle_us=0, config=None, faults=None): bring the network to OP and start the real-time threads"},
+    {"stop", erob_rt_stop, METH_NOARGS, "stop(): stop the real-time threads and close the network"},
+    {"command", erob_rt_command, METH_VARARGS, "command(axis, mode, value): setpoint in CSP(8)/CSV(9)/CST(10)"},
+    {"setpoint", erob_rt_setpoint, METH_VARARGS, "setpoint(axis, position): CSP target position"},
+    {"controlword", erob_rt_controlword, METH_VARARGS, "controlword(axis, cw): override the controlword"},
+    {"release", erob_rt_release, METH_VARARGS, "release(axis): return the controlword to the built-in state machine"},
+    {"telemetry", erob_rt_telemetry, METH_NOARGS, "telemetry() -> (cycle, wkc, [(input, cw, target, state, mode)])"},
+    {"dc_status", erob_rt_dc_status, METH_NOARGS, "dc_status() -> dict of DC sync lock state and offsets"},
+    {"recovery", erob_rt_recovery, METH_NOARGS, "recovery() -> [dict per slave] of slave recovery state and latency"},
+    {"budget", erob_rt_budget, METH_NOARGS, "budget() -> dict of late/dropped cycles and shed stages"},
+    {"slave_count", erob_rt_slave_count, METH_NOARGS, "slave_count() -> int"},
+    {"expected_wkc", erob_rt_expected_wkc, METH_NOARGS, "expected_wkc() -> int"},
+    {"states", erob_rt_states, METH_VARARGS, "states(refresh=True) -> (group_state, [(name, state, al_status)])"},
+    {"sdo_read", erob_rt_sdo_read, METH_VARARGS, "sdo_read(slave, index, subindex, size) -> bytes"},
+    {"sdo_write", erob_rt_sdo_write, METH_VARARGS, "sdo_write(slave, index, subindex, data)"},
+    {"pdo_layout", erob_rt_pdo_layout, METH_NOARGS, "pdo_layout() -> {'rx': [...], 'tx': [...]}"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef erob_rt_module = {
+    PyModuleDef_HEAD_INIT, "erob_rt", "eRob EtherCAT real-time loop", -1, erob_rt_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_erob_rt(void) {
+    needlf = FALSE;
+    inOP = FALSE;
+    start_ecatthread_thread = FALSE;
+    dorun = 0;
+    g_config.cpu_main = CPU_NONE; // The interpreter is not pinned; only the EtherCAT threads are
+    config_apply(&g_config);
+    return PyModule_Create(&erob_rt_module);
+}
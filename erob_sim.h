@@ -0,0 +1,902 @@
+/*
+ * Simulated eRob slaves for running eRob_CSP.cpp without a NIC or drives.
+ *
+ * Build with -DEROB_SIM. The SOEM calls the master uses (ec_init, ec_config_init, ec_config_map,
+ * ec_SDOread/ec_SDOwrite and their ecx_ variants, ec_writestate/ec_statecheck/ec_readstate, ec_BRD/ec_FPRD
+ * of the AL status, ec_FPWR, ec_send_processdata/ec_receive_processdata, ...) are redirected to an in-process transport that talks to
+ * EROB_SIM_SLAVES simulated drives. Each drive has
+ *   - a CoE object dictionary (SDO read/write, Complete Access on the PDO objects)
+ *   - PDO mapping through 0x1600/0x1A00 and 0x1C12/0x1C13, packed into IOmap like SOEM does
+ *   - the EtherCAT AL state machine (PRE-OP -> SAFE-OP needs a valid mapping, SAFE-OP -> OP needs
+ *     DC sync0 and cyclic process data, a sync manager watchdog drops back to SAFE-OP + ERROR)
+ *   - the CiA402 drive state machine and a first-order motor model for CSP, CSV and CST
+ * so erob_test runs the full bring-up and ecatthread runs its normal loop on any Linux box.
+ * The SOEM globals (ec_slave, ec_group, ec_slavecount, ec_DCtime) are still the library's own,
+ * so the program is still linked against SOEM:
+ *     g++ -std=c++17 -O2 -DEROB_SIM [-DEROB_SIM_SLAVES=4] eRob_CSP.cpp -lsoem -pthread
+ * sim_slave_set_lost() disconnects a drive to exercise ecatcheck; it comes back power-cycled, in INIT
+ * without its PDO assignment.
+ * Without EROB_SIM only the drive model (SimSlave, its object dictionary, sim_drive_step,
+ * sim_pack/sim_unpack) is defined; the loopback transport and the SDO benchmark of erob_bench.cpp
+ * run on it.
+ */
+
+#ifndef EROB_SIM_H
+#define EROB_SIM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "ethercat.h"
+
+#ifndef EROB_SIM_SLAVES
+#define EROB_SIM_SLAVES 1             // Number of simulated drives on the bus
+#endif
+#ifndef EROB_SIM_DC_DRIFT_PPM
+#define EROB_SIM_DC_DRIFT_PPM 0.0     // Reference clock drift against CLOCK_MONOTONIC
+#endif
+
+#define SIM_SLAVE_MAILBOX_US 500          // SDO request/response round trip
+#define SIM_SLAVE_MAX_OBJECTS 64          // Object dictionary entries per drive
+#define SIM_SLAVE_MAX_MAPPED 8            // Entries per PDO
+#define SIM_SLAVE_WATCHDOG_NS 100000000LL // Sync manager watchdog (100 ms without process data)
+#define SIM_SLAVE_VELOCITY_TAU 0.002      // Velocity loop time constant (s)
+#define SIM_SLAVE_POSITION_GAIN 300.0     // Position loop gain in CSP (1/s)
+#define SIM_SLAVE_TORQUE_ACCEL 1000.0     // Acceleration per torque unit (counts/s^2 per 0.1 % rated)
+#define SIM_SLAVE_FRICTION 2.0            // Viscous friction in CST (1/s)
+#define SIM_SLAVE_FOLLOWING_ERROR 100000  // Default following error window 0x6065 (counts)
+
+// Drive states (CiA402)
+enum SimDriveState : uint8 {
+    SIM_SWITCH_ON_DISABLED,
+    SIM_READY_TO_SWITCH_ON,
+    SIM_SWITCHED_ON,
+    SIM_OPERATION_ENABLED,
+    SIM_QUICK_STOP_ACTIVE,
+    SIM_FAULT
+};
+
+// One object dictionary entry. Values are kept as raw little-endian words of `bits` length.
+struct SimObject {
+    uint16 index;
+    uint8 subindex;
+    uint8 bits;
+    uint32 value;
+    bool writable;
+    bool preop_only; // PDO mapping/assignment: writable in PRE-OP only
+};
+
+// One mapped PDO entry, resolved at ec_config_map()
+struct SimMapped {
+    SimObject *object; // NULL for padding
+    uint8 bits;
+};
+
+struct SimSlave {
+    pthread_mutex_t lock;
+    SimObject objects[SIM_SLAVE_MAX_OBJECTS];
+    int object_count;
+
+    // EtherCAT side
+    uint16 al_state;     // EC_STATE_INIT .. EC_STATE_OPERATIONAL
+    bool al_error;
+    uint16 al_status_code;
+    bool lost;           // Does not answer frames or mailbox requests
+    bool mapped;         // Process image valid (ec_config_map succeeded for this slave)
+    bool dc_sync0;       // ecx_dcsync0 activated
+    SimMapped rx[SIM_SLAVE_MAX_MAPPED];
+    SimMapped tx[SIM_SLAVE_MAX_MAPPED];
+    int rx_count, tx_count;
+    uint8 *outputs, *inputs;
+    int obytes, ibytes;
+    uint8 frame_outputs[64]; // Outputs captured when the frame passed the slave
+    int64 last_frame_ns;
+
+    // Drive side
+    uint8 drive_state;
+    uint16 last_controlword;
+    double position, velocity; // counts, counts/s
+    int32 last_target;
+};
+
+inline int64 sim_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+inline SimObject *sim_object(SimSlave *s, uint16 index, uint8 subindex) {
+    for (int k = 0; k < s->object_count; k++) {
+        if (s->objects[k].index == index && s->objects[k].subindex == subindex) {
+            return &s->objects[k];
+        }
+    }
+    return NULL;
+}
+
+inline void sim_add_object(SimSlave *s, uint16 index, uint8 subindex, uint8 bits, uint32 value,
+                           bool writable, bool preop_only = false) {
+    if (s->object_count < SIM_SLAVE_MAX_OBJECTS) {
+        s->objects[s->object_count++] = {index, subindex, bits, value, writable, preop_only};
+    }
+}
+
+inline uint32 sim_get(SimSlave *s, uint16 index, uint8 subindex) {
+    SimObject *o = sim_object(s, index, subindex);
+    return o ? o->value : 0;
+}
+
+inline void sim_set(SimSlave *s, uint16 index, uint8 subindex, uint32 value) {
+    SimObject *o = sim_object(s, index, subindex);
+    if (o) {
+        o->value = o->bits < 32 ? value & ((1u << o->bits) - 1) : value;
+    }
+}
+
+// Power-on object dictionary. The default mapping is the 8/12 byte CSP layout the drives ship with.
+inline void sim_slave_reset(SimSlave *s, int slave) {
+    s->object_count = 0;
+    sim_add_object(s, 0x1000, 0x00, 32, 0x00020192, false);      // Device type: CiA402 servo
+    sim_add_object(s, 0x1018, 0x01, 32, 0x5A65726F, false);      // Vendor ID
+    sim_add_object(s, 0x1018, 0x02, 32, 0x00029252, false);      // Product code
+    sim_add_object(s, 0x1018, 0x03, 32, 0x00000001, false);      // Revision
+    sim_add_object(s, 0x1018, 0x04, 32, 0x10000 + slave, false); // Serial number
+
+    static const uint32 rx_default[] = {0x60400010, 0x607A0020, 0x60600008, 0x00000008};
+    static const uint32 tx_default[] = {0x60410010, 0x60640020, 0x606C0020, 0x60770010};
+    sim_add_object(s, 0x1600, 0x00, 8, 4, true, true);
+    for (int k = 0; k < SIM_SLAVE_MAX_MAPPED; k++) {
+        sim_add_object(s, 0x1600, k + 1, 32, k < 4 ? rx_default[k] : 0, true, true);
+    }
+    sim_add_object(s, 0x1A00, 0x00, 8, 4, true, true);
+    for (int k = 0; k < SIM_SLAVE_MAX_MAPPED; k++) {
+        sim_add_object(s, 0x1A00, k + 1, 32, k < 4 ? tx_default[k] : 0, true, true);
+    }
+    sim_add_object(s, 0x1C12, 0x00, 8, 1, true, true);
+    sim_add_object(s, 0x1C12, 0x01, 16, 0x1600, true, true);
+    sim_add_object(s, 0x1C13, 0x00, 8, 1, true, true);
+    sim_add_object(s, 0x1C13, 0x01, 16, 0x1A00, true, true);
+    sim_add_object(s, 0x1C32, 0x01, 16, 0, false);               // Sync type: 0 free run, 2 DC sync0
+    sim_add_object(s, 0x1C32, 0x02, 32, 0, false);               // Cycle time (ns)
+
+    sim_add_object(s, 0x603F, 0x00, 16, 0, false);               // Error code
+    sim_add_object(s, 0x6040, 0x00, 16, 0, true);                // Controlword
+    sim_add_object(s, 0x6041, 0x00, 16, 0x0040, false);          // Statusword
+    sim_add_object(s, 0x6060, 0x00, 8, 8, true);                 // Mode of operation
+    sim_add_object(s, 0x6061, 0x00, 8, 8, false);                // Mode of operation display
+    sim_add_object(s, 0x6064, 0x00, 32, 0, false);               // Actual position
+    sim_add_object(s, 0x6065, 0x00, 32, SIM_SLAVE_FOLLOWING_ERROR, true);
+    sim_add_object(s, 0x606C, 0x00, 32, 0, false);               // Actual velocity
+    sim_add_object(s, 0x6071, 0x00, 16, 0, true);                // Target torque
+    sim_add_object(s, 0x6077, 0x00, 16, 0, false);               // Actual torque
+    sim_add_object(s, 0x607A, 0x00, 32, 0, true);                // Target position
+    sim_add_object(s, 0x60FF, 0x00, 32, 0, true);                // Target velocity
+
+    s->al_state = EC_STATE_INIT;
+    s->al_error = false;
+    s->al_status_code = 0;
+    s->lost = false;
+    s->mapped = false;
+    s->dc_sync0 = false;
+    s->rx_count = s->tx_count = 0;
+    s->outputs = s->inputs = NULL;
+    s->obytes = s->ibytes = 0;
+    s->last_frame_ns = 0;
+    s->drive_state = SIM_SWITCH_ON_DISABLED;
+    s->last_controlword = 0;
+    s->position = 0.0;
+    s->velocity = 0.0;
+    s->last_target = 0;
+}
+
+inline void sim_al_error(SimSlave *s, uint16 state, uint16 code) {
+    s->al_state = state;
+    s->al_error = true;
+    s->al_status_code = code;
+}
+
+inline void sim_drive_fault(SimSlave *s, uint16 error_code) {
+    s->drive_state = SIM_FAULT;
+    s->velocity = 0.0;
+    sim_set(s, 0x603F, 0x00, error_code);
+}
+
+// Sync manager watchdog: OP without process data drops to SAFE-OP + ERROR (caller holds the lock)
+inline void sim_check_watchdog(SimSlave *s, int64 now) {
+    if (s->al_state == EC_STATE_OPERATIONAL && now - s->last_frame_ns > SIM_SLAVE_WATCHDOG_NS) {
+        sim_al_error(s, EC_STATE_SAFE_OP, 0x001B); // Sync manager watchdog
+        if (s->drive_state == SIM_OPERATION_ENABLED) {
+            sim_drive_fault(s, 0x8700);                 // Sync controller
+        }
+    }
+}
+
+inline int sim_resolve_pdo(SimSlave *s, uint16 assign, SimMapped *entries, int *count);
+
+// PRE-OP -> SAFE-OP: the assigned PDOs must still fill the process image ec_config_map laid out
+// (a power-cycled slave has lost its assignment until the master writes it again)
+inline bool sim_mapping_valid(SimSlave *s) {
+    return s->mapped && sim_resolve_pdo(s, 0x1C12, s->rx, &s->rx_count) == s->obytes &&
+           sim_resolve_pdo(s, 0x1C13, s->tx, &s->tx_count) == s->ibytes;
+}
+
+// AL state change request (caller holds the lock)
+inline void sim_request_state(SimSlave *s, uint16 request) {
+    if (request & EC_STATE_ACK) {
+        s->al_error = false;
+        s->al_status_code = 0;
+    } else if (s->al_error) {
+        return; // Errors must be acknowledged first
+    }
+    uint16 target = request & 0x0F;
+    if (target == s->al_state) {
+        return;
+    }
+    switch (target) {
+    case EC_STATE_INIT:
+    case EC_STATE_PRE_OP:
+        if (s->al_state == EC_STATE_OPERATIONAL && s->drive_state == SIM_OPERATION_ENABLED) {
+            sim_drive_fault(s, 0x8700);
+        }
+        s->al_state = target;
+        break;
+    case EC_STATE_SAFE_OP:
+        if (s->al_state == EC_STATE_INIT) {
+            sim_al_error(s, s->al_state, 0x0011); // Invalid requested state change
+        } else if (s->al_state == EC_STATE_PRE_OP ? !sim_mapping_valid(s) : !s->mapped) {
+            sim_al_error(s, s->al_state, 0x001D); // Invalid output configuration
+        } else {
+            if (s->al_state == EC_STATE_OPERATIONAL && s->drive_state == SIM_OPERATION_ENABLED) {
+                sim_drive_fault(s, 0x8700);
+            }
+            s->al_state = EC_STATE_SAFE_OP;
+        }
+        break;
+    case EC_STATE_OPERATIONAL:
+        if (s->al_state != EC_STATE_SAFE_OP) {
+            sim_al_error(s, s->al_state, 0x0011);
+        } else if (!s->dc_sync0) {
+            sim_al_error(s, EC_STATE_SAFE_OP, 0x0030); // Invalid DC SYNC configuration
+        } else if (sim_now_ns() - s->last_frame_ns > SIM_SLAVE_WATCHDOG_NS) {
+            sim_al_error(s, EC_STATE_SAFE_OP, 0x001B); // No valid outputs
+        } else {
+            s->al_state = EC_STATE_OPERATIONAL;
+        }
+        break;
+    default:
+        sim_al_error(s, s->al_state, 0x0011);
+        break;
+    }
+}
+
+// CiA402 state machine on the controlword (caller holds the lock)
+inline void sim_drive_controlword(SimSlave *s, uint16 cw) {
+    bool fault_reset = (cw & 0x0080) && !(s->last_controlword & 0x0080);
+    s->last_controlword = cw;
+    bool disable_voltage = (cw & 0x0002) == 0;
+    bool quick_stop = (cw & 0x0006) == 0x0002;
+    bool shutdown = (cw & 0x0087) == 0x0006;
+    bool switch_on = (cw & 0x008F) == 0x0007;
+    bool enable = (cw & 0x008F) == 0x000F;
+
+    switch (s->drive_state) {
+    case SIM_FAULT:
+        if (fault_reset) {
+            s->drive_state = SIM_SWITCH_ON_DISABLED;
+            sim_set(s, 0x603F, 0x00, 0);
+        }
+        break;
+    case SIM_SWITCH_ON_DISABLED:
+        if (shutdown) s->drive_state = SIM_READY_TO_SWITCH_ON;
+        break;
+    case SIM_READY_TO_SWITCH_ON:
+        if (disable_voltage || quick_stop) s->drive_state = SIM_SWITCH_ON_DISABLED;
+        else if (switch_on) s->drive_state = SIM_SWITCHED_ON;
+        else if (enable) s->drive_state = SIM_OPERATION_ENABLED;
+        break;
+    case SIM_SWITCHED_ON:
+        if (disable_voltage || quick_stop) s->drive_state = SIM_SWITCH_ON_DISABLED;
+        else if (shutdown) s->drive_state = SIM_READY_TO_SWITCH_ON;
+        else if (enable) s->drive_state = SIM_OPERATION_ENABLED;
+        break;
+    case SIM_OPERATION_ENABLED:
+        if (disable_voltage) s->drive_state = SIM_SWITCH_ON_DISABLED;
+        else if (quick_stop) s->drive_state = SIM_QUICK_STOP_ACTIVE;
+        else if (shutdown) s->drive_state = SIM_READY_TO_SWITCH_ON;
+        else if (switch_on) s->drive_state = SIM_SWITCHED_ON;
+        break;
+    case SIM_QUICK_STOP_ACTIVE:
+        if (disable_voltage) s->drive_state = SIM_SWITCH_ON_DISABLED;
+        break;
+    }
+}
+
+inline uint16 sim_statusword(const SimSlave *s) {
+    switch (s->drive_state) {
+    case SIM_READY_TO_SWITCH_ON: return 0x0221;
+    case SIM_SWITCHED_ON:        return 0x0233;
+    case SIM_OPERATION_ENABLED:  return 0x0237;
+    case SIM_QUICK_STOP_ACTIVE:  return 0x0217;
+    case SIM_FAULT:              return 0x0208;
+    default:                     return 0x0240;
+    }
+}
+
+// Advance the motor model by dt seconds (caller holds the lock)
+inline void sim_drive_step(SimSlave *s, double dt) {
+    sim_drive_controlword(s, (uint16)sim_get(s, 0x6040, 0x00));
+    uint8 mode = (uint8)sim_get(s, 0x6060, 0x00);
+    int32 target = (int32)sim_get(s, 0x607A, 0x00);
+    double previous_velocity = s->velocity;
+    double torque = 0.0;
+
+    if (s->drive_state != SIM_OPERATION_ENABLED) {
+        s->velocity = 0.0; // Brake engaged
+        s->last_target = (int32)lround(s->position);
+    } else if (dt > 0.0) {
+        double alpha = 1.0 - exp(-dt / SIM_SLAVE_VELOCITY_TAU);
+        if (mode == 8) {
+            // CSP: feed-forward from the target increment plus a proportional position loop
+            double command = (double)(target - s->last_target) / dt + SIM_SLAVE_POSITION_GAIN * (target - s->position);
+            s->velocity += (command - s->velocity) * alpha;
+            if (fabs(target - s->position) > (double)sim_get(s, 0x6065, 0x00)) {
+                sim_drive_fault(s, 0x8611); // Following error
+            }
+        } else if (mode == 9) {
+            double command = (double)(int32)sim_get(s, 0x60FF, 0x00);
+            s->velocity += (command - s->velocity) * alpha;
+        } else if (mode == 10) {
+            torque = (double)(int16)sim_get(s, 0x6071, 0x00);
+            s->velocity += (torque * SIM_SLAVE_TORQUE_ACCEL - SIM_SLAVE_FRICTION * s->velocity) * dt;
+        }
+        s->position += s->velocity * dt;
+        s->last_target = target;
+        if (mode != 10) {
+            torque = (s->velocity - previous_velocity) / dt / SIM_SLAVE_TORQUE_ACCEL;
+        }
+    }
+    torque = torque > 32767.0 ? 32767.0 : (torque < -32768.0 ? -32768.0 : torque);
+
+    sim_set(s, 0x6041, 0x00, sim_statusword(s));
+    sim_set(s, 0x6061, 0x00, mode);
+    sim_set(s, 0x6064, 0x00, (uint32)(int32)lround(s->position));
+    sim_set(s, 0x606C, 0x00, (uint32)(int32)lround(s->velocity));
+    sim_set(s, 0x6077, 0x00, (uint32)(int16)lround(torque));
+}
+
+// Copy mapped entries between the object dictionary and a byte-aligned process image
+inline void sim_unpack(SimMapped *entries, int count, const uint8 *image) {
+    int offset = 0;
+    for (int k = 0; k < count; k++) {
+        int bytes = entries[k].bits / 8;
+        if (entries[k].object) {
+            uint32 value = 0;
+            for (int b = 0; b < bytes; b++) {
+                value |= (uint32)image[offset + b] << (8 * b);
+            }
+            entries[k].object->value = value;
+        }
+        offset += bytes;
+    }
+}
+
+inline void sim_pack(const SimMapped *entries, int count, uint8 *image) {
+    int offset = 0;
+    for (int k = 0; k < count; k++) {
+        int bytes = entries[k].bits / 8;
+        uint32 value = entries[k].object ? entries[k].object->value : 0;
+        for (int b = 0; b < bytes; b++) {
+            image[offset + b] = (uint8)(value >> (8 * b));
+        }
+        offset += bytes;
+    }
+}
+
+// Resolve the PDO assigned through `assign` (0x1C12/0x1C13). Returns the image size in bytes, -1 if invalid.
+inline int sim_resolve_pdo(SimSlave *s, uint16 assign, SimMapped *entries, int *count) {
+    *count = 0;
+    if (sim_get(s, assign, 0x00) != 1) {
+        return -1;
+    }
+    uint16 pdo = (uint16)sim_get(s, assign, 0x01);
+    uint32 n = sim_get(s, pdo, 0x00);
+    if (!sim_object(s, pdo, 0x00) || n > SIM_SLAVE_MAX_MAPPED) {
+        return -1;
+    }
+    int bits = 0;
+    for (uint32 k = 1; k <= n; k++) {
+        uint32 word = sim_get(s, pdo, (uint8)k);
+        uint16 index = (uint16)(word >> 16);
+        uint8 length = (uint8)(word & 0xFF);
+        SimObject *object = index ? sim_object(s, index, (uint8)(word >> 8)) : NULL;
+        if ((length % 8) != 0 || (index && (!object || object->bits != length))) {
+            return -1;
+        }
+        entries[*count].object = object;
+        entries[*count].bits = length;
+        (*count)++;
+        bits += length;
+    }
+    return bits / 8;
+}
+
+// SDO download into the object dictionary (caller holds the lock). Returns 1, or 0 for an SDO abort.
+inline int sim_sdo_download(SimSlave *s, uint16 index, uint8 subindex, boolean CA, int psize, const void *p) {
+    const uint8 *bytes = (const uint8 *)p;
+    if (CA) {
+        // Complete Access from subindex 0: {count, padding, entries...}
+        SimObject *count = sim_object(s, index, 0x00);
+        SimObject *first = sim_object(s, index, 0x01);
+        int entry_bytes = first ? first->bits / 8 : 0;
+        if (subindex != 0 || !count || !first || psize < 2 || psize != 2 + bytes[0] * entry_bytes ||
+            bytes[0] > SIM_SLAVE_MAX_MAPPED || (count->preop_only && s->al_state != EC_STATE_PRE_OP)) {
+            return 0;
+        }
+        for (int e = 0; e < bytes[0]; e++) {
+            uint32 value = 0;
+            for (int b = 0; b < entry_bytes; b++) {
+                value |= (uint32)bytes[2 + e * entry_bytes + b] << (8 * b);
+            }
+            sim_set(s, index, (uint8)(e + 1), value);
+        }
+        count->value = bytes[0];
+        return 1;
+    }
+    SimObject *o = sim_object(s, index, subindex);
+    if (!o || !o->writable || psize != o->bits / 8 || (o->preop_only && s->al_state != EC_STATE_PRE_OP)) {
+        return 0;
+    }
+    uint32 value = 0;
+    for (int b = 0; b < psize; b++) {
+        value |= (uint32)bytes[b] << (8 * b);
+    }
+    o->value = value;
+    return 1;
+}
+
+// SDO upload of one subindex (caller holds the lock). Returns 1, or 0 for an SDO abort.
+inline int sim_sdo_upload(SimSlave *s, uint16 index, uint8 subindex, int *psize, void *p) {
+    SimObject *o = sim_object(s, index, subindex);
+    int size = o ? o->bits / 8 : 0;
+    if (!o || *psize < size) {
+        return 0;
+    }
+    uint8 *bytes = (uint8 *)p;
+    for (int b = 0; b < size; b++) {
+        bytes[b] = (uint8)(o->value >> (8 * b));
+    }
+    *psize = size;
+    return 1;
+}
+
+#ifdef EROB_SIM
+//##################################################################################################
+// SOEM API of the simulated bus
+
+static SimSlave sim_slaves[EC_MAXSLAVE];
+static pthread_mutex_t sim_wire = PTHREAD_MUTEX_INITIALIZER; // One frame or mailbox transfer at a time
+static bool sim_frame_pending = false;
+static int sim_frame_wkc = 0;
+static int64 sim_frame_ns = 0;
+static int64 sim_dc_origin_ns = 0;
+
+// DC system time of the reference clock (first slave) at monotonic time `now`
+inline int64 sim_dc_time(int64 now) {
+    return now + (int64)((now - sim_dc_origin_ns) * (EROB_SIM_DC_DRIFT_PPM * 1e-6));
+}
+
+inline int sim_ec_init(const char *ifname) {
+    printf("EROB_SIM: %d simulated eRob slave(s) instead of %s\n", EROB_SIM_SLAVES, ifname);
+    for (int i = 0; i < EC_MAXSLAVE; i++) {
+        pthread_mutex_init(&sim_slaves[i].lock, NULL);
+    }
+    sim_frame_pending = false;
+    sim_dc_origin_ns = sim_now_ns();
+    return 1;
+}
+
+inline void sim_ec_close(void) {
+    sim_frame_pending = false;
+}
+
+inline int sim_ec_config_init(uint8 usetable) {
+    (void)usetable;
+    ec_slavecount = EROB_SIM_SLAVES < EC_MAXSLAVE - 1 ? EROB_SIM_SLAVES : EC_MAXSLAVE - 1;
+    memset(&ec_slave[0], 0, sizeof(ec_slave[0]));
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        sim_slave_reset(s, i);
+        s->al_state = EC_STATE_PRE_OP;
+        pthread_mutex_unlock(&s->lock);
+
+        memset(&ec_slave[i], 0, sizeof(ec_slave[i]));
+        ec_slave[i].state = EC_STATE_PRE_OP;
+        ec_slave[i].configadr = 0x1000 + i;
+        ec_slave[i].eep_man = 0x5A65726F;
+        ec_slave[i].eep_id = 0x00029252;
+        ec_slave[i].eep_rev = 1;
+        ec_slave[i].CoEdetails = ECT_COEDET_SDO | ECT_COEDET_SDOCA;
+        ec_slave[i].hasdc = TRUE;
+        ec_slave[i].group = 0;
+        snprintf(ec_slave[i].name, sizeof(ec_slave[i].name), "ZeroErr Driver (sim)");
+    }
+    ec_slave[0].state = EC_STATE_PRE_OP;
+    return ec_slavecount;
+}
+
+inline int sim_ec_config_map(void *pIOmap) {
+    // SOEM layout: the outputs of all slaves first, then all inputs
+    uint8 *image = (uint8 *)pIOmap;
+    int obytes = 0, ibytes = 0;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        s->obytes = sim_resolve_pdo(s, 0x1C12, s->rx, &s->rx_count);
+        s->ibytes = sim_resolve_pdo(s, 0x1C13, s->tx, &s->tx_count);
+        s->mapped = s->obytes >= 0 && s->ibytes >= 0 && s->obytes <= (int)sizeof(s->frame_outputs);
+        if (!s->mapped) {
+            s->obytes = s->ibytes = 0;
+        }
+        obytes += s->obytes;
+        ibytes += s->ibytes;
+        pthread_mutex_unlock(&s->lock);
+    }
+    int offset_out = 0, offset_in = obytes;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        s->outputs = s->obytes ? image + offset_out : NULL;
+        s->inputs = s->ibytes ? image + offset_in : NULL;
+        ec_slave[i].Obytes = s->obytes;
+        ec_slave[i].Obits = s->obytes * 8;
+        ec_slave[i].outputs = s->outputs;
+        ec_slave[i].Ostartbit = 0;
+        ec_slave[i].Ibytes = s->ibytes;
+        ec_slave[i].Ibits = s->ibytes * 8;
+        ec_slave[i].inputs = s->inputs;
+        ec_slave[i].Istartbit = 0;
+        offset_out += s->obytes;
+        offset_in += s->ibytes;
+    }
+    memset(image, 0, obytes + ibytes);
+    ec_slave[0].outputs = image;
+    ec_slave[0].Obytes = obytes;
+    ec_slave[0].inputs = image + obytes;
+    ec_slave[0].Ibytes = ibytes;
+    ec_group[0].outputs = image;
+    ec_group[0].Obytes = obytes;
+    ec_group[0].inputs = image + obytes;
+    ec_group[0].Ibytes = ibytes;
+    ec_group[0].outputsWKC = 0;
+    ec_group[0].inputsWKC = 0;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        ec_group[0].outputsWKC += sim_slaves[i].obytes > 0;
+        ec_group[0].inputsWKC += sim_slaves[i].ibytes > 0;
+    }
+    return obytes + ibytes;
+}
+
+inline boolean sim_ec_configdc(void) {
+    for (int i = 1; i <= ec_slavecount; i++) {
+        ec_slave[i].hasdc = TRUE;
+        ec_slave[i].pdelay = 100 * (i - 1); // ~100 ns propagation delay per hop
+    }
+    ec_slave[0].hasdc = ec_slavecount > 0;
+    return ec_slave[0].hasdc;
+}
+
+inline void sim_ecx_dcsync0(ecx_contextt *context, uint16 slave, boolean act, uint32 CyclTime, int32 CyclShift) {
+    (void)context;
+    (void)CyclShift;
+    if (slave < 1 || slave > ec_slavecount) {
+        return;
+    }
+    SimSlave *s = &sim_slaves[slave];
+    pthread_mutex_lock(&s->lock);
+    s->dc_sync0 = act;
+    sim_set(s, 0x1C32, 0x01, act ? 2 : 0);
+    sim_set(s, 0x1C32, 0x02, act ? CyclTime : 0);
+    pthread_mutex_unlock(&s->lock);
+    ec_slave[slave].DCactive = act;
+}
+
+inline int sim_ec_readstate(void) {
+    int64 now = sim_now_ns();
+    uint16 lowest = EC_STATE_OPERATIONAL;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        sim_check_watchdog(s, now);
+        if (s->lost) {
+            ec_slave[i].state = EC_STATE_NONE;
+            ec_slave[i].ALstatuscode = 0;
+        } else {
+            ec_slave[i].state = s->al_state | (s->al_error ? EC_STATE_ERROR : 0);
+            ec_slave[i].ALstatuscode = s->al_status_code;
+        }
+        pthread_mutex_unlock(&s->lock);
+        if ((ec_slave[i].state & 0x0F) < lowest) {
+            lowest = ec_slave[i].state & 0x0F;
+        }
+    }
+    ec_slave[0].state = lowest;
+    return lowest;
+}
+
+// Broadcast register read of the AL status: the ORed state of all slaves, the working counter
+// is the number of slaves that answered
+inline int sim_ec_BRD(uint16 ADP, uint16 ADO, uint16 length, void *data, int timeout) {
+    (void)ADP;
+    (void)timeout;
+    if (ADO != ECT_REG_ALSTAT || length > 2) {
+        return 0;
+    }
+    int64 now = sim_now_ns();
+    uint16 state = 0;
+    int wkc = 0;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        sim_check_watchdog(s, now);
+        if (!s->lost) {
+            state |= s->al_state | (s->al_error ? EC_STATE_ERROR : 0);
+            wkc++;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    memcpy(data, &state, length);
+    return wkc;
+}
+
+// Register read of one slave; only the AL status block (ECT_REG_ALSTAT: status, reserved, status code)
+// is modelled. Returns the working counter: 0 if no slave has that address or it is disconnected.
+inline int sim_ec_FPRD(uint16 ADP, uint16 ADO, uint16 length, void *data, int timeout) {
+    (void)timeout;
+    int slave = 1;
+    while (slave <= ec_slavecount && ec_slave[slave].configadr != ADP) {
+        slave++;
+    }
+    if (slave > ec_slavecount || ADO != ECT_REG_ALSTAT || length > 6) {
+        return 0;
+    }
+    SimSlave *s = &sim_slaves[slave];
+    int wkc = 0;
+    pthread_mutex_lock(&s->lock);
+    sim_check_watchdog(s, sim_now_ns());
+    if (!s->lost) {
+        uint16 regs[3] = {(uint16)(s->al_state | (s->al_error ? EC_STATE_ERROR : 0)), 0, s->al_status_code};
+        memcpy(data, regs, length);
+        wkc = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return wkc;
+}
+
+// Register write of one slave. Sync manager and FMMU registers are accepted but not modelled: the
+// process image stays the one ec_config_map laid out. Returns 0 if the slave is disconnected.
+inline int sim_ec_FPWR(uint16 ADP, uint16 ADO, uint16 length, void *data, int timeout) {
+    (void)ADO;
+    (void)length;
+    (void)data;
+    (void)timeout;
+    int slave = 1;
+    while (slave <= ec_slavecount && ec_slave[slave].configadr != ADP) {
+        slave++;
+    }
+    if (slave > ec_slavecount) {
+        return 0;
+    }
+    SimSlave *s = &sim_slaves[slave];
+    pthread_mutex_lock(&s->lock);
+    int wkc = s->lost ? 0 : 1;
+    pthread_mutex_unlock(&s->lock);
+    return wkc;
+}
+
+// EEPROM access back to the slave (PDI); the simulated slaves have no EEPROM
+inline int sim_ec_eeprom2pdi(uint16 slave) {
+    (void)slave;
+    return 1;
+}
+
+inline int sim_ec_writestate(uint16 slave) {
+    for (int i = 1; i <= ec_slavecount; i++) {
+        if (slave != 0 && i != slave) {
+            continue;
+        }
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        if (!s->lost) {
+            sim_request_state(s, slave == 0 ? ec_slave[0].state : ec_slave[i].state);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return 1;
+}
+
+inline uint16 sim_ec_statecheck(uint16 slave, uint16 reqstate, int timeout) {
+    int64 deadline = sim_now_ns() + (int64)timeout * 1000;
+    uint16 state;
+    do {
+        sim_ec_readstate();
+        state = ec_slave[slave].state;
+        if (state == reqstate || sim_now_ns() >= deadline) {
+            break;
+        }
+        osal_usleep(1000);
+    } while (true);
+    return state;
+}
+
+inline int sim_ec_SDOwrite(uint16 slave, uint16 index, uint8 subindex, boolean CA, int psize, const void *p, int timeout) {
+    (void)timeout;
+    if (slave < 1 || slave > ec_slavecount) {
+        return 0;
+    }
+    pthread_mutex_lock(&sim_wire);
+    osal_usleep(SIM_SLAVE_MAILBOX_US / 10);
+    pthread_mutex_unlock(&sim_wire);
+    osal_usleep(SIM_SLAVE_MAILBOX_US);
+
+    SimSlave *s = &sim_slaves[slave];
+    pthread_mutex_lock(&s->lock);
+    int wkc = s->lost ? 0 : sim_sdo_download(s, index, subindex, CA, psize, p);
+    pthread_mutex_unlock(&s->lock);
+    return wkc;
+}
+
+inline int sim_ec_SDOread(uint16 slave, uint16 index, uint8 subindex, boolean CA, int *psize, void *p, int timeout) {
+    (void)CA;
+    (void)timeout;
+    if (slave < 1 || slave > ec_slavecount) {
+        return 0;
+    }
+    pthread_mutex_lock(&sim_wire);
+    osal_usleep(SIM_SLAVE_MAILBOX_US / 10);
+    pthread_mutex_unlock(&sim_wire);
+    osal_usleep(SIM_SLAVE_MAILBOX_US);
+
+    SimSlave *s = &sim_slaves[slave];
+    pthread_mutex_lock(&s->lock);
+    int wkc = s->lost ? 0 : sim_sdo_upload(s, index, subindex, psize, p);
+    pthread_mutex_unlock(&s->lock);
+    return wkc;
+}
+
+// The master's SDO workers call the context variants; the simulation has no error list to fill
+inline int sim_ecx_SDOwrite(ecx_contextt *context, uint16 slave, uint16 index, uint8 subindex, boolean CA, int psize,
+                            const void *p, int timeout) {
+    (void)context;
+    return sim_ec_SDOwrite(slave, index, subindex, CA, psize, p, timeout);
+}
+
+inline int sim_ecx_SDOread(ecx_contextt *context, uint16 slave, uint16 index, uint8 subindex, boolean CA, int *psize,
+                           void *p, int timeout) {
+    (void)context;
+    return sim_ec_SDOread(slave, index, subindex, CA, psize, p, timeout);
+}
+
+// The frame passes all slaves when it is sent: each captures its outputs and adds to the working counter
+inline int sim_ec_send_processdata(void) {
+    pthread_mutex_lock(&sim_wire);
+    int64 now = sim_now_ns();
+    int frame_wkc = 0;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        sim_check_watchdog(s, now);
+        if (!s->lost && s->mapped && (s->al_state == EC_STATE_SAFE_OP || s->al_state == EC_STATE_OPERATIONAL)) {
+            if (s->al_state == EC_STATE_OPERATIONAL) {
+                memcpy(s->frame_outputs, s->outputs, s->obytes);
+                frame_wkc += 2;
+            }
+            frame_wkc += 1;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    sim_frame_wkc = frame_wkc;
+    sim_frame_ns = now;
+    sim_frame_pending = true;
+    ec_DCtime = sim_dc_time(now);
+    pthread_mutex_unlock(&sim_wire);
+    return 1;
+}
+
+// The slaves process the frame: apply the outputs, run the drive for the time since their last
+// frame and return their inputs
+inline int sim_ec_receive_processdata(int timeout) {
+    (void)timeout;
+    pthread_mutex_lock(&sim_wire);
+    if (!sim_frame_pending) {
+        pthread_mutex_unlock(&sim_wire);
+        return -1; // EC_NOFRAME
+    }
+    sim_frame_pending = false;
+    int64 now = sim_frame_ns;
+    for (int i = 1; i <= ec_slavecount; i++) {
+        SimSlave *s = &sim_slaves[i];
+        pthread_mutex_lock(&s->lock);
+        if (!s->lost && s->mapped && (s->al_state == EC_STATE_SAFE_OP || s->al_state == EC_STATE_OPERATIONAL)) {
+            if (s->al_state == EC_STATE_OPERATIONAL) {
+                sim_unpack(s->rx, s->rx_count, s->frame_outputs);
+            }
+            double dt = s->last_frame_ns ? (now - s->last_frame_ns) / 1e9 : 0.0;
+            sim_drive_step(s, dt > 0.1 ? 0.1 : dt);
+            sim_pack(s->tx, s->tx_count, s->inputs);
+            s->last_frame_ns = now;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    int frame_wkc = sim_frame_wkc;
+    pthread_mutex_unlock(&sim_wire);
+    return frame_wkc;
+}
+
+inline int sim_ec_recover_slave(uint16 slave, int timeout) {
+    (void)timeout;
+    SimSlave *s = &sim_slaves[slave];
+    pthread_mutex_lock(&s->lock);
+    int found = !s->lost;
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+inline char *sim_ec_ALstatuscode2string(uint16 ALstatuscode) {
+    static char text[][40] = {"No error", "Invalid requested state change", "Sync manager watchdog",
+                              "Invalid output configuration", "Invalid DC SYNC configuration", "Unspecified error"};
+    switch (ALstatuscode) {
+    case 0x0000: return text[0];
+    case 0x0011: return text[1];
+    case 0x001B: return text[2];
+    case 0x001D: return text[3];
+    case 0x0030: return text[4];
+    default: return text[5];
+    }
+}
+
+// Disconnect (lost = true) or reconnect a simulated slave, e.g. to exercise ecatcheck
+inline void sim_slave_set_lost(uint16 slave, bool lost) {
+    if (slave < 1 || slave > ec_slavecount) {
+        return;
+    }
+    SimSlave *s = &sim_slaves[slave];
+    pthread_mutex_lock(&s->lock);
+    s->lost = lost;
+    if (!lost) {
+        s->al_state = EC_STATE_INIT; // Power-on after reconnecting: PDO assignment and SYNC0 are gone
+        s->al_error = false;
+        s->al_status_code = 0;
+        s->dc_sync0 = false;
+        sim_set(s, 0x1C12, 0x00, 0);
+        sim_set(s, 0x1C13, 0x00, 0);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+#define ec_init sim_ec_init
+#define ec_close sim_ec_close
+#define ec_config_init sim_ec_config_init
+#define ec_config_map sim_ec_config_map
+#define ec_configdc sim_ec_configdc
+#define ecx_dcsync0 sim_ecx_dcsync0
+#define ec_readstate sim_ec_readstate
+#define ec_writestate sim_ec_writestate
+#define ec_BRD sim_ec_BRD
+#define ec_FPRD sim_ec_FPRD
+#define ec_FPWR sim_ec_FPWR
+#define ec_eeprom2pdi sim_ec_eeprom2pdi
+#define ec_statecheck sim_ec_statecheck
+#define ec_SDOwrite sim_ec_SDOwrite
+#define ec_SDOread sim_ec_SDOread
+#define ecx_SDOwrite sim_ecx_SDOwrite
+#define ecx_SDOread sim_ecx_SDOread
+#define ec_send_processdata sim_ec_send_processdata
+#define ec_receive_processdata sim_ec_receive_processdata
+#define ec_recover_slave sim_ec_recover_slave
+#define ec_ALstatuscode2string sim_ec_ALstatuscode2string
+
+#endif // EROB_SIM
+
+#endif // EROB_SIM_H
@@ -21,6 +21,12 @@ except ModuleNotFoundError:
     print("\nTip: If using conda environment, use 'python3' instead of '/bin/python3'")
     sys.exit(1)
 
+# Optional C++ real-time loop (python3 setup.py build_ext --inplace), used with --native
+try:
+    import erob_native
+except ImportError:
+    erob_native = None
+
 
 def get_state_name(state_code):
     """Convert state code to human-readable state name"""
@@ -842,6 +848,11 @@ def data_exchange_worker(master):
     This thread will continuously perform data exchange until _data_exchange_running is False
     """
     global _data_exchange_running
+
+    # The C++ loop sends the frames; only forward the shared variables to it
+    if getattr(master, 'native', False):
+        erob_native.exchange_worker(master, sys.modules[__name__])
+        return
     
     padding = 0
 
@@ -1832,6 +1843,52 @@ def main():
         print("Program ended")
 
 
+def main_native(ifname):
+    """Same flow as main(), with bring-up and cyclic exchange done by the C++ real-time loop (erob_rt)
+
+    STEP 1-9 run in erob_rt.start(); cyclic_operation_csp() then drives the state machine through
+    the _thread_* variables exactly as with pysoem.
+    """
+    print("=" * 60)
+    print("eRob EtherCAT CSP example (native real-time loop)")
+    print("=" * 60)
+
+    if erob_native is None:
+        print("Error: erob_rt extension not found")
+        print("Build it with: python3 setup.py build_ext --inplace")
+        return
+
+    check_permissions()
+    master = erob_native.NativeMaster()
+
+    try:
+        print(f"\nStarting real-time loop on {ifname} ({ETHERCAT_CYCLE_TIME_MS} ms cycle)")
+        if not master.open(ifname, cycle_time_ms=ETHERCAT_CYCLE_TIME_MS):
+            print("⚠ Warning: Not all slaves reached OP")
+        check_slave_states(master, show_all=True)
+
+        start_data_exchange_thread(master)
+        cyclic_operation_csp(master, duration=300, timeout_us=5000)
+        stop_data_exchange_thread()
+
+    except Exception as e:
+        print(f"\nError occurred: {e}")
+        import traceback
+        traceback.print_exc()
+
+    finally:
+        print("\nClosing master connection...")
+        try:
+            master.close()
+        except:
+            pass
+        print("Program ended")
+
+
 if __name__ == "__main__":
-    main()
+    # --native <ifname>: run the cyclic exchange in the C++ real-time loop instead of a Python thread
+    if len(sys.argv) > 2 and sys.argv[1] == "--native":
+        main_native(sys.argv[2])
+    else:
+        main()
 
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Build the erob_rt extension (C++ real-time loop for the pysoem examples)
+
+    python3 setup.py build_ext --inplace
+
+SOEM must be installed (headers under /usr/local/include/soem, libsoem in the linker path).
+Set SOEM_INCLUDE / SOEM_LIB to use another location. EROB_SIM=1 builds against the simulated
+slaves of erob_sim.h instead of the NIC. EROB_FAULT_INJECTION=1 compiles in the fault injection
+hooks of eRob_CSP.cpp.
+"""
+
+import os
+from setuptools import setup, Extension
+
+soem_include = os.environ.get("SOEM_INCLUDE", "/usr/local/include/soem")
+soem_lib = os.environ.get("SOEM_LIB", "/usr/local/lib")
+macros = [("EROB_SIM", "1")] if os.environ.get("EROB_SIM") else []
+if os.environ.get("EROB_FAULT_INJECTION"):
+    macros.append(("EROB_FAULT_INJECTION", "1"))
+
+erob_rt = Extension(
+    "erob_rt",
+    sources=["erob_rt_module.cpp"],
+    depends=["eRob_CSP.cpp", "erob_sim.h"],
+    define_macros=macros,
+    include_dirs=[soem_include],
+    library_dirs=[soem_lib],
+    libraries=["soem", "pthread", "rt"],
+    extra_compile_args=["-std=c++17", "-O2"],
+    language="c++",
+)
+
+setup(
+    name="erob_rt",
+    version="1.0",
+    description="eRob EtherCAT real-time loop for Python",
+    ext_modules=[erob_rt],
+    py_modules=["erob_native"],
+)